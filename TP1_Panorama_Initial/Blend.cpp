@@ -0,0 +1,700 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Blend.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86 1
+#include <emmintrin.h>
+#endif
+
+using namespace Imagine;
+using namespace std;
+
+static inline int clampTo(int i, int n) {
+    return i<0? 0: (i<n? i: n-1);
+}
+
+// Half size by the binomial filter (1 4 6 4 1)/16, border replicated.
+// Whole rows go through the vertical pass, then the horizontal pass
+// decimates; both inner loops are contiguous and free of clamping, and
+// the C channels of a are a constant, so the compiler vectorizes them.
+template <int C>
+static Plane reduce(const Plane& a, ThreadPool& pool) {
+    Plane r((a.w+1)/2, (a.h+1)/2, C);
+    const int c = C, n = a.w*c;
+    vector< vector<float> > tmp(pool.size(), vector<float>(n));
+    pool.run(r.h, [&](int y, int worker) {
+        const float* r0 = a.row(clampTo(2*y-2, a.h));
+        const float* r1 = a.row(clampTo(2*y-1, a.h));
+        const float* r2 = a.row(clampTo(2*y,   a.h));
+        const float* r3 = a.row(clampTo(2*y+1, a.h));
+        const float* r4 = a.row(clampTo(2*y+2, a.h));
+        float* t = &tmp[worker][0];
+        for(int i=0; i<n; i++)
+            t[i] = (r0[i]+r4[i]) + 4*(r1[i]+r3[i]) + 6*r2[i];
+        float* out = r.row(y);
+        for(int x=0; x<r.w; x++) {
+            if(x == 1 && 2*x+2 < a.w) { // Interior
+                for(; 2*x+2 < a.w; x++) {
+                    const float* tc = t + 2*x*c;
+                    for(int k=0; k<c; k++)
+                        out[x*c+k] = ((tc[k-2*c]+tc[k+2*c]) +
+                                      4*(tc[k-c]+tc[k+c]) + 6*tc[k])
+                                     * (1/256.f);
+                }
+                if(x == r.w)
+                    break;
+            }
+            const float* t0 = t + clampTo(2*x-2, a.w)*c;
+            const float* t1 = t + clampTo(2*x-1, a.w)*c;
+            const float* t2 = t + clampTo(2*x,   a.w)*c;
+            const float* t3 = t + clampTo(2*x+1, a.w)*c;
+            const float* t4 = t + clampTo(2*x+2, a.w)*c;
+            for(int k=0; k<c; k++)
+                out[x*c+k] = ((t0[k]+t4[k]) + 4*(t1[k]+t3[k]) + 6*t2[k])
+                             * (1/256.f);
+        }
+    });
+    return r;
+}
+
+// Row y of a, of C channels, expanded by the same filter to width w, into
+// out. Buffer t holds a.w*C values.
+template <int C>
+static void expandRow(const Plane& a, int y, int w, float* t, float* out) {
+    const int c = C, n = a.w*c;
+    const float* r0 = a.row(clampTo(y/2, a.h));
+    const float* rp = a.row(clampTo(y/2+1, a.h));
+    if(y%2 == 0) {
+        const float* rm = a.row(clampTo(y/2-1, a.h));
+        for(int i=0; i<n; i++)
+            t[i] = (rm[i] + 6*r0[i] + rp[i]) * (1/8.f);
+    } else
+        for(int i=0; i<n; i++)
+            t[i] = (r0[i] + rp[i]) * .5f;
+    for(int x=0; x<w; x++) {
+        if(x == 2 && x/2+1 < a.w) { // Interior, by pairs of columns
+            for(; x+1 < w && x/2+1 < a.w; x+=2) {
+                const float* tc = t + (x/2)*c;
+                float* o = out + x*c;
+                for(int k=0; k<c; k++) {
+                    o[k] = (tc[k-c] + 6*tc[k] + tc[k+c]) * (1/8.f);
+                    o[k+c] = (tc[k] + tc[k+c]) * .5f;
+                }
+            }
+            if(x == w)
+                break;
+        }
+        const float* t0 = t + clampTo(x/2, a.w)*c;
+        const float* tp = t + clampTo(x/2+1, a.w)*c;
+        const float* tm = t + clampTo(x/2-1, a.w)*c;
+        for(int k=0; k<c; k++)
+            out[x*c+k] = x%2==0? (tm[k] + 6*t0[k] + tp[k]) * (1/8.f):
+                                 (t0[k] + tp[k]) * .5f;
+    }
+}
+
+// Cost of a cut outside the overlap: the largest one inside
+static const float OUTSIDE = 3*255;
+
+// Seam costs sampled from both warped sources along canvas rows, with the
+// scratch rows of one worker
+class SeamCosts {
+public:
+    SeamCosts(const WarpSource& S1, const WarpMap& M1,
+              const WarpSource& S2, const WarpMap& M2)
+    : S1(S1), M1(M1), S2(S2), M2(M2) {}
+    // Costs of cuts at xBegin, xBegin+step... before xEnd, on row y.
+    // Coverage (1 for source 1, 2 for source 2, 3 for both) goes to cover
+    // if not null.
+    void sample(int y, int xBegin, int xEnd, int step, float* cost,
+                byte* cover=0) {
+        const int n = (xEnd-xBegin+step-1)/step;
+        const int span = (n-1)*step+1; // Every step-th pixel used
+        if(int(in1.size()) < span) {
+            rgb1.resize(3*span); rgb2.resize(3*span);
+            in1.resize(span); in2.resize(span);
+        }
+        warpRow(S1, M1, y, xBegin, xBegin+span, &rgb1[0], &in1[0]);
+        warpRow(S2, M2, y, xBegin, xBegin+span, &rgb2[0], &in2[0]);
+        for(int k=0; k<n; k++) {
+            int q = k*step;
+            if(cover)
+                cover[k] = byte(in1[q] | (in2[q]<<1));
+            if(! (in1[q] && in2[q])) {
+                cost[k] = OUTSIDE;
+                continue;
+            }
+            const byte *c1 = &rgb1[3*q], *c2 = &rgb2[3*q];
+            cost[k] = float(abs(c1[0]-c2[0]) + abs(c1[1]-c2[1]) +
+                            abs(c1[2]-c2[2]));
+        }
+    }
+    std::vector<float> row; // Costs of a row before they are transposed
+    std::vector<byte> rowCover;
+private:
+    const WarpSource& S1;
+    const WarpMap& M1;
+    const WarpSource& S2;
+    const WarpMap& M2;
+    std::vector<byte> rgb1, rgb2, in1, in2;
+};
+
+// Cheapest path through rows i of cells lo[i]..lo[i]+m-1, of costs
+// cost[i*m+k] for cell lo[i]+k, moving at most one cell between rows: the
+// cell of each row.
+static vector<int> cheapestPath(const vector<float>& cost,
+                                const vector<int>& lo, int m) {
+    const int n = int(lo.size());
+    vector<double> E(cost.begin(), cost.begin()+m), F(m);
+    vector<int> from(size_t(n)*m, 0);
+    for(int i=1; i<n; i++) {
+        int jump = -1; // Best cell of row i-1, if the bands part
+        for(int k=0; k<m; k++) {
+            int best = -1;
+            for(int d=-1; d<=1; d++) {
+                int kp = lo[i]+k+d-lo[i-1];
+                if(kp>=0 && kp<m && (best<0 || E[kp]<E[best]))
+                    best = kp;
+            }
+            if(best < 0) {
+                if(jump < 0)
+                    jump = int(min_element(E.begin(), E.end())-E.begin());
+                best = jump;
+            }
+            F[k] = cost[size_t(i)*m+k] + E[best];
+            from[size_t(i)*m+k] = best;
+        }
+        E.swap(F);
+    }
+    vector<int> path(n);
+    int k = int(min_element(E.begin(), E.end())-E.begin());
+    for(int i=n-1; i>=0; i--) {
+        path[i] = lo[i]+k;
+        k = from[size_t(i)*m+k];
+    }
+    return path;
+}
+
+Seam findSeam(const WarpSource& S1, const WarpMap& M1,
+              const WarpSource& S2, const WarpMap& M2,
+              int x0, int y0, int x1, int y1, ThreadPool& pool, int step) {
+    Seam seam;
+    if(x1<=x0 || y1<=y0)
+        return seam;
+    seam.vertical = y1-y0 >= x1-x0;
+    seam.x0 = x0; seam.y0 = y0; seam.x1 = x1; seam.y1 = y1;
+    // Extent [a0,a1) along the seam and [b0,b1) across it
+    const int a0 = seam.vertical? y0: x0, a1 = seam.vertical? y1: x1;
+    const int b0 = seam.vertical? x0: y0, b1 = seam.vertical? x1: y1;
+    step = max(1, step);
+    vector<SeamCosts> costs(pool.size(), SeamCosts(S1, M1, S2, M2));
+
+    // Coarse grid: cell centers a0+step*i+o, same across. Costs are always
+    // sampled along canvas rows: for a horizontal seam, the rows of the
+    // grid are its columns, transposed.
+    const int o = min(step/2, min(a1-a0, b1-b0)-1);
+    const int n = (a1-a0-o+step-1)/step, m = (b1-b0-o+step-1)/step;
+    vector<float> grid(size_t(n)*m);
+    vector<byte> cover(size_t(n)*m);
+    if(seam.vertical)
+        pool.run(n, [&](int i, int worker) {
+            costs[worker].sample(a0+step*i+o, b0+o, b1, step,
+                                 &grid[size_t(i)*m], &cover[size_t(i)*m]);
+        });
+    else
+        pool.run(m, [&](int k, int worker) {
+            SeamCosts& C = costs[worker];
+            C.row.resize(n);
+            C.rowCover.resize(n);
+            C.sample(b0+step*k+o, a0+o, a1, step, &C.row[0], &C.rowCover[0]);
+            for(int i=0; i<n; i++) {
+                grid[size_t(i)*m+k] = C.row[i];
+                cover[size_t(i)*m+k] = C.rowCover[i];
+            }
+        });
+    // Source 1 before the cut if it rather covers the first cells alone
+    int score = 0;
+    for(int i=0; i<n; i++) {
+        byte first = cover[size_t(i)*m], last = cover[size_t(i)*m+m-1];
+        score += (first==1) - (first==2) + (last==2) - (last==1);
+    }
+    seam.firstBefore = score >= 0;
+    vector<int> coarse = cheapestPath(grid, vector<int>(n, 0), m);
+
+    // Refinement in a band of width 2*step+1 around the coarse path,
+    // interpolated between the cell centers
+    const int w = min(2*step+1, b1-b0);
+    vector<int> lo(a1-a0);
+    for(int a=a0; a<a1; a++) {
+        float t = float(a-a0-o)/step;
+        int i = max(0, min(n-1, int(std::floor(t))));
+        int i2 = min(n-1, i+1);
+        float f = max(0.0f, min(1.0f, t-i));
+        float c = b0+o + step*(coarse[i] + f*(coarse[i2]-coarse[i]));
+        lo[a-a0] = max(b0, min(b1-w, int(c+.5f)-w/2));
+    }
+    vector<float> band(size_t(a1-a0)*w);
+    if(seam.vertical)
+        pool.run(a1-a0, [&](int i, int worker) {
+            costs[worker].sample(a0+i, lo[i], lo[i]+w, 1, &band[size_t(i)*w]);
+        });
+    else {
+        // Row y of the canvas crosses the band in columns first[y-b0] to
+        // last[y-b0], which are warped together and scattered
+        vector<int> first(b1-b0, a1-a0), last(b1-b0, -1);
+        for(int i=0; i<a1-a0; i++)
+            for(int t=0; t<w; t++) {
+                const int r = lo[i]+t-b0;
+                first[r] = min(first[r], i);
+                last[r] = max(last[r], i);
+            }
+        pool.run(b1-b0, [&](int r, int worker) {
+            if(last[r] < first[r])
+                return;
+            SeamCosts& C = costs[worker];
+            const int y = b0+r;
+            C.row.resize(last[r]-first[r]+1);
+            C.sample(y, a0+first[r], a0+last[r]+1, 1, &C.row[0]);
+            for(int i=first[r]; i<=last[r]; i++)
+                if(y >= lo[i] && y < lo[i]+w)
+                    band[size_t(i)*w + y-lo[i]] = C.row[i-first[r]];
+        });
+    }
+    seam.cut = cheapestPath(band, lo, w);
+    return seam;
+}
+
+// Pixel x, of n cells of 2^k pixels, lies between the centers of cells i
+// and i+1 at fraction f, f=0 beyond the first and last centers
+static void cellOf(int x, int k, int n, int& i, float& f) {
+    const float u = (x+.5f)/(1<<k) - .5f;
+    i = int(floor(u));
+    f = u-i;
+    if(i < 0 || i >= n-1) {
+        i = clampTo(i, n);
+        f = 0;
+    }
+}
+
+// Cells [j0,j1) of row y of the cells of P, of 2^k pixels, interpolated
+// into t, followed by a copy of the last cell of the row if j1 is P.w
+static void cellRow(const Plane& P, int k, int y, int j0, int j1, float* t) {
+    int i;
+    float f;
+    cellOf(y, k, P.h, i, f);
+    const float* r0 = P.row(i);
+    const float* r1 = P.row(min(i+1, P.h-1));
+    const int n = P.w*P.c;
+    for(int j=j0*P.c; j<j1*P.c; j++)
+        t[j] = r0[j] + f*(r1[j]-r0[j]);
+    if(j1 == P.w)
+        copy(t+n-P.c, t+n, t+n);
+}
+
+// Sums over n pixels of the differences of colors a and b, added to d
+static inline void sumDiffScalar(const byte* a, const byte* b, int n,
+                                 int* d) {
+    for(int j=0; j<3*n; j+=3)
+        for(int q=0; q<3; q++)
+            d[q] += int(a[j+q]) - b[j+q];
+}
+
+#ifdef BLEND_X86
+// Bytes of channel q of 16 pixels, from the 48 of v0, v1, v2, whose
+// channels start at 0, 1 and 2: m[q] masks bytes 3i+q of a vector
+__attribute__((target("sse2")))
+static inline __m128i channelOf(const __m128i* v, const __m128i* m, int q) {
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(v[0], m[q]),
+                                     _mm_and_si128(v[1], m[(q+2)%3])),
+                        _mm_and_si128(v[2], m[(q+1)%3]));
+}
+
+// Same sums, 16 pixels at a time, each channel summed by _mm_sad_epu8
+__attribute__((target("sse2")))
+static inline void sumDiffSse2(const byte* a, const byte* b, int n, int* d) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i m[3];
+    m[0] = _mm_setr_epi8(-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1);
+    m[1] = _mm_slli_si128(m[0], 1);
+    m[2] = _mm_slli_si128(m[0], 2);
+    __m128i acc[3] = {zero, zero, zero};
+    for(; n>=16; n-=16, a+=48, b+=48) {
+        __m128i va[3], vb[3];
+        for(int k=0; k<3; k++) {
+            va[k] = _mm_loadu_si128((const __m128i*)(a+16*k));
+            vb[k] = _mm_loadu_si128((const __m128i*)(b+16*k));
+        }
+        for(int q=0; q<3; q++)
+            acc[q] = _mm_add_epi32(acc[q], _mm_sub_epi32(
+                         _mm_sad_epu8(channelOf(va, m, q), zero),
+                         _mm_sad_epu8(channelOf(vb, m, q), zero)));
+    }
+    for(int q=0; q<3; q++)
+        d[q] += _mm_cvtsi128_si32(_mm_add_epi32(acc[q],
+                    _mm_shuffle_epi32(acc[q], _MM_SHUFFLE(1,0,3,2))));
+    sumDiffScalar(a, b, n, d);
+}
+#define sumDiff sumDiffSse2
+#else
+#define sumDiff sumDiffScalar
+#endif
+
+void BlendBand::reset(int ox0, int oy0, int ox1, int oy1, int levels,
+                      int w, int h) {
+    x0 = y0 = x1 = y1 = cw = ch = 0;
+    k = min(max(0, levels), MULTIBAND_FINE);
+    G.clear();
+    if(ox1<=ox0 || oy1<=oy0) {
+        cover.clear();
+        sums.clear();
+        return;
+    }
+    const int margin = 2 << max(0, levels);
+    x0 = max(0, ox0-margin); y0 = max(0, oy0-margin);
+    x1 = min(w, ox1+margin); y1 = min(h, oy1+margin);
+    cw = (x1-x0+(1<<k)-1) >> k;
+    ch = (y1-y0+(1<<k)-1) >> k;
+    cover.assign(size_t(x1-x0)*(y1-y0), 0);
+    sums.assign(size_t(y1-y0)*cw*8, 0.f);
+    ix.resize(x1-x0);
+    fx.resize(x1-x0);
+    for(int x=0; x<x1-x0; x++)
+        cellOf(x, k, cw, ix[x], fx[x]);
+}
+
+void BlendBand::featherMask(const WarpSource& S1, const WarpMap& M1,
+                            const WarpSource& S2, const WarpMap& M2) {
+    if(empty())
+        return;
+    const int s = 1<<k;
+    G.resize(size_t(ch)*(cw+1));
+    for(int i=0; i<ch; i++) {
+        const float y = y0 + i*s + (s-1)*.5f;
+        float* g = &G[size_t(i)*(cw+1)];
+        for(int j=0; j<cw; j++) {
+            const float x = x0 + j*s + (s-1)*.5f;
+            g[j] = featherWeight(M1, S1.width(), S1.height(), x, y) -
+                   featherWeight(M2, S2.width(), S2.height(), x, y);
+        }
+        g[cw] = g[cw-1];
+    }
+}
+
+void BlendBand::setCover(int y, int u, int v, int bx, bool in1, bool in2) {
+    u = max(u, x0); v = min(v, x1);
+    if(y<y0 || y>=y1 || u>=v)
+        return;
+    byte* c = &cover[size_t(y-y0)*(x1-x0)];
+    fill(c+(u-x0), c+(v-x0), byte(in1 | (in2<<1) | ((in1 && ! in2)<<2)));
+    if(in1 && ! in2)
+        addMask(y, u, v, bx);
+}
+
+void BlendBand::addMask(int y, int u, int v, int bx) {
+    for(int x=u; x<v; ) {
+        const int i = (x-x0) >> k, e = min(v, x0 + ((i+1) << k));
+        cellSums(y, i, bx)[3] += float(e-x);
+        x = e;
+    }
+}
+
+void BlendBand::addOverlap(int y, int u, int v, int bx,
+                           const byte* rgb1, const byte* rgb2) {
+    u = max(u, x0); v = min(v, x1);
+    if(y<y0 || y>=y1 || u>=v)
+        return;
+    for(int x=u; x<v; ) {
+        const int i = (x-x0) >> k, e = min(v, x0 + ((i+1) << k));
+        int d[3] = {0, 0, 0};
+        sumDiff(rgb1+3*(x-bx), rgb2+3*(x-bx), e-x, d);
+        x = e;
+        float* p = cellSums(y, i, bx);
+        for(int q=0; q<3; q++)
+            p[q] += float(d[q]);
+    }
+}
+
+int BlendBand::maskRun(int y, int u, int v, int bx, bool& first) {
+    int i;
+    float fy;
+    cellOf(y-y0, k, ch, i, fy);
+    const float* g0 = &G[size_t(i)*(cw+1)];
+    const float* g1 = &G[size_t(min(i+1, ch-1))*(cw+1)];
+    const int s = 1<<k, w = x1-x0;
+    u -= x0; v -= x0;
+    auto takes = [&](int x) {
+        const int j = ix[x];
+        const float a = g0[j] + fy*(g1[j]-g0[j]);
+        const float b = g0[j+1] + fy*(g1[j+1]-g0[j+1]);
+        return a + fx[x]*(b-a) >= 0;
+    };
+    first = takes(u);
+    // The difference is linear between two cell centers, so that it keeps
+    // its sign over the pixels between them if it has it at both ends
+    int e = u;
+    while(e < v) {
+        const int j = ix[e];
+        const int end = min(v, j == cw-1? w: (j+1)*s + s/2);
+        if(takes(e) == first && takes(end-1) == first) {
+            e = end;
+            continue;
+        }
+        while(takes(e) == first)
+            e++;
+        break;
+    }
+    if(first) {
+        byte* c = &cover[size_t(y-y0)*w];
+        for(int x=u; x<e; x++)
+            c[x] |= 4;
+        addMask(y, x0+u, x0+e, bx);
+    }
+    return x0+e;
+}
+
+// Pixels [u,v) of out covered by both sources, c=3, corrected by the
+// interpolation of the cells in t, 8 values per cell: the correction
+// where the mask is 0, then where it is 1, each padded to 4
+static inline void correctRun(Color* out, const byte* c, const float* t,
+                              const int* ix, const float* fx, int u, int v) {
+    for(int x=u; x<v; x++) {
+        if((c[x]&3) != 3)
+            continue;
+        const float* a = t + 8*ix[x] + 4*(c[x]>>2);
+        const float f = fx[x];
+        for(int j=0; j<3; j++) {
+            const float e = a[j] + f*(a[8+j]-a[j]);
+            out[x][j] = byte(min(255.f, max(0.f, out[x][j] + e + .5f)));
+        }
+    }
+}
+
+#ifdef BLEND_X86
+// Pixel p corrected by e, padded to 4: truncation then saturation give
+// the bytes of correctRun
+__attribute__((target("sse2")))
+static inline void correctPixelSse2(byte* p, __m128 e) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i q = _mm_cvtsi32_si128(p[0] | (p[1]<<8) | (p[2]<<16));
+    q = _mm_unpacklo_epi16(_mm_unpacklo_epi8(q, zero), zero);
+    __m128 r = _mm_add_ps(_mm_add_ps(_mm_cvtepi32_ps(q), e), _mm_set1_ps(.5f));
+    q = _mm_cvttps_epi32(r);
+    q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+    const int b = _mm_cvtsi128_si32(q);
+    p[0] = byte(b); p[1] = byte(b>>8); p[2] = byte(b>>16);
+}
+
+// Same pixels, with the same float operations. Over a run of pixels of
+// the same coverage between the same two cell centers, the 12 bytes of 4
+// pixels are corrected at once, their channels laid out as r g b r,
+// g b r g and b r g b.
+__attribute__((target("sse2")))
+static void correctRunSse2(Color* out, const byte* c, const float* t,
+                           const int* ix, const float* fx, int u, int v) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 half = _mm_set1_ps(.5f);
+    for(int x=u; x<v; ) {
+        if((c[x]&3) != 3) {
+            x++;
+            continue;
+        }
+        int e = x+1;
+        while(e<v && c[e] == c[x] && ix[e] == ix[x])
+            e++;
+        const float* a = t + 8*ix[x] + 4*(c[x]>>2);
+        const __m128 ea = _mm_loadu_ps(a);
+        const __m128 d = _mm_sub_ps(_mm_loadu_ps(a+8), ea);
+        const __m128 A[3] = {_mm_shuffle_ps(ea, ea, _MM_SHUFFLE(0,2,1,0)),
+                             _mm_shuffle_ps(ea, ea, _MM_SHUFFLE(1,0,2,1)),
+                             _mm_shuffle_ps(ea, ea, _MM_SHUFFLE(2,1,0,2))};
+        const __m128 D[3] = {_mm_shuffle_ps(d, d, _MM_SHUFFLE(0,2,1,0)),
+                             _mm_shuffle_ps(d, d, _MM_SHUFFLE(1,0,2,1)),
+                             _mm_shuffle_ps(d, d, _MM_SHUFFLE(2,1,0,2))};
+        for(; x+4<=e; x+=4) {
+            byte* p = &out[x][0];
+            const __m128 f = _mm_loadu_ps(fx+x);
+            const __m128 F[3] = {_mm_shuffle_ps(f, f, _MM_SHUFFLE(1,0,0,0)),
+                                 _mm_shuffle_ps(f, f, _MM_SHUFFLE(2,2,1,1)),
+                                 _mm_shuffle_ps(f, f, _MM_SHUFFLE(3,3,3,2))};
+            int last;
+            memcpy(&last, p+8, 4);
+            const __m128i o = _mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i*)p), _mm_cvtsi32_si128(last));
+            const __m128i o0 = _mm_unpacklo_epi8(o, zero);
+            const __m128i o1 = _mm_unpackhi_epi8(o, zero);
+            const __m128i q[3] = {_mm_unpacklo_epi16(o0, zero),
+                                  _mm_unpackhi_epi16(o0, zero),
+                                  _mm_unpacklo_epi16(o1, zero)};
+            __m128i r[3];
+            for(int k=0; k<3; k++) {
+                const __m128 ek = _mm_add_ps(A[k], _mm_mul_ps(F[k], D[k]));
+                r[k] = _mm_cvttps_epi32(_mm_add_ps(
+                    _mm_add_ps(_mm_cvtepi32_ps(q[k]), ek), half));
+            }
+            const __m128i b = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]),
+                                               _mm_packs_epi32(r[2], r[2]));
+            _mm_storel_epi64((__m128i*)p, b);
+            last = _mm_cvtsi128_si32(_mm_srli_si128(b, 8));
+            memcpy(p+8, &last, 4);
+        }
+        for(; x<e; x++)
+            correctPixelSse2(&out[x][0], _mm_add_ps(ea,
+                _mm_mul_ps(_mm_set1_ps(fx[x]), d)));
+    }
+}
+#define correct correctRunSse2
+#else
+#define correct correctRun
+#endif
+
+// Whether rounding leaves as they are the pixels of a cell of mask mean m
+// whose corrections are below B0 where the mask is 0, B1 where it is 1
+static inline bool unchanged(float B0, float B1, float m) {
+    return (B0 < .5f || m == 1) && (B1 < .5f || m == 0);
+}
+
+void blendMultiband(Image<Color,2>& I, BlendBand& band, int levels,
+                    ThreadPool& pool, const Seam* seam) {
+    if(band.empty())
+        return;
+    const int x0 = band.x0, y0 = band.y0, w = band.x1-x0, h = band.y1-y0;
+    const int k = band.k, s = 1<<k, cw = band.cw, ch = band.ch;
+    while(levels>k && min(w,h) < (4<<levels))
+        levels--;
+
+    // The blend of Laplacian pyramids L(I1) and L(I2) under mask m is
+    // I2 + collapse(m*L(D)) with D=I1-I2, 0 where one source covers. The
+    // levels finer than the cells are taken as one band, D-E(D), with E
+    // interpolating the means over the cells, so the blend is the source
+    // the mask takes plus E(R)-m*E(D), where R is the collapse of the
+    // levels of the cells. Only overlapping pixels are written back.
+    if(seam)
+        pool.run(h, [&](int y, int) {
+            byte* c = &band.cover[size_t(y)*w];
+            for(int x=0; x<w; x++)
+                if(c[x] == 3 && seam->takesFirst(x0+x, y0+y)) {
+                    c[x] |= 4;
+                    band.addMask(y0+y, x0+x, x0+x+1, x0);
+                }
+        });
+    vector<Plane> P(1, Plane(cw, ch, 4));
+    pool.run(ch, [&](int i, int) {
+        float* a = P[0].row(i);
+        const int ya = i*s, yb = min(h, ya+s);
+        for(int y=ya; y<yb; y++) {
+            const float* S = band.cellSums(y0+y, 0, x0);
+            for(int j=0; j<cw; j++)
+                for(int q=0; q<4; q++)
+                    a[4*j+q] += S[8*j+q] + S[8*j+4+q];
+        }
+        for(int j=0; j<cw; j++) {
+            const float n = float((min(w, (j+1)*s) - j*s) * (yb-ya));
+            for(int q=0; q<4; q++)
+                a[4*j+q] /= n;
+        }
+    });
+
+    // Collapse m*L(D) of the cells from the coarsest level:
+    // R = m*(D-E(Dn)) + E(Rn)
+    for(int l=k; l<levels; l++)
+        P.push_back(reduce<4>(P.back(), pool));
+    const Plane& Pt = P.back();
+    Plane R(Pt.w, Pt.h, 3);
+    for(size_t q=0; q<size_t(R.w)*R.h; q++)
+        for(int j=0; j<3; j++)
+            R.v[3*q+j] = Pt.v[4*q+3]*Pt.v[4*q+j];
+    vector< vector<float> > tmp(pool.size(), vector<float>(4*cw)),
+        ed(pool.size(), vector<float>(4*cw)),
+        er(pool.size(), vector<float>(3*cw));
+    for(int l=int(P.size())-2; l>=0; l--) {
+        const Plane& Pl = P[l];
+        const Plane& Pn = P[l+1];
+        Plane Rl(Pl.w, Pl.h, 3);
+        pool.run(Pl.h, [&](int y, int worker) {
+            float *t = &tmp[worker][0], *d = &ed[worker][0];
+            float* r = &er[worker][0];
+            expandRow<4>(Pn, y, Pl.w, t, d);
+            expandRow<3>(R, y, Pl.w, t, r);
+            const float* p = Pl.row(y);
+            float* v = Rl.row(y);
+            for(int x=0; x<Pl.w; x++)
+                for(int j=0; j<3; j++)
+                    v[3*x+j] = p[4*x+3]*(p[4*x+j]-d[4*x+j]) + r[3*x+j];
+        });
+        swap(R, Rl);
+    }
+
+    // Corrections at the cell centers of the pixels the mask gives to I2,
+    // E(R), and to I1, E(R-D). The pixels of a cell interpolate the
+    // centers of the cells around, so where these are below half a unit,
+    // rounding leaves the cut as it is and the cell is skipped.
+    Plane E(cw, ch, 8);
+    vector<float> b0(size_t(cw)*ch), b1(b0.size());
+    for(size_t q=0; q<b0.size(); q++)
+        for(int j=0; j<3; j++) {
+            E.v[8*q+j] = R.v[3*q+j];
+            E.v[8*q+4+j] = R.v[3*q+j] - P[0].v[4*q+j];
+            b0[q] = max(b0[q], fabs(E.v[8*q+j]));
+            b1[q] = max(b1[q], fabs(E.v[8*q+4+j]));
+        }
+    vector<byte> skip(b0.size());
+    for(int i=0; i<ch; i++)
+        for(int j=0; j<cw; j++) {
+            float B0 = 0, B1 = 0;
+            for(int a=max(0, i-1); a<=min(ch-1, i+1); a++)
+                for(int b=max(0, j-1); b<=min(cw-1, j+1); b++) {
+                    B0 = max(B0, b0[size_t(a)*cw+b]);
+                    B1 = max(B1, b1[size_t(a)*cw+b]);
+                }
+            skip[size_t(i)*cw+j] = unchanged(B0, B1, P[0].row(i)[4*j+3]);
+        }
+    vector< vector<float> > et(pool.size(), vector<float>(8*(cw+1)));
+    vector< vector<byte> > rs(pool.size(), vector<byte>(cw));
+    pool.run(h, [&](int y, int worker) {
+        const byte* cs = &skip[size_t(y>>k)*cw];
+        const int a = int(find(cs, cs+cw, 0) - cs);
+        if(a == cw)
+            return;
+        int b = cw;
+        while(cs[b-1])
+            b--;
+        float* t = &et[worker][0];
+        cellRow(E, k, y, max(0, a-1), min(cw, b+1), t);
+        // A row of a cell interpolates only the centers of its row
+        byte* sk = &rs[worker][0];
+        const float* M = P[0].row(y>>k);
+        for(int i=a; i<b; i++) {
+            sk[i] = cs[i];
+            if(sk[i])
+                continue;
+            float B0 = 0, B1 = 0;
+            for(int j=max(0, i-1); j<=min(cw-1, i+1); j++)
+                for(int q=0; q<3; q++) {
+                    B0 = max(B0, fabs(t[8*j+q]));
+                    B1 = max(B1, fabs(t[8*j+4+q]));
+                }
+            sk[i] = unchanged(B0, B1, M[4*i+3]);
+        }
+        const byte* c = &band.cover[size_t(y)*w];
+        Color* out = &I(x0, y0+y);
+        for(int i=a; i<b; ) {
+            if(sk[i]) {
+                i++;
+                continue;
+            }
+            const int u = i*s;
+            while(i<b && ! sk[i])
+                i++;
+            correct(out, c, t, &band.ix[0], &band.fx[0], u, min(w, i*s));
+        }
+    });
+}
@@ -0,0 +1,135 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Blending of the overlap of two warped sources.
+
+#ifndef PANORAMA_BLEND_H
+#define PANORAMA_BLEND_H
+
+#include "ThreadPool.h"
+#include "Warp.h"
+#include <algorithm>
+#include <vector>
+
+// How overlapping pixels are combined
+enum BlendMode {
+    BLEND_AVERAGE,  // Mean of the two sources
+    BLEND_FEATHER,  // Weighted by distance to the border of each source
+    BLEND_MULTIBAND // Laplacian pyramid blending of the overlap band
+};
+
+// Float image with c interleaved channels
+struct Plane {
+    int w, h, c;
+    std::vector<float> v;
+    Plane(int w0=0, int h0=0, int c0=1): w(w0), h(h0), c(c0),
+        v(size_t(w0)*h0*c0) {}
+    float* row(int y) { return &v[size_t(y)*w*c]; }
+    const float* row(int y) const { return &v[size_t(y)*w*c]; }
+};
+
+// Cells of 2^MULTIBAND_FINE pixels: the levels of the multi-band blend
+// finer than them are taken as one band, cut by the mask, so that only the
+// cells are decomposed. They must not be wider than a render tile.
+const int MULTIBAND_FINE = 4;
+
+// Band of the canvas over which the overlap is blended in several levels,
+// filled by the render pass while it has both sources warped, so that they
+// are not warped again and no color is kept. Per pixel of box
+// [x0,x1)x[y0,y1), the coverage, bit 0 for I1 and bit 1 for I2, and bit 2
+// if the pixel takes I1, in cover. Per row and cell of 2^k pixels, the
+// sums of D=I1-I2 over the overlap, in sums: a cell split between two
+// tiles has those of its first pixels in part 0, the others in part 1.
+struct BlendBand {
+    int x0, y0, x1, y1, k, cw, ch;
+    std::vector<Imagine::byte> cover;
+    std::vector<float> sums; // (Dr,Dg,Db,m) of parts 0 and 1 of each cell
+    std::vector<int> ix;   // Column x0+x lies between cell centers ix[x]
+    std::vector<float> fx; // and ix[x]+1, at fraction fx[x]
+    BlendBand(): x0(0), y0(0), x1(0), y1(0), k(0), cw(0), ch(0) {}
+    // Band of overlap box [ox0,ox1)x[oy0,oy1) of a w x h canvas, widened
+    // so that the coarsest of the given levels fades out inside it
+    void reset(int ox0, int oy0, int ox1, int oy1, int levels, int w, int h);
+    bool empty() const { return x1<=x0 || y1<=y0; }
+    // Mask of overlapping pixels for maskRun: they take I1 where the
+    // difference of the feathering weights of S1 mapped by M1 and S2
+    // mapped by M2, interpolated from the cell centers, is positive.
+    void featherMask(const WarpSource& S1, const WarpMap& M1,
+                     const WarpSource& S2, const WarpMap& M2);
+    // Pixels [u,v) of canvas row y, in the tile starting at column bx,
+    // covered by I1 if in1, by I2 if in2. Pixels covered by I1 alone take
+    // it, overlapping pixels I2 until their mask is set.
+    void setCover(int y, int u, int v, int bx, bool in1, bool in2);
+    // Overlapping pixels [u,v) of canvas row y, in the tile starting at
+    // column bx, of colors rgb1 and rgb2 from there: D added to the sums
+    void addOverlap(int y, int u, int v, int bx,
+                    const Imagine::byte* rgb1, const Imagine::byte* rgb2);
+    // Overlapping pixels [u,e) of canvas row y, in the tile starting at
+    // column bx, with e<=v the largest such that they all take I1, then
+    // first is true, or all I2. Their mask is set.
+    int maskRun(int y, int u, int v, int bx, bool& first);
+    // Sums of cell i of canvas row y, in the tile starting at column bx
+    float* cellSums(int y, int i, int bx) {
+        return &sums[(size_t(y-y0)*cw + i)*8 + (x0+(i<<k) < bx? 4: 0)];
+    }
+    // Mask of pixels [u,v) of canvas row y, in the tile starting at column
+    // bx, added to the sums
+    void addMask(int y, int u, int v, int bx);
+private:
+    std::vector<float> G;  // Weight differences at the cell centers
+};
+
+// Feathering weight of canvas pixel (x,y) mapped by M into a w x h
+// source: distance of the source point to the border of the source. As
+// sources are rectangles, this is their distance transform in closed form
+// (in source pixels, which is close to canvas pixels for moderate zoom).
+inline float featherWeight(const WarpMap& M, int w, int h, float x, float y) {
+    float X, Y, W;
+    warpPoint(M, x, y, X, Y, W);
+    float sx = X/W, sy = Y/W;
+    float d = std::min(std::min(sx+.5f, w-.5f-sx), std::min(sy+.5f, h-.5f-sy));
+    return std::max(d, 1e-3f);
+}
+
+// Cut through the overlap of two sources inside box [x0,x1)x[y0,y1). A
+// vertical seam has one cut per row y, cut[y-y0]: overlapping pixels
+// (x,y) with x<cut[y-y0] lie before it. A horizontal seam has one cut per
+// column x, before it meaning y<cut[x-x0]. Only per-row or per-column
+// positions are stored, never a mask.
+struct Seam {
+    bool vertical;
+    bool firstBefore; // Source 1 lies before the cut, else source 2
+    int x0, y0, x1, y1;
+    std::vector<int> cut;
+    Seam(): vertical(true), firstBefore(true), x0(0), y0(0), x1(0), y1(0) {}
+    bool empty() const { return cut.empty(); }
+    // Overlapping canvas pixel (x,y), inside the box, takes source 1
+    bool takesFirst(int x, int y) const {
+        bool before = vertical? x < cut[y-y0]: y < cut[x-x0];
+        return before == firstBefore;
+    }
+};
+
+// Cheapest seam through the overlap of S1 mapped by M1 and S2 mapped by
+// M2, whose bounding box is [x0,x1)x[y0,y1): vertical when the box is at
+// least as tall as wide, else horizontal. Cutting at a pixel costs the
+// sum of its channel differences, or 3*255 outside the overlap. The path
+// is found by dynamic programming on a grid of the given step, then again
+// at full resolution within step pixels of it, so the cost grows with the
+// box area over step, not with the canvas.
+Seam findSeam(const WarpSource& S1, const WarpMap& M1,
+              const WarpSource& S2, const WarpMap& M2,
+              int x0, int y0, int x1, int y1, ThreadPool& pool, int step=4);
+
+// Replace the overlapping pixels of band of canvas I with the multi-band
+// blend of the two sources in the given number of levels, fewer if the band
+// is too thin. The canvas holds the source each pixel takes: the cut is
+// corrected by the levels of the cells, where the correction reaches half
+// a unit. Overlapping pixels take I1 on its side of seam if not null, as
+// the canvas must already do, else as the mask of the band says.
+void blendMultiband(Imagine::Image<Imagine::Color,2>& I, BlendBand& band,
+                    int levels, ThreadPool& pool, const Seam* seam=0);
+
+#endif
@@ -0,0 +1,475 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Bundle.h"
+#include "Dense.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace Imagine;
+using namespace std;
+
+static const int CHUNK = 512; // Points per task
+
+// Point of the reference frame seen in two images, one per match
+struct Landmark {
+    int img[2];
+    double x[2][2]; // Observations in each image
+};
+
+// Linearization of one observation
+struct Observation {
+    double r[2];     // Residual, projection minus observation
+    double Jg[2][8]; // Derivative with respect to the image parameters
+    double Jp[2][2]; // Derivative with respect to the point
+    double W[8][2];  // Jg^T Jp
+};
+
+// Normal equations of a point: V = sum of Jp^T Jp (symmetric, 3 entries)
+// and b = sum of Jp^T r over its observations
+struct PointSystem {
+    double V[3], b[2];
+};
+
+// Point p mapped by the homography of parameters g (coefficient 8 is 1)
+// and compared to x. False if p falls behind the camera.
+static bool observe(const double* g, const double p[2], const double x[2],
+                    Observation& o, bool jacobian) {
+    double w = g[6]*p[0] + g[7]*p[1] + 1;
+    if(! (w > 1e-9))
+        return false;
+    double iw = 1/w;
+    double u = (g[0]*p[0] + g[1]*p[1] + g[2])*iw;
+    double v = (g[3]*p[0] + g[4]*p[1] + g[5])*iw;
+    o.r[0] = u - x[0];
+    o.r[1] = v - x[1];
+    if(! jacobian)
+        return true;
+    const double a = p[0]*iw, b = p[1]*iw;
+    const double du[8] = {a, b, iw, 0, 0, 0, -u*a, -u*b};
+    const double dv[8] = {0, 0, 0, a, b, iw, -v*a, -v*b};
+    copy(du, du+8, o.Jg[0]);
+    copy(dv, dv+8, o.Jg[1]);
+    o.Jp[0][0] = (g[0] - u*g[6])*iw;
+    o.Jp[0][1] = (g[1] - u*g[7])*iw;
+    o.Jp[1][0] = (g[3] - v*g[6])*iw;
+    o.Jp[1][1] = (g[4] - v*g[7])*iw;
+    return true;
+}
+
+// Sparse Levenberg-Marquardt on the parameters g of the maps from the
+// reference frame to each image, with the points p eliminated
+class Bundle {
+public:
+    Bundle(int nImages, const vector<PairMatches>& pairs, ThreadPool& pool);
+    bool init(const vector< Matrix<float> >& H);
+    double run(const BundleOptions& opt);
+    void result(vector< Matrix<float> >& H) const;
+private:
+    double cost(const vector<double>& g, const vector<double>& p);
+    void linearize();
+    bool solve(double lambda, vector<double>& g, vector<double>& p,
+               double& predicted);
+    bool cholesky();
+    int first(int b) const { return firstBlock[b]; }
+    double& S(int r, int c) { // Scalar entry of the profile, c<=r
+        int b = r/8;
+        return schur[rowStart[b] + (r%8)*rowWidth(b) + c - 8*first(b)];
+    }
+    int rowWidth(int b) const { return 8*(b-first(b)+1); }
+
+    ThreadPool& pool;
+    int nImages, nBlocks;
+    vector<int> block;             // Block of image k, -1 if fixed
+    vector<int> imageOf;           // Image of block b
+    vector<Landmark> points;
+    vector< vector<int> > seen;    // Observations 2*m+s of each image
+    vector<int> firstBlock, rowStart;
+    double N[9], Ninv[9];          // Pixels -> normalized coordinates
+    vector<double> g, p;           // Current parameters
+    vector<Observation> obs;       // Linearization at g, p
+    vector<PointSystem> pointSys;
+    vector<double> imageU, imageB; // Normal equations of the images
+    vector<double> schur, rhs;     // Reduced system
+};
+
+Bundle::Bundle(int n, const vector<PairMatches>& pairs, ThreadPool& tp)
+: pool(tp), nImages(n), nBlocks(0), block(n, -1), seen(n) {
+    for(size_t q=0; q<pairs.size(); q++) {
+        const PairMatches& P = pairs[q];
+        if(P.i<0 || P.j<0 || P.i>=n || P.j>=n || P.i==P.j)
+            continue;
+        for(size_t k=0; k<P.matches.size(); k++) {
+            const Match& m = P.matches[k];
+            Landmark L;
+            L.img[0] = P.i; L.x[0][0] = m.x1; L.x[0][1] = m.y1;
+            L.img[1] = P.j; L.x[1][0] = m.x2; L.x[1][1] = m.y2;
+            for(int s=0; s<2; s++)
+                seen[L.img[s]].push_back(int(2*points.size())+s);
+            points.push_back(L);
+        }
+    }
+    for(int k=1; k<n; k++)
+        if(! seen[k].empty()) {
+            block[k] = nBlocks++;
+            imageOf.push_back(k);
+        }
+    // Block profile: first block coupled to each block by a point
+    firstBlock.resize(nBlocks);
+    for(int b=0; b<nBlocks; b++)
+        firstBlock[b] = b;
+    for(size_t m=0; m<points.size(); m++) {
+        int a = block[points[m].img[0]], b = block[points[m].img[1]];
+        if(a>=0 && b>=0)
+            firstBlock[max(a,b)] = min(firstBlock[max(a,b)], min(a,b));
+    }
+    rowStart.resize(nBlocks+1, 0);
+    for(int b=0; b<nBlocks; b++)
+        rowStart[b+1] = rowStart[b] + 8*rowWidth(b);
+    schur.resize(rowStart[nBlocks]);
+    rhs.resize(8*nBlocks);
+    obs.resize(2*points.size());
+    pointSys.resize(points.size());
+    imageU.resize(64*nBlocks);
+    imageB.resize(8*nBlocks);
+}
+
+bool Bundle::init(const vector< Matrix<float> >& H) {
+    if(points.empty())
+        return false;
+    // Similarity centering the observations, at unit RMS distance
+    double cx=0, cy=0, d2=0;
+    const double n = 2.0*points.size();
+    for(size_t m=0; m<points.size(); m++)
+        for(int s=0; s<2; s++) {
+            cx += points[m].x[s][0];
+            cy += points[m].x[s][1];
+        }
+    cx /= n;
+    cy /= n;
+    for(size_t m=0; m<points.size(); m++)
+        for(int s=0; s<2; s++) {
+            double dx = points[m].x[s][0]-cx, dy = points[m].x[s][1]-cy;
+            d2 += dx*dx + dy*dy;
+        }
+    double sc = d2>0? sqrt(n/d2): 1.0;
+    const double Nm[9] = {sc, 0, -sc*cx, 0, sc, -sc*cy, 0, 0, 1};
+    const double Ni[9] = {1/sc, 0, cx, 0, 1/sc, cy, 0, 0, 1};
+    copy(Nm, Nm+9, N);
+    copy(Ni, Ni+9, Ninv);
+    for(size_t m=0; m<points.size(); m++)
+        for(int s=0; s<2; s++) {
+            double* x = points[m].x[s];
+            x[0] = sc*(x[0]-cx);
+            x[1] = sc*(x[1]-cy);
+        }
+
+    // Map from the reference frame to image k: N * H[k]^-1 * N^-1
+    g.assign(8*nImages, 0);
+    vector<double> G(9*nImages); // Same with coefficient 8
+    for(int k=0; k<nImages; k++) {
+        double h[9], hi[9], t[9];
+        for(int r=0; r<3; r++)
+            for(int c=0; c<3; c++)
+                h[3*r+c] = H[k](r,c);
+        if(! inverse3(h, hi))
+            return false;
+        mul3(N, hi, t);
+        mul3(t, Ninv, &G[9*k]);
+        if(! (fabs(G[9*k+8]) > 1e-12))
+            return false;
+        for(int c=0; c<8; c++)
+            g[8*k+c] = G[9*k+c]/G[9*k+8];
+    }
+    // Points: mean of the observations mapped to the reference frame
+    p.resize(2*points.size());
+    for(size_t m=0; m<points.size(); m++) {
+        double sx=0, sy=0;
+        for(int s=0; s<2; s++) {
+            int k = points[m].img[s];
+            double hi[9];
+            inverse3(&G[9*k], hi);
+            const double* x = points[m].x[s];
+            double w = hi[6]*x[0] + hi[7]*x[1] + hi[8];
+            if(! (fabs(w) > 1e-12))
+                return false;
+            sx += (hi[0]*x[0] + hi[1]*x[1] + hi[2])/w;
+            sy += (hi[3]*x[0] + hi[4]*x[1] + hi[5])/w;
+        }
+        p[2*m] = sx/2;
+        p[2*m+1] = sy/2;
+    }
+    return true;
+}
+
+// Sum of squared residuals, infinite if a point is behind an image
+double Bundle::cost(const vector<double>& gt, const vector<double>& pt) {
+    const int nm = int(points.size()), chunks = (nm+CHUNK-1)/CHUNK;
+    vector<double> partial(chunks, 0);
+    pool.run(chunks, [&](int t, int) {
+        double sum = 0;
+        for(int m=t*CHUNK; m<min(nm, (t+1)*CHUNK); m++)
+            for(int s=0; s<2; s++) {
+                Observation o;
+                if(! observe(&gt[8*points[m].img[s]], &pt[2*m],
+                             points[m].x[s], o, false)) {
+                    sum = HUGE_VAL;
+                    continue;
+                }
+                sum += o.r[0]*o.r[0] + o.r[1]*o.r[1];
+            }
+        partial[t] = sum;
+    });
+    double sum = 0;
+    for(int t=0; t<chunks; t++) // In order: same result for any threads
+        sum += partial[t];
+    return sum;
+}
+
+void Bundle::linearize() {
+    // Observations and normal equations of the points
+    const int nm = int(points.size()), chunks = (nm+CHUNK-1)/CHUNK;
+    pool.run(chunks, [&](int t, int) {
+        for(int m=t*CHUNK; m<min(nm, (t+1)*CHUNK); m++) {
+            PointSystem& P = pointSys[m];
+            fill(P.V, P.V+3, 0.0);
+            fill(P.b, P.b+2, 0.0);
+            for(int s=0; s<2; s++) {
+                Observation& o = obs[2*m+s];
+                observe(&g[8*points[m].img[s]], &p[2*m], points[m].x[s],
+                        o, true);
+                const double (*J)[2] = o.Jp;
+                P.V[0] += J[0][0]*J[0][0] + J[1][0]*J[1][0];
+                P.V[1] += J[0][0]*J[0][1] + J[1][0]*J[1][1];
+                P.V[2] += J[0][1]*J[0][1] + J[1][1]*J[1][1];
+                P.b[0] += J[0][0]*o.r[0] + J[1][0]*o.r[1];
+                P.b[1] += J[0][1]*o.r[0] + J[1][1]*o.r[1];
+                for(int i=0; i<8; i++)
+                    for(int j=0; j<2; j++)
+                        o.W[i][j] = o.Jg[0][i]*o.Jp[0][j] +
+                                    o.Jg[1][i]*o.Jp[1][j];
+            }
+        }
+    });
+    // Normal equations of the images
+    pool.run(nBlocks, [&](int b, int) {
+        double* U = &imageU[64*b];
+        double* bu = &imageB[8*b];
+        fill(U, U+64, 0.0);
+        fill(bu, bu+8, 0.0);
+        const vector<int>& list = seen[imageOf[b]];
+        for(size_t q=0; q<list.size(); q++) {
+            const Observation& o = obs[list[q]];
+            for(int i=0; i<8; i++) {
+                for(int j=0; j<8; j++)
+                    U[8*i+j] += o.Jg[0][i]*o.Jg[0][j] + o.Jg[1][i]*o.Jg[1][j];
+                bu[i] += o.Jg[0][i]*o.r[0] + o.Jg[1][i]*o.r[1];
+            }
+        }
+    });
+}
+
+// Inverse of the damped normal matrix of a point (2x2 symmetric)
+static void dampedInverse(const double V[3], double lambda, double Vinv[3]) {
+    double a = V[0]*(1+lambda), b = V[1], c = V[2]*(1+lambda);
+    double det = a*c - b*b;
+    if(! (det > 0)) {
+        Vinv[0] = Vinv[1] = Vinv[2] = 0;
+        return;
+    }
+    Vinv[0] = c/det;
+    Vinv[1] = -b/det;
+    Vinv[2] = a/det;
+}
+
+bool Bundle::cholesky() {
+    const int n = 8*nBlocks;
+    for(int r=0; r<n; r++) {
+        const int fr = 8*first(r/8);
+        for(int c=fr; c<=r; c++) {
+            const int k0 = max(fr, 8*first(c/8));
+            double s = S(r,c);
+            for(int k=k0; k<c; k++)
+                s -= S(r,k)*S(c,k);
+            if(c < r)
+                S(r,c) = s/S(c,c);
+            else if(s > 0)
+                S(r,r) = sqrt(s);
+            else
+                return false;
+        }
+    }
+    return true;
+}
+
+// Trial parameters of the damped step, and the decrease of the cost the
+// linearization predicts
+bool Bundle::solve(double lambda, vector<double>& gt, vector<double>& pt,
+                   double& predicted) {
+    // Block rows of the Schur complement U - W V^-1 W^T, one per task
+    pool.run(nBlocks, [&](int b, int) {
+        const int k = imageOf[b], width = rowWidth(b), f = first(b);
+        double* row = &schur[rowStart[b]];
+        fill(row, row+8*width, 0.0);
+        double* diag = row + 8*(b-f);
+        const double* U = &imageU[64*b];
+        double* r = &rhs[8*b];
+        for(int i=0; i<8; i++) {
+            for(int j=0; j<8; j++)
+                diag[i*width+j] = U[8*i+j];
+            diag[i*width+i] += lambda*U[9*i];
+            r[i] = imageB[8*b+i];
+        }
+        for(size_t q=0; q<seen[k].size(); q++) {
+            const int code = seen[k][q], m = code/2;
+            const double (*W)[2] = obs[code].W;
+            const PointSystem& P = pointSys[m];
+            double Vinv[3], Y[8][2];
+            dampedInverse(P.V, lambda, Vinv);
+            for(int i=0; i<8; i++) {
+                Y[i][0] = W[i][0]*Vinv[0] + W[i][1]*Vinv[1];
+                Y[i][1] = W[i][0]*Vinv[1] + W[i][1]*Vinv[2];
+                r[i] -= Y[i][0]*P.b[0] + Y[i][1]*P.b[1];
+            }
+            // The point couples this image with both of its images
+            for(int t=0; t<2; t++) {
+                const int bt = block[points[m].img[t]];
+                if(bt < 0 || bt > b)
+                    continue;
+                const double (*Wt)[2] = obs[2*m+t].W;
+                double* blk = row + 8*(bt-f);
+                for(int i=0; i<8; i++)
+                    for(int j=0; j<8; j++)
+                        blk[i*width+j] -= Y[i][0]*Wt[j][0] + Y[i][1]*Wt[j][1];
+            }
+        }
+    });
+    if(! cholesky())
+        return false;
+
+    // Forward and back substitution, the step of the images is -S^-1 rhs
+    const int n = 8*nBlocks;
+    vector<double> x(rhs);
+    for(int r=0; r<n; r++) {
+        for(int k=8*first(r/8); k<r; k++)
+            x[r] -= S(r,k)*x[k];
+        x[r] /= S(r,r);
+    }
+    for(int r=n-1; r>=0; r--) {
+        x[r] /= S(r,r);
+        for(int k=8*first(r/8); k<r; k++)
+            x[k] -= S(r,k)*x[r];
+    }
+    // Predicted decrease -d^T J^T r + lambda d^T D d, D the damped diagonal
+    predicted = 0;
+    gt = g;
+    for(int b=0; b<nBlocks; b++)
+        for(int i=0; i<8; i++) {
+            const double d = -x[8*b+i];
+            gt[8*imageOf[b]+i] += d;
+            predicted += -d*imageB[8*b+i] + lambda*imageU[64*b+9*i]*d*d;
+        }
+
+    // Step of the points: -V^-1 (bp + W^T dg)
+    pt = p;
+    const int nm = int(points.size()), chunks = (nm+CHUNK-1)/CHUNK;
+    vector<double> partial(chunks, 0);
+    pool.run(chunks, [&](int t, int) {
+        for(int m=t*CHUNK; m<min(nm, (t+1)*CHUNK); m++) {
+            const PointSystem& P = pointSys[m];
+            double Vinv[3], bp[2] = {P.b[0], P.b[1]};
+            dampedInverse(P.V, lambda, Vinv);
+            for(int s=0; s<2; s++) {
+                const int b = block[points[m].img[s]];
+                if(b < 0)
+                    continue;
+                const double (*W)[2] = obs[2*m+s].W;
+                for(int i=0; i<8; i++) { // dg = -x
+                    bp[0] -= W[i][0]*x[8*b+i];
+                    bp[1] -= W[i][1]*x[8*b+i];
+                }
+            }
+            const double d0 = -(Vinv[0]*bp[0] + Vinv[1]*bp[1]);
+            const double d1 = -(Vinv[1]*bp[0] + Vinv[2]*bp[1]);
+            pt[2*m]   += d0;
+            pt[2*m+1] += d1;
+            partial[t] += -d0*P.b[0] - d1*P.b[1] +
+                          lambda*(P.V[0]*d0*d0 + P.V[2]*d1*d1);
+        }
+    });
+    for(int t=0; t<chunks; t++)
+        predicted += partial[t];
+    return true;
+}
+
+double Bundle::run(const BundleOptions& opt) {
+    // Damping updated from the ratio of actual to predicted decrease
+    // (Nielsen), which avoids most rejected steps
+    double E = cost(g, p), lambda = 1e-3, nu = 2;
+    const double nObs = 2.0*points.size();
+    if(opt.verbose)
+        cout << "bundle: initial RMS " << sqrt(E/nObs)/N[0] << " px" << endl;
+    vector<double> gt, pt;
+    for(int it=0; it<opt.maxIterations && nBlocks>0; it++) {
+        linearize();
+        bool accepted = false;
+        while(! accepted && lambda < 1e12) {
+            double predicted = 0;
+            double Et = solve(lambda, gt, pt, predicted)? cost(gt, pt): HUGE_VAL;
+            if(! (Et < E)) {
+                lambda *= nu;
+                nu *= 2;
+                continue;
+            }
+            accepted = true;
+            double decrease = (E-Et)/E, rho = (E-Et)/max(predicted, 1e-300);
+            g.swap(gt);
+            p.swap(pt);
+            E = Et;
+            double c = 2*rho-1;
+            lambda = max(lambda*max(1/3.0, 1-c*c*c), 1e-12);
+            nu = 2;
+            if(opt.verbose)
+                cout << "bundle: iteration " << it+1 << " RMS "
+                     << sqrt(E/nObs)/N[0] << " px" << endl;
+            if(decrease < opt.tolerance)
+                it = opt.maxIterations;
+        }
+        if(! accepted)
+            break;
+    }
+    return sqrt(E/nObs)/N[0];
+}
+
+void Bundle::result(vector< Matrix<float> >& H) const {
+    // H[k] = N^-1 * G^-1 * N
+    for(int b=0; b<nBlocks; b++) {
+        const int k = imageOf[b];
+        double G[9], Gi[9], t[9], h[9];
+        copy(&g[8*k], &g[8*k]+8, G);
+        G[8] = 1;
+        if(! inverse3(G, Gi))
+            continue;
+        mul3(Ninv, Gi, t);
+        mul3(t, N, h);
+        for(int r=0; r<3; r++)
+            for(int c=0; c<3; c++)
+                H[k](r,c) = float(h[3*r+c]/h[8]);
+    }
+}
+
+double bundleAdjust(vector< Matrix<float> >& H,
+                    const vector<PairMatches>& pairs,
+                    const BundleOptions& opt) {
+    ThreadPool pool(opt.threads);
+    Bundle B(int(H.size()), pairs, pool);
+    if(! B.init(H))
+        return -1;
+    double rms = B.run(opt);
+    B.result(H);
+    return rms;
+}
@@ -0,0 +1,44 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Bundle adjustment of the homographies of a mosaic.
+
+#ifndef PANORAMA_BUNDLE_H
+#define PANORAMA_BUNDLE_H
+
+#include "Match.h"
+#include <Imagine/LinAlg.h>
+#include <vector>
+
+// Matches between images i and j: (x1,y1) in image i, (x2,y2) in image j
+struct PairMatches {
+    int i, j;
+    std::vector<Match> matches;
+};
+
+// Levenberg-Marquardt parameters
+struct BundleOptions {
+    int maxIterations; // Accepted steps at most
+    double tolerance;  // Stop when the cost decreases by less, relatively
+    int threads;       // Jacobian and Schur complement, <=0 = all cores
+    bool verbose;      // Print the error at each iteration
+    BundleOptions(): maxIterations(50), tolerance(1e-6), threads(0),
+                     verbose(false) {}
+};
+
+// Refine the homographies H[k] from image k to the frame of image 0 so
+// that the matches of all pairs agree. Each match is a point of the frame
+// of image 0 seen in both images; the sum of its squared reprojection
+// errors is minimized over the points and the homographies. The points are
+// eliminated by the Schur complement, a sparse system in the homographies
+// whose block profile follows the pairs (banded for a sequence). H[0],
+// and images without matches, are fixed. Returns the final RMS
+// reprojection error in pixels, or a negative value, H unchanged, if the
+// initial homographies are unusable.
+double bundleAdjust(std::vector< Imagine::Matrix<float> >& H,
+                    const std::vector<PairMatches>& pairs,
+                    const BundleOptions& opt=BundleOptions());
+
+#endif
@@ -0,0 +1,353 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "DLT.h"
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define DLT_X86 1
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Projective map of the unit square (0,0),(1,0),(1,1),(0,1) onto the
+// quadrilateral (x[k],y[k]) (Heckbert). False if it is degenerate.
+static bool squareToQuad(const double x[4], const double y[4], double Q[9]) {
+    double sx = x[0]-x[1]+x[2]-x[3], sy = y[0]-y[1]+y[2]-y[3];
+    double dx1 = x[1]-x[2], dx2 = x[3]-x[2];
+    double dy1 = y[1]-y[2], dy2 = y[3]-y[2];
+    double det = dx1*dy2 - dx2*dy1;
+    double scale = fabs(dx1*dy1) + fabs(dx2*dy2) + fabs(dx1*dy2) +
+                   fabs(dx2*dy1);
+    if(! (fabs(det) > 1e-9*scale))
+        return false;
+    double g = (sx*dy2 - dx2*sy)/det, h = (dx1*sy - sx*dy1)/det;
+    Q[0] = x[1]-x[0] + g*x[1]; Q[1] = x[3]-x[0] + h*x[3]; Q[2] = x[0];
+    Q[3] = y[1]-y[0] + g*y[1]; Q[4] = y[3]-y[0] + h*y[3]; Q[5] = y[0];
+    Q[6] = g;                  Q[7] = h;                  Q[8] = 1;
+    return true;
+}
+
+// Scale H so that H[8]=1
+static bool unitScale(double H[9]) {
+    double n = 0;
+    for(int k=0; k<9; k++)
+        n += H[k]*H[k];
+    if(! (fabs(H[8]) > 1e-12*sqrt(n)))
+        return false;
+    double s = 1/H[8];
+    for(int k=0; k<9; k++)
+        H[k] *= s;
+    return true;
+}
+
+bool homography4(const Match* m, const int idx[4], double H[9]) {
+    double x1[4], y1[4], x2[4], y2[4];
+    for(int k=0; k<4; k++) {
+        const Match& a = m[idx[k]];
+        x1[k] = a.x1; y1[k] = a.y1; x2[k] = a.x2; y2[k] = a.y2;
+    }
+    double Q1[9], Q2[9];
+    if(! squareToQuad(x1, y1, Q1) || ! squareToQuad(x2, y2, Q2))
+        return false;
+    // H = Q2 * adj(Q1), adj(Q1) being inverse(Q1) up to scale
+    double A[9] = {
+        Q1[4]*Q1[8]-Q1[5]*Q1[7], Q1[2]*Q1[7]-Q1[1]*Q1[8], Q1[1]*Q1[5]-Q1[2]*Q1[4],
+        Q1[5]*Q1[6]-Q1[3]*Q1[8], Q1[0]*Q1[8]-Q1[2]*Q1[6], Q1[2]*Q1[3]-Q1[0]*Q1[5],
+        Q1[3]*Q1[7]-Q1[4]*Q1[6], Q1[1]*Q1[6]-Q1[0]*Q1[7], Q1[0]*Q1[4]-Q1[1]*Q1[3]};
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            H[3*r+c] = Q2[3*r]*A[c] + Q2[3*r+1]*A[3+c] + Q2[3*r+2]*A[6+c];
+    return unitScale(H);
+}
+
+#ifdef DLT_X86
+// Operations of homography4, in the same order, on two hypotheses at once:
+// lane l of each register belongs to hypothesis l. Results are therefore
+// bit for bit those of homography4.
+__attribute__((target("sse2")))
+static inline __m128d absPd(__m128d a) {
+    return _mm_andnot_pd(_mm_set1_pd(-0.0), a);
+}
+
+// squareToQuad of the quadrilaterals of both lanes, with the mask of the
+// lanes that are not degenerate
+__attribute__((target("sse2")))
+static __m128d squareToQuad2(const __m128d x[4], const __m128d y[4],
+                             __m128d Q[9]) {
+    __m128d sx = _mm_sub_pd(_mm_add_pd(_mm_sub_pd(x[0], x[1]), x[2]), x[3]);
+    __m128d sy = _mm_sub_pd(_mm_add_pd(_mm_sub_pd(y[0], y[1]), y[2]), y[3]);
+    __m128d dx1 = _mm_sub_pd(x[1], x[2]), dx2 = _mm_sub_pd(x[3], x[2]);
+    __m128d dy1 = _mm_sub_pd(y[1], y[2]), dy2 = _mm_sub_pd(y[3], y[2]);
+    __m128d det = _mm_sub_pd(_mm_mul_pd(dx1, dy2), _mm_mul_pd(dx2, dy1));
+    __m128d scale = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+        absPd(_mm_mul_pd(dx1, dy1)), absPd(_mm_mul_pd(dx2, dy2))),
+        absPd(_mm_mul_pd(dx1, dy2))), absPd(_mm_mul_pd(dx2, dy1)));
+    __m128d ok = _mm_cmpgt_pd(absPd(det),
+                              _mm_mul_pd(_mm_set1_pd(1e-9), scale));
+    __m128d g = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(sx, dy2),
+                                      _mm_mul_pd(dx2, sy)), det);
+    __m128d h = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(dx1, sy),
+                                      _mm_mul_pd(sx, dy1)), det);
+    Q[0] = _mm_add_pd(_mm_sub_pd(x[1], x[0]), _mm_mul_pd(g, x[1]));
+    Q[1] = _mm_add_pd(_mm_sub_pd(x[3], x[0]), _mm_mul_pd(h, x[3]));
+    Q[2] = x[0];
+    Q[3] = _mm_add_pd(_mm_sub_pd(y[1], y[0]), _mm_mul_pd(g, y[1]));
+    Q[4] = _mm_add_pd(_mm_sub_pd(y[3], y[0]), _mm_mul_pd(h, y[3]));
+    Q[5] = y[0];
+    Q[6] = g;
+    Q[7] = h;
+    Q[8] = _mm_set1_pd(1);
+    return ok;
+}
+
+// a*d - b*c
+__attribute__((target("sse2")))
+static inline __m128d cross2(__m128d a, __m128d d, __m128d b, __m128d c) {
+    return _mm_sub_pd(_mm_mul_pd(a, d), _mm_mul_pd(b, c));
+}
+
+// Hypotheses s0 and s1 (4 match indices each) into H0 and H1, the bits of
+// the result telling which are valid
+__attribute__((target("sse2")))
+static int homography4Sse2(const Match* m, const int* s0, const int* s1,
+                           double* H0, double* H1) {
+    // Coordinates of the samples, one hypothesis per lane
+    __m128d x1[4], y1[4], x2[4], y2[4];
+    for(int k=0; k<4; k++) {
+        const Match &a = m[s0[k]], &b = m[s1[k]];
+        x1[k] = _mm_set_pd(b.x1, a.x1); y1[k] = _mm_set_pd(b.y1, a.y1);
+        x2[k] = _mm_set_pd(b.x2, a.x2); y2[k] = _mm_set_pd(b.y2, a.y2);
+    }
+    __m128d Q1[9], Q2[9];
+    __m128d ok = _mm_and_pd(squareToQuad2(x1, y1, Q1),
+                            squareToQuad2(x2, y2, Q2));
+    const __m128d A[9] = {
+        cross2(Q1[4],Q1[8],Q1[5],Q1[7]), cross2(Q1[2],Q1[7],Q1[1],Q1[8]),
+        cross2(Q1[1],Q1[5],Q1[2],Q1[4]),
+        cross2(Q1[5],Q1[6],Q1[3],Q1[8]), cross2(Q1[0],Q1[8],Q1[2],Q1[6]),
+        cross2(Q1[2],Q1[3],Q1[0],Q1[5]),
+        cross2(Q1[3],Q1[7],Q1[4],Q1[6]), cross2(Q1[1],Q1[6],Q1[0],Q1[7]),
+        cross2(Q1[0],Q1[4],Q1[1],Q1[3])};
+    __m128d H[9];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            H[3*r+c] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Q2[3*r], A[c]),
+                                             _mm_mul_pd(Q2[3*r+1], A[3+c])),
+                                  _mm_mul_pd(Q2[3*r+2], A[6+c]));
+    // unitScale
+    __m128d n = _mm_setzero_pd();
+    for(int k=0; k<9; k++)
+        n = _mm_add_pd(n, _mm_mul_pd(H[k], H[k]));
+    ok = _mm_and_pd(ok, _mm_cmpgt_pd(absPd(H[8]), _mm_mul_pd(
+                        _mm_set1_pd(1e-12), _mm_sqrt_pd(n))));
+    __m128d inv = _mm_div_pd(_mm_set1_pd(1), H[8]);
+    for(int k=0; k<9; k++) {
+        __m128d h = _mm_mul_pd(H[k], inv);
+        _mm_storel_pd(H0+k, h);
+        _mm_storeh_pd(H1+k, h);
+    }
+    return _mm_movemask_pd(ok);
+}
+#endif
+
+int homographyBatch(const Match* m, const int* samples, int nHyp,
+                    double* H, unsigned char* ok) {
+    int k = 0;
+#ifdef DLT_X86
+    for(; k+2<=nHyp; k+=2) {
+        int valid = homography4Sse2(m, samples+4*k, samples+4*k+4,
+                                    H+9*k, H+9*k+9);
+        ok[k] = valid & 1;
+        ok[k+1] = (valid >> 1) & 1;
+    }
+#endif
+    for(; k<nHyp; k++)
+        ok[k] = homography4(m, samples+4*k, H+9*k);
+    int n = 0;
+    for(k=0; k<nHyp; k++)
+        n += ok[k];
+    return n;
+}
+
+// Similarity x -> s*(x-c) sending the centroid of the points to the origin
+// and their mean distance to it to sqrt(2) (Hartley)
+struct Normalization {
+    double s, cx, cy;
+};
+
+static Normalization normalization(const Match* m, const int* idx, int n,
+                                   bool second) {
+    Normalization N;
+    double cx=0, cy=0, d=0;
+    for(int i=0; i<n; i++) {
+        const Match& a = m[idx? idx[i]: i];
+        cx += second? a.x2: a.x1;
+        cy += second? a.y2: a.y1;
+    }
+    cx /= n;
+    cy /= n;
+    for(int i=0; i<n; i++) {
+        const Match& a = m[idx? idx[i]: i];
+        double dx = (second? a.x2: a.x1) - cx, dy = (second? a.y2: a.y1) - cy;
+        d += sqrt(dx*dx + dy*dy);
+    }
+    d /= n;
+    N.s = d>0? sqrt(2.0)/d: 1.0;
+    N.cx = cx;
+    N.cy = cy;
+    return N;
+}
+
+// Eigenvector v of the smallest eigenvalue of symmetric A, by cyclic
+// Jacobi rotations. A is overwritten.
+static void smallestEigenvector(double A[9][9], double v[9]) {
+    double V[9][9];
+    double norm = 0;
+    for(int i=0; i<9; i++)
+        for(int j=0; j<9; j++) {
+            V[i][j] = i==j;
+            norm += A[i][j]*A[i][j];
+        }
+    for(int sweep=0; sweep<50; sweep++) {
+        double off = 0;
+        for(int p=0; p<9; p++)
+            for(int q=p+1; q<9; q++)
+                off += A[p][q]*A[p][q];
+        if(off <= 1e-30*norm)
+            break;
+        for(int p=0; p<9; p++)
+            for(int q=p+1; q<9; q++) {
+                if(A[p][q] == 0)
+                    continue;
+                double theta = (A[q][q]-A[p][p])/(2*A[p][q]);
+                double t = (theta>=0? 1: -1)/(fabs(theta)+sqrt(theta*theta+1));
+                double c = 1/sqrt(t*t+1), s = t*c;
+                for(int k=0; k<9; k++) { // A <- A*J
+                    double akp = A[k][p], akq = A[k][q];
+                    A[k][p] = c*akp - s*akq;
+                    A[k][q] = s*akp + c*akq;
+                }
+                for(int k=0; k<9; k++) { // A <- J^T*A
+                    double apk = A[p][k], aqk = A[q][k];
+                    A[p][k] = c*apk - s*aqk;
+                    A[q][k] = s*apk + c*aqk;
+                }
+                for(int k=0; k<9; k++) { // V <- V*J
+                    double vkp = V[k][p], vkq = V[k][q];
+                    V[k][p] = c*vkp - s*vkq;
+                    V[k][q] = s*vkp + c*vkq;
+                }
+            }
+    }
+    int best = 0;
+    for(int i=1; i<9; i++)
+        if(A[i][i] < A[best][best])
+            best = i;
+    for(int k=0; k<9; k++)
+        v[k] = V[k][best];
+}
+
+bool homographyDLT(const Match* m, const int* idx, int n, double H[9]) {
+    if(n < 4)
+        return false;
+    Normalization N1 = normalization(m, idx, n, false);
+    Normalization N2 = normalization(m, idx, n, true);
+
+    // Normal equations, upper triangle, from the two rows of each match
+    double A[9][9] = {{0}};
+    for(int i=0; i<n; i++) {
+        const Match& a = m[idx? idx[i]: i];
+        double x = N1.s*(a.x1-N1.cx), y = N1.s*(a.y1-N1.cy);
+        double u = N2.s*(a.x2-N2.cx), v = N2.s*(a.y2-N2.cy);
+        const double r1[9] = {x, y, 1, 0, 0, 0, -u*x, -u*y, -u};
+        const double r2[9] = {0, 0, 0, x, y, 1, -v*x, -v*y, -v};
+        for(int p=0; p<9; p++)
+            for(int q=p; q<9; q++)
+                A[p][q] += r1[p]*r1[q] + r2[p]*r2[q];
+    }
+    for(int p=0; p<9; p++)
+        for(int q=0; q<p; q++)
+            A[p][q] = A[q][p];
+    double h[9];
+    smallestEigenvector(A, h);
+
+    // H = N2^-1 * Hn * N1
+    double T[9]; // Hn * N1
+    for(int r=0; r<3; r++) {
+        T[3*r+0] = h[3*r+0]*N1.s;
+        T[3*r+1] = h[3*r+1]*N1.s;
+        T[3*r+2] = h[3*r+2] - N1.s*(h[3*r+0]*N1.cx + h[3*r+1]*N1.cy);
+    }
+    for(int c=0; c<3; c++) {
+        H[0+c] = T[0+c]/N2.s + N2.cx*T[6+c];
+        H[3+c] = T[3+c]/N2.s + N2.cy*T[6+c];
+        H[6+c] = T[6+c];
+    }
+    return unitScale(H);
+}
+
+MatchArrays::MatchArrays(const vector<Match>& m)
+: x1(m.size()), y1(m.size()), x2(m.size()), y2(m.size()) {
+    for(size_t i=0; i<m.size(); i++) {
+        x1[i] = m[i].x1; y1[i] = m[i].y1;
+        x2[i] = m[i].x2; y2[i] = m[i].y2;
+    }
+}
+
+// Inliers among matches [i,n) for homography h, one at a time
+static int countScalar(const MatchArrays& m, const float* h, float t2, int i) {
+    int count = 0;
+    for(; i<m.size(); i++)
+        count += isInlier(h, m.x1[i], m.y1[i], m.x2[i], m.y2[i], t2);
+    return count;
+}
+
+#ifdef DLT_X86
+// Same float operations as isInlier, 4 matches at a time
+__attribute__((target("sse2")))
+static int countSse2(const MatchArrays& m, const float* h, float t2) {
+    __m128 H[9];
+    for(int k=0; k<9; k++)
+        H[k] = _mm_set1_ps(h[k]);
+    const __m128 vt2 = _mm_set1_ps(t2), zero = _mm_setzero_ps();
+    __m128i acc = _mm_setzero_si128();
+    const int n = m.size();
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m128 x1 = _mm_loadu_ps(&m.x1[i]), y1 = _mm_loadu_ps(&m.y1[i]);
+        __m128 x2 = _mm_loadu_ps(&m.x2[i]), y2 = _mm_loadu_ps(&m.y2[i]);
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(H[6],x1),
+                                         _mm_mul_ps(H[7],y1)), H[8]);
+        __m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(H[0],x1),
+                                         _mm_mul_ps(H[1],y1)), H[2]);
+        __m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(H[3],x1),
+                                         _mm_mul_ps(H[4],y1)), H[5]);
+        __m128 dx = _mm_sub_ps(X, _mm_mul_ps(x2,w));
+        __m128 dy = _mm_sub_ps(Y, _mm_mul_ps(y2,w));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy));
+        __m128 in = _mm_and_ps(_mm_cmpgt_ps(w,zero),
+                               _mm_cmple_ps(d2, _mm_mul_ps(vt2,
+                                                           _mm_mul_ps(w,w))));
+        acc = _mm_sub_epi32(acc, _mm_castps_si128(in)); // Lanes are 0 or -1
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_cvtsi128_si32(acc) + countScalar(m, h, t2, i);
+}
+#endif
+
+void countInliers(const MatchArrays& m, const float* H, int nHyp, float t,
+                  int* counts) {
+    const float t2 = t*t;
+    for(int k=0; k<nHyp; k++)
+#ifdef DLT_X86
+        counts[k] = countSse2(m, H+9*k, t2);
+#else
+        counts[k] = countScalar(m, H+9*k, t2, 0);
+#endif
+}
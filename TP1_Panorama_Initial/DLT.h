@@ -0,0 +1,57 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Fixed-size homography solvers, without heap allocation. Homographies
+// are row-major arrays of 9 coefficients mapping (x1,y1) to (x2,y2).
+
+#ifndef PANORAMA_DLT_H
+#define PANORAMA_DLT_H
+
+#include "Match.h"
+#include <vector>
+
+// Exact homography through the 4 matches of indices idx, in closed form:
+// composition of the projective maps of the unit square onto both
+// quadrilaterals. H is scaled so that H[8]=1. False if three points of
+// either image are nearly aligned.
+bool homography4(const Match* m, const int idx[4], double H[9]);
+
+// Least squares homography of the n matches of indices idx (all matches
+// if idx is null), by the DLT in Hartley-normalized coordinates: the 9x9
+// normal matrix A^T A is accumulated over the matches and H is its
+// eigenvector of smallest eigenvalue (Jacobi). H[8]=1. False if n<4 or the
+// configuration is degenerate.
+bool homographyDLT(const Match* m, const int* idx, int n, double H[9]);
+
+// Minimal solutions of nHyp samples of 4 matches, samples[4k..4k+3] for
+// hypothesis k, stored at H+9k with ok[k] (H+9k is undefined if ok[k] is
+// 0). Returns the number solved. Hypotheses are solved by pairs, one per
+// SSE2 lane, with the operations of homography4: results are the same.
+int homographyBatch(const Match* m, const int* samples, int nHyp,
+                    double* H, unsigned char* ok);
+
+// Matches as arrays of coordinates, for vectorized scoring
+struct MatchArrays {
+    std::vector<float> x1, y1, x2, y2;
+    explicit MatchArrays(const std::vector<Match>& m);
+    int size() const { return int(x1.size()); }
+};
+
+// (x1,y1) mapped by H lies within distance t of (x2,y2), with t2=t*t.
+// Written without division, so all evaluators agree bit for bit.
+inline bool isInlier(const float H[9], float x1, float y1,
+                     float x2, float y2, float t2) {
+    float w = H[6]*x1 + H[7]*y1 + H[8];
+    float dx = (H[0]*x1 + H[1]*y1 + H[2]) - x2*w;
+    float dy = (H[3]*x1 + H[4]*y1 + H[5]) - y2*w;
+    return w > 0 && dx*dx + dy*dy <= t2*(w*w);
+}
+
+// Number of inliers at distance t of each of the nHyp homographies of H
+// (9 floats each), in counts. Matches are scored 4 at a time with SSE2.
+void countInliers(const MatchArrays& m, const float* H, int nHyp, float t,
+                  int* counts);
+
+#endif
@@ -0,0 +1,115 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "DeepZoom.h"
+#include "Gain.h"
+#include "Render.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace Imagine;
+using namespace std;
+
+// Create directory dir, fine if it already exists
+static bool makeDir(const string& dir) {
+#ifdef _WIN32
+    int r = _mkdir(dir.c_str());
+#else
+    int r = mkdir(dir.c_str(), 0755);
+#endif
+    return r==0 || errno==EEXIST;
+}
+
+// Half resolution image by 2x2 box filter, border replicated for odd sizes
+static Image<Color> halve(const Image<Color,2>& I) {
+    int w = (I.width()+1)/2, h = (I.height()+1)/2;
+    Image<Color> J(w, h);
+    for(int y=0; y<h; y++) {
+        int y0 = 2*y, y1 = min(2*y+1, I.height()-1);
+        for(int x=0; x<w; x++) {
+            int x0 = 2*x, x1 = min(2*x+1, I.width()-1);
+            Color a=I(x0,y0), b=I(x1,y0), c=I(x0,y1), d=I(x1,y1);
+            J(x,y) = Color((a.r()+b.r()+c.r()+d.r()+2)/4,
+                           (a.g()+b.g()+c.g()+d.g()+2)/4,
+                           (a.b()+b.b()+c.b()+d.b()+2)/4);
+        }
+    }
+    return J;
+}
+
+bool writeDeepZoom(const string& name,
+                   const Image<Color,2>& I1, const Image<Color,2>& I2,
+                   const WarpMap& M1, const WarpMap& M2, int w, int h,
+                   const DeepZoomOptions& opt) {
+    // The descriptor has no level range: it declares levels 0 to maxLevel,
+    // which viewers request, so all of them are written
+    if(! opt.pyramid)
+        return false;
+    const int ts = max(16, opt.tileSize);
+    int maxLevel = 0;
+    while((1<<maxLevel) < max(w,h))
+        maxLevel++;
+    const string dir = name + "_files";
+    if(! makeDir(dir))
+        return false;
+
+    ThreadPool pool(opt.threads);
+    atomic<bool> ok(true);
+    Image<Color> J1 = I1, J2 = I2; // Sources at the resolution of the level
+    float gain1[3] = {1, 1, 1}, gain2[3] = {1, 1, 1};
+    for(int k=0; k<=maxLevel; k++) {
+        if(k > 0) {
+            J1 = halve(J1);
+            J2 = halve(J2);
+        }
+        const int level = maxLevel-k;
+        const float s = float(1<<k);
+        const int wl = (w+(1<<k)-1)>>k, hl = (h+(1<<k)-1)>>k;
+        ostringstream levelDir;
+        levelDir << dir << '/' << level;
+        if(! makeDir(levelDir.str()))
+            return false;
+
+        // Level pixel -> canvas pixel -> source -> downsampled source
+        WarpSource S1(J1), S2(J2);
+        WarpMap L1 = scaledMap(M1, s, (s-1)/2, 1/s, (1/s-1)/2, wl, hl);
+        WarpMap L2 = scaledMap(M2, s, (s-1)/2, 1/s, (1/s-1)/2, wl, hl);
+        L1.filter = L2.filter = opt.filter;
+        if(opt.gain && k == 0) { // Same gains at all levels
+            compensateGains(S1, L1, S2, L2, w, h);
+            copy(L1.gain, L1.gain+3, gain1);
+            copy(L2.gain, L2.gain+3, gain2);
+        }
+        copy(gain1, gain1+3, L1.gain);
+        copy(gain2, gain2+3, L2.gain);
+
+        const int cols = (wl+ts-1)/ts, rows = (hl+ts-1)/ts;
+        pool.run(cols*rows, [&](int t, int) {
+            int tx = (t%cols)*ts, ty = (t/cols)*ts;
+            Image<Color> tile(min(ts, wl-tx), min(ts, hl-ty));
+            renderTile(tile, tx, ty, S1, L1, S2, L2, opt.blend);
+            ostringstream file;
+            file << levelDir.str() << '/' << t%cols << '_' << t/cols << ".jpg";
+            if(! save(tile, file.str(), opt.quality))
+                ok = false;
+        });
+    }
+
+    ofstream dzi((name+".dzi").c_str());
+    dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl
+        << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\""
+        << " Format=\"jpg\" Overlap=\"0\" TileSize=\"" << ts << "\">" << endl
+        << "  <Size Width=\"" << w << "\" Height=\"" << h << "\"/>" << endl
+        << "</Image>" << endl;
+    return ok && bool(dzi);
+}
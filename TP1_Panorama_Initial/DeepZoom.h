@@ -0,0 +1,42 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Out-of-core panorama output as a Deep Zoom tile pyramid.
+
+#ifndef PANORAMA_DEEPZOOM_H
+#define PANORAMA_DEEPZOOM_H
+
+#include "Blend.h"
+#include <Imagine/Images.h>
+#include <string>
+
+// Tiled output parameters
+struct DeepZoomOptions {
+    int tileSize;   // Tile width and height in pixels
+    int quality;    // JPEG quality of tiles
+    bool pyramid;   // Also write the reduced resolution levels. Viewers
+                    // read a .dzi as the whole pyramid: false is refused
+    int threads;    // Tiles rendered in parallel, <=0 = all cores
+    BlendMode blend; // Multi-band falls back to feathering in tiles
+    bool gain;      // Exposure compensation, from the finest level
+    WarpFilter filter; // Resampling of the sources at all levels
+    DeepZoomOptions(): tileSize(256), quality(90), pyramid(true), threads(0),
+                       blend(BLEND_AVERAGE), gain(false),
+                       filter(FILTER_BILINEAR) {}
+};
+
+// Write the w x h panorama of I1 mapped by M1 and I2 mapped by M2 as the
+// Deep Zoom image name.dzi with tiles name_files/level/col_row.jpg. Tiles are
+// rendered and saved one at a time: memory is a few tiles per thread
+// plus half-resolution copies of the sources, whatever the canvas size.
+// Coarse levels sample the downsampled sources, not the finer tiles.
+// Returns false, writing nothing, without opt.pyramid.
+bool writeDeepZoom(const std::string& name,
+                   const Imagine::Image<Imagine::Color,2>& I1,
+                   const Imagine::Image<Imagine::Color,2>& I2,
+                   const WarpMap& M1, const WarpMap& M2, int w, int h,
+                   const DeepZoomOptions& opt=DeepZoomOptions());
+
+#endif
@@ -0,0 +1,56 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Dense.h"
+#include <cmath>
+
+void mul3(const double A[9], const double B[9], double C[9]) {
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            C[3*r+c] = A[3*r]*B[c] + A[3*r+1]*B[3+c] + A[3*r+2]*B[6+c];
+}
+
+bool inverse3(const double A[9], double B[9]) {
+    B[0] = A[4]*A[8]-A[5]*A[7]; B[1] = A[2]*A[7]-A[1]*A[8];
+    B[2] = A[1]*A[5]-A[2]*A[4]; B[3] = A[5]*A[6]-A[3]*A[8];
+    B[4] = A[0]*A[8]-A[2]*A[6]; B[5] = A[2]*A[3]-A[0]*A[5];
+    B[6] = A[3]*A[7]-A[4]*A[6]; B[7] = A[1]*A[6]-A[0]*A[7];
+    B[8] = A[0]*A[4]-A[1]*A[3];
+    double det = A[0]*B[0] + A[1]*B[3] + A[2]*B[6];
+    if(! (std::fabs(det) > 1e-300))
+        return false;
+    for(int k=0; k<9; k++)
+        B[k] /= det;
+    return true;
+}
+
+bool choleskySolve(double* A, double* b, int n) {
+    for(int j=0; j<n; j++) {
+        double d = A[j*n+j];
+        for(int k=0; k<j; k++)
+            d -= A[j*n+k]*A[j*n+k];
+        if(! (d > 0))
+            return false;
+        d = std::sqrt(d);
+        A[j*n+j] = d;
+        for(int i=j+1; i<n; i++) {
+            double s = A[i*n+j];
+            for(int k=0; k<j; k++)
+                s -= A[i*n+k]*A[j*n+k];
+            A[i*n+j] = s/d;
+        }
+    }
+    for(int i=0; i<n; i++) { // L y = b
+        for(int k=0; k<i; k++)
+            b[i] -= A[i*n+k]*b[k];
+        b[i] /= A[i*n+i];
+    }
+    for(int i=n-1; i>=0; i--) { // L^T x = y
+        for(int k=i+1; k<n; k++)
+            b[i] -= A[k*n+i]*b[k];
+        b[i] /= A[i*n+i];
+    }
+    return true;
+}
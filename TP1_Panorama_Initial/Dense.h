@@ -0,0 +1,22 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Small dense matrices in double precision, stored row-major, for the
+// homography chains of the bundle adjustment and of the tracking.
+
+#ifndef PANORAMA_DENSE_H
+#define PANORAMA_DENSE_H
+
+// C = A*B, 3x3; C must not alias A or B
+void mul3(const double A[9], const double B[9], double C[9]);
+
+// B = A^-1, 3x3, by the adjugate; false if A is singular
+bool inverse3(const double A[9], double B[9]);
+
+// Solve A x = b for symmetric positive A (n x n) by Cholesky: A is
+// overwritten by its factor and b by x. False if A is not positive.
+bool choleskySolve(double* A, double* b, int n);
+
+#endif
@@ -0,0 +1,89 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Gain.h"
+#include <Imagine/LinAlg.h>
+
+using namespace Imagine;
+using namespace std;
+
+vector<float> solveGains(int nImages, const vector<OverlapStats>& overlaps,
+                         float sigmaN, float sigmaG) {
+    vector<float> gains(3*nImages, 1.0f);
+    // Samples weighted by 1/total, so that float stays accurate
+    double total = 0;
+    for(size_t p=0; p<overlaps.size(); p++)
+        total += overlaps[p].n;
+    if(total <= 0)
+        return gains;
+    const double wN = 1/(double(sigmaN)*sigmaN), wG = 1/(double(sigmaG)*sigmaG);
+    for(int c=0; c<3; c++) {
+        // Normal equations of the quadratic cost, one channel at a time
+        Matrix<float> A(nImages, nImages);
+        Vector<float> b(nImages);
+        A.fill(0);
+        b.fill(0);
+        for(int k=0; k<nImages; k++) { // Weak prior for isolated images
+            A(k,k) = float(wG*1e-6);
+            b[k] = float(wG*1e-6);
+        }
+        for(size_t p=0; p<overlaps.size(); p++) {
+            const OverlapStats& o = overlaps[p];
+            if(o.n <= 0)
+                continue;
+            // Both ordered pairs (i,j) and (j,i) of the cost
+            double mi = o.sumI[c]/o.n, mj = o.sumJ[c]/o.n, f = o.n/total;
+            A(o.i,o.i) += float(f*(2*wN*mi*mi + wG));
+            A(o.j,o.j) += float(f*(2*wN*mj*mj + wG));
+            A(o.i,o.j) -= float(f*2*wN*mi*mj);
+            A(o.j,o.i) -= float(f*2*wN*mi*mj);
+            b[o.i] += float(f*wG);
+            b[o.j] += float(f*wG);
+        }
+        Vector<float> g = linSolve(A, b);
+        for(int k=0; k<nImages; k++)
+            gains[3*k+c] = g[k];
+    }
+    return gains;
+}
+
+WarpMap subsampled(const WarpMap& M, int step) {
+    int w = M.rays? (M.rays->width()+step-1)/step: 0;
+    int h = M.rays? (M.rays->height()+step-1)/step: 0;
+    return scaledMap(M, float(step), 0, 1, 0, w, h);
+}
+
+OverlapStats overlapStats(const WarpSource& S1, const WarpMap& M1,
+                          const WarpSource& S2, const WarpMap& M2,
+                          int w, int h, int step) {
+    OverlapStats o(0, 1);
+    WarpMap G1 = subsampled(M1, step), G2 = subsampled(M2, step);
+    const int gw = (w+step-1)/step, gh = (h+step-1)/step;
+    vector<unsigned char> rgb1(3*gw), rgb2(3*gw), in1(gw), in2(gw);
+    for(int i=0; i<gh; i++) {
+        warpRow(S1, G1, i, 0, gw, &rgb1[0], &in1[0]);
+        warpRow(S2, G2, i, 0, gw, &rgb2[0], &in2[0]);
+        for(int j=0; j<gw; j++) {
+            if(! (in1[j] && in2[j]))
+                continue;
+            o.n++;
+            for(int c=0; c<3; c++) {
+                o.sumI[c] += rgb1[3*j+c];
+                o.sumJ[c] += rgb2[3*j+c];
+            }
+        }
+    }
+    return o;
+}
+
+void compensateGains(const WarpSource& S1, WarpMap& M1,
+                     const WarpSource& S2, WarpMap& M2, int w, int h) {
+    vector<OverlapStats> o(1, overlapStats(S1, M1, S2, M2, w, h));
+    vector<float> g = solveGains(2, o);
+    for(int c=0; c<3; c++) {
+        M1.gain[c] = g[c];
+        M2.gain[c] = g[3+c];
+    }
+}
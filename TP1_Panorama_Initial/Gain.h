@@ -0,0 +1,51 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Exposure compensation: per image and channel gains equalizing the
+// overlaps, in the least-squares sense of Brown and Lowe (IJCV 2007).
+
+#ifndef PANORAMA_GAIN_H
+#define PANORAMA_GAIN_H
+
+#include "Warp.h"
+#include <vector>
+
+// Overlap of images i and j: number of samples and sum of each channel
+// in both images over these samples
+struct OverlapStats {
+    int i, j;
+    double n;
+    double sumI[3], sumJ[3];
+    OverlapStats(int i0=0, int j0=1): i(i0), j(j0), n(0) {
+        for(int c=0; c<3; c++)
+            sumI[c] = sumJ[c] = 0;
+    }
+};
+
+// Gains g[3*k+c] of image k and channel c minimizing the sum over ordered
+// pairs (i,j) of overlapping images of
+// N*((gi*mean_i - gj*mean_j)^2/sigmaN^2 + (1-gi)^2/sigmaG^2),
+// intensities in 0..255. The prior keeps gains near 1 and the system
+// regular; images without overlap get gain 1.
+std::vector<float> solveGains(int nImages,
+                              const std::vector<OverlapStats>& overlaps,
+                              float sigmaN=10, float sigmaG=0.1f);
+
+// Overlap statistics of S1 mapped by M1 (image 0) and S2 mapped by M2
+// (image 1) on a w x h canvas, gains included, on the canvas pixels of a
+// grid of the given step only: the cost is 1/step^2 of a warp.
+OverlapStats overlapStats(const WarpSource& S1, const WarpMap& M1,
+                          const WarpSource& S2, const WarpMap& M2,
+                          int w, int h, int step=4);
+
+// Map canvas pixel (x,y) of a grid of the given step, that is point
+// (step*x,step*y) of the canvas of M
+WarpMap subsampled(const WarpMap& M, int step);
+
+// Set the gains of M1 and M2 to equalize the overlap of S1 and S2
+void compensateGains(const WarpSource& S1, WarpMap& M1,
+                     const WarpSource& S2, WarpMap& M2, int w, int h);
+
+#endif
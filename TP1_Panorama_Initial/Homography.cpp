@@ -0,0 +1,178 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Homography.h"
+#include "DLT.h"
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace Imagine;
+using namespace std;
+
+// Hypotheses solved and scored together by RANSAC
+static const int BATCH = 64;
+
+static Matrix<float> toMatrix(const float h[9]) {
+    Matrix<float> H(3, 3);
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            H(r,c) = h[3*r+c];
+    return H;
+}
+
+bool fitHomography(const vector<Match>& matches, const vector<int>& idx,
+                   Matrix<float>& H) {
+    double h[9];
+    if(idx.size() < 4 ||
+       ! homographyDLT(&matches[0], &idx[0], int(idx.size()), h))
+        return false;
+    float f[9];
+    for(int k=0; k<9; k++) {
+        if(! (h[k]==h[k]) || fabs(h[k]) > 1e12)
+            return false;
+        f[k] = float(h[k]);
+    }
+    H = toMatrix(f);
+    return true;
+}
+
+static void findInliers(const vector<Match>& matches, const float H[9],
+                        float threshold, vector<int>& inliers) {
+    inliers.clear();
+    const float t2 = threshold*threshold;
+    for(size_t i=0; i<matches.size(); i++) {
+        const Match& m = matches[i];
+        if(isInlier(H, m.x1, m.y1, m.x2, m.y2, t2))
+            inliers.push_back(int(i));
+    }
+}
+
+static void findInliers(const vector<Match>& matches, const Matrix<float>& H,
+                        float threshold, vector<int>& inliers) {
+    float h[9];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            h[3*r+c] = H(r,c);
+    findInliers(matches, h, threshold, inliers);
+}
+
+// Three of the four points (in either image) nearly aligned
+static bool degenerate(const vector<Match>& matches, const int* s) {
+    for(int img=0; img<2; img++)
+        for(int k=0; k<4; k++) {
+            const Match& a = matches[s[k]];
+            const Match& b = matches[s[(k+1)%4]];
+            const Match& c = matches[s[(k+2)%4]];
+            float ux = img? b.x2-a.x2: b.x1-a.x1, uy = img? b.y2-a.y2: b.y1-a.y1;
+            float vx = img? c.x2-a.x2: c.x1-a.x1, vy = img? c.y2-a.y2: c.y1-a.y1;
+            if(fabs(ux*vy - uy*vx) < 1.0f)
+                return true;
+        }
+    return false;
+}
+
+Matrix<float> computeH(vector<Match>& matches, const RansacOptions& opt) {
+    const int n = int(matches.size());
+    if(n < 4) {
+        cout << "Not enough matches: " << n << endl;
+        return Matrix<float>::Identity(3);
+    }
+    mt19937 rng(opt.seed);
+    uniform_int_distribution<int> pick(0, n-1);
+    const MatchArrays arrays(matches);
+
+    // Samples are drawn, solved and scored by batches, then examined in
+    // drawing order so that the result does not depend on the batch size
+    vector<int> samples(4*BATCH);
+    vector<double> Hd(9*BATCH);
+    vector<float> Hf(9*BATCH);
+    vector<unsigned char> ok(BATCH), solved(BATCH);
+    vector<int> counts(BATCH);
+
+    float bestH[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    int bestCount = 0;
+    int Niter = opt.maxIterations; // Adjusted dynamically
+    int iter = 0;
+    while(iter < Niter) {
+        const int nb = min(BATCH, Niter-iter);
+        // Degenerate samples are rejected as drawn; the others are packed at
+        // the front of samples, the only ones to be solved
+        int ns = 0;
+        for(int b=0; b<nb; b++) {
+            int* s = &samples[4*ns];
+            for(int k=0; k<4; k++) {
+                bool again = true;
+                while(again) {
+                    s[k] = pick(rng);
+                    again = false;
+                    for(int l=0; l<k; l++)
+                        again = again || s[l]==s[k];
+                }
+            }
+            ok[b] = ! degenerate(matches, s);
+            ns += ok[b];
+        }
+        homographyBatch(&matches[0], &samples[0], ns, &Hd[0], &solved[0]);
+        // Valid hypotheses packed at the front of Hf
+        int nv = 0;
+        for(int b=0, j=0; b<nb; b++) {
+            if(! ok[b])
+                continue;
+            ok[b] = solved[j];
+            if(solved[j]) {
+                for(int k=0; k<9; k++)
+                    Hf[9*nv+k] = float(Hd[9*j+k]);
+                nv++;
+            }
+            j++;
+        }
+        countInliers(arrays, &Hf[0], nv, opt.threshold, &counts[0]);
+        for(int b=0, v=0; b<nb && iter<Niter; b++, iter++) {
+            if(! ok[b])
+                continue;
+            if(counts[v] > bestCount) {
+                bestCount = counts[v];
+                for(int k=0; k<9; k++)
+                    bestH[k] = Hf[9*v+k];
+                double w = double(bestCount)/n;
+                double p = 1 - w*w*w*w;
+                if(p <= 0)
+                    Niter = iter+1;
+                else {
+                    double N = log(1-opt.confidence)/log(p);
+                    if(N < Niter)
+                        Niter = int(ceil(N));
+                }
+            }
+            v++;
+        }
+    }
+
+    // Least squares refinement on the inliers, while they grow
+    vector<int> bestInliers, inliers;
+    findInliers(matches, bestH, opt.threshold, bestInliers);
+    Matrix<float> H, refined = toMatrix(bestH);
+    while(bestInliers.size() >= 4 && fitHomography(matches, bestInliers, H)) {
+        findInliers(matches, H, opt.threshold, inliers);
+        if(inliers.size() < bestInliers.size())
+            break;
+        bool grown = inliers.size() > bestInliers.size();
+        refined = H;
+        bestInliers = inliers;
+        if(! grown)
+            break;
+    }
+
+    cout << "Iterations: " << iter << ", Inliers: " << bestInliers.size()
+         << "/" << n << endl;
+
+    // Updating matches with inliers only
+    vector<Match> all=matches;
+    matches.clear();
+    for(size_t i=0; i<bestInliers.size(); i++)
+        matches.push_back(all[bestInliers[i]]);
+    return refined;
+}
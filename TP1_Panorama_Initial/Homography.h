@@ -0,0 +1,35 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Robust homography estimation from automatic matches.
+
+#ifndef PANORAMA_HOMOGRAPHY_H
+#define PANORAMA_HOMOGRAPHY_H
+
+#include "Match.h"
+#include <Imagine/LinAlg.h>
+#include <vector>
+
+// RANSAC parameters
+struct RansacOptions {
+    float threshold;     // Max transfer error of an inlier, in pixels
+    float confidence;    // Probability to draw one all-inlier sample
+    int maxIterations;   // Upper bound of the adaptive iteration count
+    unsigned int seed;   // Random generator seed, runs are repeatable
+    RansacOptions()
+    : threshold(3.0f), confidence(0.99f), maxIterations(10000), seed(0) {}
+};
+
+// Least squares homography mapping (x1,y1) to (x2,y2) for the matches of
+// indices idx (at least 4), computed in Hartley-normalized coordinates.
+bool fitHomography(const std::vector<Match>& matches,
+                   const std::vector<int>& idx, Imagine::Matrix<float>& H);
+
+// RANSAC algorithm to compute H from point matches (4-point samples).
+// Parameter matches is filtered to keep only inliers as output.
+Imagine::Matrix<float> computeH(std::vector<Match>& matches,
+                                const RansacOptions& opt=RansacOptions());
+
+#endif
@@ -0,0 +1,113 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Match.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <climits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define MATCH_X86 1
+#include <emmintrin.h>
+#endif
+
+using namespace Imagine;
+using namespace std;
+
+static const int DESC = 128; // SIFT descriptor length
+
+Features detectFeatures(const Image<Color,2>& I) {
+    SIFTDetector D;
+    D.setFirstOctave(-1);
+    return D.run(I);
+}
+
+// Squared Euclidean distance between two descriptors
+static inline int ssdScalar(const byte* a, const byte* b) {
+    int d=0;
+    for(int k=0; k<DESC; k++) {
+        int e = int(a[k]) - int(b[k]);
+        d += e*e;
+    }
+    return d;
+}
+
+#ifdef MATCH_X86
+__attribute__((target("sse2")))
+static int ssdSse2(const byte* a, const byte* b) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for(int k=0; k<DESC; k+=16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a+k));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b+k));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va,zero),
+                                   _mm_unpacklo_epi8(vb,zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va,zero),
+                                   _mm_unpackhi_epi8(vb,zero));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(lo,lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(hi,hi));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_cvtsi128_si32(acc);
+}
+#define ssd ssdSse2
+#else
+#define ssd ssdScalar
+#endif
+
+// Descriptors packed contiguously, one after the other
+static void packDescriptors(const Features& f, vector<byte>& d) {
+    d.resize(f.size()*DESC);
+    for(size_t i=0; i<f.size(); i++)
+        for(int k=0; k<DESC; k++)
+            d[i*DESC+k] = f[i].desc[k];
+}
+
+void matchFeatures(const Features& f1, const Features& f2,
+                   vector<Match>& matches, float ratio, int threads) {
+    if(f1.size()==0 || f2.size()<2)
+        return;
+    vector<byte> d1, d2;
+    packDescriptors(f1, d1);
+    packDescriptors(f2, d2);
+    const int n1 = int(f1.size()), n2 = int(f2.size());
+    const float ratio2 = ratio*ratio;
+
+    // Best match in f2 for each feature of f1, -1 if ambiguous
+    vector<int> best(n1, -1);
+    const int chunk = 64;
+    ThreadPool pool(threads);
+    pool.run((n1+chunk-1)/chunk, [&](int t, int) {
+        for(int i=t*chunk; i<min(n1,(t+1)*chunk); i++) {
+            const byte* a = &d1[size_t(i)*DESC];
+            int first=INT_MAX, second=INT_MAX, j1=-1;
+            for(int j=0; j<n2; j++) {
+                int d = ssd(a, &d2[size_t(j)*DESC]);
+                if(d < second) {
+                    if(d < first) {
+                        second = first;
+                        first = d;
+                        j1 = j;
+                    } else
+                        second = d;
+                }
+            }
+            if(float(first) < ratio2*float(second))
+                best[i] = j1;
+        }
+    });
+
+    for(int i=0; i<n1; i++)
+        if(best[i] >= 0) {
+            Match m;
+            m.x1 = f1[i].pos.x();
+            m.y1 = f1[i].pos.y();
+            m.x2 = f2[best[i]].pos.x();
+            m.y2 = f2[best[i]].pos.y();
+            matches.push_back(m);
+        }
+}
@@ -0,0 +1,30 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Automatic point correspondences: SIFT features and descriptor matching.
+
+#ifndef PANORAMA_MATCH_H
+#define PANORAMA_MATCH_H
+
+#include "Imagine/Features.h"
+#include <vector>
+
+// Point (x1,y1) of the first image corresponds to (x2,y2) in the second
+struct Match {
+    float x1, y1, x2, y2;
+};
+
+typedef Imagine::Array<Imagine::SIFTDetector::Feature> Features;
+
+// SIFT features of an image
+Features detectFeatures(const Imagine::Image<Imagine::Color,2>& I);
+
+// Nearest neighbour in f2 of each feature of f1, kept when the second
+// nearest is farther by the given distance ratio (Lowe's test).
+void matchFeatures(const Features& f1, const Features& f2,
+                   std::vector<Match>& matches,
+                   float ratio=0.8f, int threads=0);
+
+#endif
@@ -0,0 +1,161 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Mosaic.h"
+#include "Gain.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Imagine;
+using namespace std;
+
+static const double MAX_FOOTPRINT = 1e9; // Pixels, beyond H is surely wrong
+
+Mosaic::Mosaic(const RenderOptions& o)
+: opt(o), pool(o.threads), ox(0), oy(0), capW(0), capH(0),
+  bx0(0), by0(0), bx1(0), by1(0) {}
+
+// Make the buffer cover box [x0,x1)x[y0,y1) of the reference frame
+void Mosaic::reserve(int x0, int y0, int x1, int y1) {
+    if(capW>0 && x0>=ox && y0>=oy && x1<=ox+capW && y1<=oy+capH)
+        return;
+    int nx0=x0, ny0=y0, nx1=x1, ny1=y1;
+    if(capW > 0) {
+        // Grow by at least half the current size on each side that needs it
+        nx0 = x0<ox? min(x0, ox-capW/2): ox;
+        ny0 = y0<oy? min(y0, oy-capH/2): oy;
+        nx1 = x1>ox+capW? max(x1, ox+capW+capW/2): ox+capW;
+        ny1 = y1>oy+capH? max(y1, oy+capH+capH/2): oy+capH;
+    }
+    int w = nx1-nx0, h = ny1-ny0;
+    vector<Color> p(size_t(w)*h, WHITE);
+    vector<byte> c(size_t(w)*h, 0);
+    for(int y=by0; y<by1; y++) {
+        size_t from = size_t(y-oy)*capW + (bx0-ox);
+        size_t to = size_t(y-ny0)*w + (bx0-nx0);
+        copy(pix.begin()+from, pix.begin()+from+(bx1-bx0), p.begin()+to);
+        memcpy(&c[to], &covered[from], bx1-bx0);
+    }
+    pix.swap(p);
+    covered.swap(c);
+    ox = nx0; oy = ny0; capW = w; capH = h;
+}
+
+bool Mosaic::add(const Image<Color,2>& I, const Matrix<float>& H) {
+    // Footprint of I in the reference frame
+    float fx0=0, fy0=0, fx1=0, fy1=0;
+    const float cx[4] = {0, float(I.width()), float(I.width()), 0};
+    const float cy[4] = {0, 0, float(I.height()), float(I.height())};
+    for(int k=0; k<4; k++) {
+        float w = H(2,0)*cx[k] + H(2,1)*cy[k] + H(2,2);
+        if(w <= 0)
+            return false;
+        float x = (H(0,0)*cx[k] + H(0,1)*cy[k] + H(0,2))/w;
+        float y = (H(1,0)*cx[k] + H(1,1)*cy[k] + H(1,2))/w;
+        if(k == 0) {
+            fx0 = fx1 = x;
+            fy0 = fy1 = y;
+        }
+        fx0 = min(fx0, x); fx1 = max(fx1, x);
+        fy0 = min(fy0, y); fy1 = max(fy1, y);
+    }
+    int x0 = int(floor(fx0)), y0 = int(floor(fy0));
+    int x1 = int(ceil(fx1)), y1 = int(ceil(fy1));
+    if(x1<=x0 || y1<=y0)
+        return true;
+    if(double(x1-x0)*(y1-y0) > MAX_FOOTPRINT)
+        return false;
+    reserve(x0, y0, x1, y1);
+
+    // Buffer pixel (j,i) is point (j+ox,i+oy) of the reference frame
+    WarpSource S(I);
+    Matrix<float> Hi = inverse(H);
+    WarpMap M = warpMap(Hi, float(ox), float(oy));
+    M.filter = opt.filter;
+    if(opt.gain && bx1 > bx0)
+        matchGain(S, warpMap(Hi, float(x0), float(y0)), x0, y0, x1, y1,
+                  M.gain);
+    const int tw = max(8, opt.tileWidth), th = max(1, opt.tileHeight);
+    const int bw = x1-x0, nx = (bw+tw-1)/tw, ny = (y1-y0+th-1)/th;
+    vector< vector<byte> > rgb(pool.size(), vector<byte>(3*tw));
+    vector< vector<byte> > in(pool.size(), vector<byte>(tw));
+    pool.run(nx*ny, [&](int t, int worker) {
+        int j0 = x0-ox + (t%nx)*tw, j1 = min(j0+tw, x1-ox);
+        int i0 = y0-oy + (t/nx)*th, i1 = min(i0+th, y1-oy);
+        byte* c = &rgb[worker][0];
+        byte* inside = &in[worker][0];
+        for(int i=i0; i<i1; i++) {
+            warpRow(S, M, i, j0, j1, c, inside);
+            Color* out = &pix[size_t(i)*capW + j0];
+            byte* cov = &covered[size_t(i)*capW + j0];
+            for(int j=0; j<j1-j0; j++) {
+                if(! inside[j])
+                    continue;
+                const byte* n = c+3*j;
+                if(cov[j]) // Overlapping
+                    out[j] = Color((out[j].r()+n[0])/2, (out[j].g()+n[1])/2,
+                                   (out[j].b()+n[2])/2);
+                else
+                    out[j] = Color(n[0], n[1], n[2]);
+                cov[j] = 1;
+            }
+        }
+    });
+
+    if(bx1 <= bx0) {
+        bx0 = x0; by0 = y0; bx1 = x1; by1 = y1;
+    } else {
+        bx0 = min(bx0, x0); by0 = min(by0, y0);
+        bx1 = max(bx1, x1); by1 = max(by1, y1);
+    }
+    return true;
+}
+
+// Gains of source S, whose canvas pixel (j,i) is point (j+x0,i+y0) of the
+// reference frame by F, equalizing its overlap with the rendered pixels.
+// The canvas keeps its exposure. Pixels are sampled on a grid.
+void Mosaic::matchGain(const WarpSource& S, const WarpMap& F,
+                       int x0, int y0, int x1, int y1, float gain[3]) const {
+    const int step = 4;
+    WarpMap G = subsampled(F, step);
+    const int gw = (x1-x0+step-1)/step, gh = (y1-y0+step-1)/step;
+    vector<byte> rgb(3*gw), in(gw);
+    OverlapStats o(0, 1); // Canvas and new image
+    for(int gy=0; gy<gh; gy++) {
+        warpRow(S, G, gy, 0, gw, &rgb[0], &in[0]);
+        size_t row = size_t(y0-oy + step*gy)*capW + (x0-ox);
+        for(int gx=0; gx<gw; gx++) {
+            size_t k = row + step*gx;
+            if(! (in[gx] && covered[k]))
+                continue;
+            o.n++;
+            o.sumI[0] += pix[k].r(); o.sumI[1] += pix[k].g();
+            o.sumI[2] += pix[k].b();
+            for(int c=0; c<3; c++)
+                o.sumJ[c] += rgb[3*gx+c];
+        }
+    }
+    vector<float> g = solveGains(2, vector<OverlapStats>(1, o));
+    for(int c=0; c<3; c++)
+        gain[c] = g[3+c]/g[c];
+}
+
+Image<Color> Mosaic::image() const {
+    Image<Color> I(max(0,bx1-bx0), max(0,by1-by0));
+    for(int y=by0; y<by1; y++)
+        copy(pix.begin() + size_t(y-oy)*capW + (bx0-ox),
+             pix.begin() + size_t(y-oy)*capW + (bx1-ox), &I(0,y-by0));
+    return I;
+}
+
+vector< Matrix<float> > chainHomographies(const vector< Matrix<float> >& H) {
+    vector< Matrix<float> > chain(1, Matrix<float>::Identity(3));
+    for(size_t k=1; k<H.size(); k++) {
+        Matrix<float> C = chain.back()*H[k];
+        chain.push_back(C/C(2,2));
+    }
+    return chain;
+}
@@ -0,0 +1,57 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Incremental mosaic of N images in the frame of a reference image.
+
+#ifndef PANORAMA_MOSAIC_H
+#define PANORAMA_MOSAIC_H
+
+#include "Render.h"
+#include "ThreadPool.h"
+
+// Canvas pixels sit on the integer grid of the reference frame. Adding an
+// image only warps its own footprint; when the canvas must grow it is
+// reallocated with slack and the rendered pixels are copied, never
+// resampled, so growth costs amortized constant time per pixel.
+class Mosaic {
+public:
+    explicit Mosaic(const RenderOptions& opt=RenderOptions());
+
+    // Add image I whose points map to the reference frame by H (identity
+    // for the reference itself). Pixels already rendered are averaged
+    // with the new ones; with opt.gain, I is first scaled to match their
+    // exposure. Returns false if the footprint is unbounded or
+    // unreasonably large.
+    bool add(const Imagine::Image<Imagine::Color,2>& I,
+             const Imagine::Matrix<float>& H);
+
+    // Rendered part of the canvas, white where no image contributes
+    Imagine::Image<Imagine::Color> image() const;
+    // Reference frame point of pixel (0,0) of image()
+    int x0() const { return bx0; }
+    int y0() const { return by0; }
+
+private:
+    Mosaic(const Mosaic&);
+    void operator=(const Mosaic&);
+    void reserve(int x0, int y0, int x1, int y1);
+    void matchGain(const WarpSource& S, const WarpMap& F,
+                   int x0, int y0, int x1, int y1, float gain[3]) const;
+
+    RenderOptions opt;
+    ThreadPool pool;
+    int ox, oy;                // Reference point of buffer pixel (0,0)
+    int capW, capH;            // Buffer size
+    int bx0, by0, bx1, by1;    // Rendered box, in reference frame
+    std::vector<Imagine::Color> pix;
+    std::vector<Imagine::byte> covered;
+};
+
+// Homographies to the frame of image 0 of a sequence, given for each
+// image k>0 the homography toPrevious[k] to image k-1 (index 0 unused).
+std::vector< Imagine::Matrix<float> >
+chainHomographies(const std::vector< Imagine::Matrix<float> >& toPrevious);
+
+#endif
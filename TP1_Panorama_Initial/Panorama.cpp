@@ -7,11 +7,30 @@
 #include <Imagine/Graphics.h>
 #include <Imagine/Images.h>
 #include <Imagine/LinAlg.h>
+#include "Bundle.h"
+#include "DeepZoom.h"
+#include "DLT.h"
+#include "Homography.h"
+#include "Mosaic.h"
+#include "Projection.h"
+#include "Remap.h"
+#include "Render.h"
+#include "Stream.h"
 #include <vector>
 #include <sstream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
 using namespace Imagine;
 using namespace std;
 
+// Matches of two images that are not consecutive, below which they are
+// not considered overlapping for the bundle adjustment
+static const size_t MIN_BUNDLE_MATCHES = 20;
+// Bytes of decoded images a bundle mosaic keeps between its two passes
+static const size_t BUNDLE_CACHE = size_t(1) << 30;
+
 // Record clicks in two images, until right button click
 void getClicks(Window w1, Window w2,
                vector<IntPoint2>& pts1, vector<IntPoint2>& pts2) {
@@ -56,48 +75,36 @@ void getClicks(Window w1, Window w2,
 
 }
 
-// Return homography compatible with point matches
+// Return homography compatible with point matches, least squares DLT in
+// normalized coordinates. With check, print the residual x2 ^ H*x1 of each
+// correspondence, which should be near 0.
 Matrix<float> getHomography(const vector<IntPoint2>& pts1,
-                            const vector<IntPoint2>& pts2) {
+                            const vector<IntPoint2>& pts2, bool check=false) {
     size_t n = min(pts1.size(), pts2.size());
+    vector<Match> m(n);
+    for(size_t i=0; i<n; i++) {
+        m[i].x1 = float(pts1[i].x()); m[i].y1 = float(pts1[i].y());
+        m[i].x2 = float(pts2[i].x()); m[i].y2 = float(pts2[i].y());
+    }
+    double h[9];
     if(n < 4) {
         cout << "Not enough correspondences: " << n << endl;
         return Matrix<float>::Identity(3);
     }
-    Matrix<double> A(2 * n, 8);
-    Vector<double> B(2 * n);
-    for (size_t i = 0; i < n; i++) {
-        B[2 * i] = pts2[i].x();
-        B[2 * i + 1] = pts2[i].y();
-
-        A(2 * i, 0) = pts1[i].x();
-        A(2 * i, 1) = pts1[i].y();
-        A(2 * i, 2) = 1;
-        A(2 * i, 3) = 0;
-        A(2 * i, 4) = 0;
-        A(2 * i, 5) = 0;
-        A(2 * i, 6) = -pts1[i].x() * pts2[i].x();
-        A(2 * i, 7) = -pts2[i].x() * pts1[i].y();
-        A(2 * i + 1, 0) = 0;
-        A(2 * i + 1, 1) = 0;
-        A(2 * i + 1, 2) = 0;
-        A(2 * i + 1, 3) = pts1[i].x();
-        A(2 * i + 1, 4) = pts1[i].y();
-        A(2 * i + 1, 5) = 1;
-        A(2 * i + 1, 6) = -pts1[i].x() * pts2[i].y();
-        A(2 * i + 1, 7) = -pts2[i].y() * pts1[i].y();
-    }
-
-    B = linSolve(A, B);
+    if(! homographyDLT(&m[0], 0, int(n), h)) {
+        cout << "Degenerate correspondences (aligned or repeated points): "
+             << "no homography" << endl;
+        return Matrix<float>::Identity(3);
+    }
     Matrix<float> H(3, 3);
-    H(0,0)=B[0]; H(0,1)=B[1]; H(0,2)=B[2];
-    H(1,0)=B[3]; H(1,1)=B[4]; H(1,2)=B[5];
-    H(2,0)=B[6]; H(2,1)=B[7]; H(2,2)=1;
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            H(r,c) = float(h[3*r+c]);
 
     // Sanity check
-    for(size_t i=0; i<n; i++) {
-        float v1[]={(float)pts1[i].x(), (float)pts1[i].y(), 1.0f};
-        float v2[]={(float)pts2[i].x(), (float)pts2[i].y(), 1.0f};
+    for(size_t i=0; check && i<n; i++) {
+        float v1[]={m[i].x1, m[i].y1, 1.0f};
+        float v2[]={m[i].x2, m[i].y2, 1.0f};
         Vector<float> x1(v1,3);
         Vector<float> x2(v2,3);
         x1 = H*x1;
@@ -116,11 +123,33 @@ void growTo(float& x0, float& y0, float& x1, float& y1, float x, float y) {
     if(y>y1) y1=y;
 }
 
-// Panorama construction
-void panorama(const Image<Color,2>& I1, const Image<Color,2>& I2,
-              Matrix<float> H) {
+// Elapsed time of the stages of a run, in milliseconds
+class StageTimer {
+public:
+    StageTimer() { start = chrono::steady_clock::now(); }
+    // Record the time since the previous stage under the given name
+    void stage(const string& name) {
+        chrono::steady_clock::time_point t = chrono::steady_clock::now();
+        stages.push_back(make_pair(name,
+            chrono::duration<double,milli>(t - start).count()));
+        start = t;
+    }
+    void print(ostream& out) const {
+        for(size_t i=0; i<stages.size(); i++)
+            out << "time " << stages[i].first << ": "
+                << stages[i].second << " ms" << endl;
+    }
+private:
+    chrono::steady_clock::time_point start;
+    vector< pair<string,double> > stages;
+};
+
+// Bounding box of I2 and of I1 projected by H
+void panoramaBox(const Image<Color,2>& I1, const Image<Color,2>& I2,
+                 const Matrix<float>& H,
+                 float& x0, float& y0, float& x1, float& y1) {
     Vector<float> v(3);
-    float x0=0, y0=0, x1=I2.width(), y1=I2.height();
+    x0=0; y0=0; x1=I2.width(); y1=I2.height();
 
     v[0]=0; v[1]=0; v[2]=1;
     v=H*v; v/=v[2];
@@ -139,86 +168,605 @@ void panorama(const Image<Color,2>& I1, const Image<Color,2>& I2,
     growTo(x0, y0, x1, y1, v[0], v[1]);
 
     cout << "x0 x1 y0 y1=" << x0 << ' ' << x1 << ' ' << y0 << ' ' << y1<<endl;
+}
 
-    Image<Color> I(int(x1 - x0), int(y1 - y0));
-    setActiveWindow( openWindow(I.width(), I.height()) );
-    I.fill(WHITE);
+// Canvas holding I2 and I1 mapped by H, drawn on the given projection:
+// its size w x h and the maps M1 and M2 to I1 and I2. With focal<=0, the
+// focal length of curved projections is estimated from H.
+bool panoramaCanvas(const Image<Color,2>& I1, const Image<Color,2>& I2,
+                    const Matrix<float>& H, Projection proj, float focal,
+                    int& w, int& h, WarpMap& M1, WarpMap& M2) {
+    if(proj == PROJ_PLANE) {
+        float x0, y0, x1, y1;
+        panoramaBox(I1, I2, H, x0, y0, x1, y1);
+        w = int(x1 - x0);
+        h = int(y1 - y0);
+        // Canvas pixel (j,i) is point (j+x0,i+y0) in frame of I2
+        M1 = warpMap(inverse(H), x0, y0);
+        M2 = warpMap(Matrix<float>::Identity(3), x0, y0);
+        return true;
+    }
+    if(focal <= 0) {
+        focal = focalFromHomography(H, I1.width(), I1.height(),
+                                    I2.width(), I2.height());
+        if(focal <= 0) {
+            focal = float(max(I2.width(), I2.height()));
+            cout << "Focal length not estimated, ";
+        }
+    }
+    cout << "focal=" << focal << endl;
+    if(! projectedCanvas(proj, focal, H, I1.width(), I1.height(),
+                         I2.width(), I2.height(), w, h, M1, M2)) {
+        cerr << "Field of view too wide for the canvas" << endl;
+        return false;
+    }
+    cout << "canvas=" << w << 'x' << h << endl;
+    return true;
+}
 
-    H = inverse(H);
-    
-    for(int i=0; i<I.height(); i++) {
-        for(int j=0; j<I.width(); j++) {
+// Panorama construction
+Image<Color> panorama(const Image<Color,2>& I1, const Image<Color,2>& I2,
+                      int w, int h, const WarpMap& M1, const WarpMap& M2,
+                      const RenderOptions& opt=RenderOptions(),
+                      StageTimer* timer=0) {
+    Image<Color> I(w, h);
+    WarpSource S1(I1), S2(I2);
+    renderPanorama(I, S1, M1, S2, M2, opt);
+    if(timer) timer->stage("warp");
+    return I;
+}
 
-            v[0] = j + x0; 
-            v[1] = i + y0; 
-            v[2] = 1;
+// Read point correspondences "x1 y1 x2 y2", one per line, # for comments
+bool readCorrespondences(const char* name,
+                         vector<IntPoint2>& pts1, vector<IntPoint2>& pts2) {
+    ifstream f(name);
+    if(! f.is_open())
+        return false;
+    string line;
+    while(getline(f, line)) {
+        if(line.empty() || line[0]=='#')
+            continue;
+        istringstream is(line);
+        float x1, y1, x2, y2;
+        if(! (is >> x1 >> y1 >> x2 >> y2))
+            return false;
+        pts1.push_back(IntPoint2(int(floor(x1+.5f)), int(floor(y1+.5f))));
+        pts2.push_back(IntPoint2(int(floor(x2+.5f)), int(floor(y2+.5f))));
+    }
+    return true;
+}
 
-            // Right side
-            if(v[0] >=0 && v[0] < I2.width() && v[1] >= 0 && v[1] < I2.height()) {
-                // Interpolate with pixels of Image 2
-                I(j,i) = I2.interpolate(v[0],v[1]);
+// Mosaic of several images, each one matched to the previous one. With
+// bundle, each image is also matched to the one before the previous, and
+// all homographies are refined together before rendering. The images
+// decoded by the first pass are kept for the rendering, up to
+// BUNDLE_CACHE bytes; the ones past it are loaded again.
+int mosaic(const vector<const char*>& names, const string& output,
+           const RenderOptions& opt, bool bundle, bool batch) {
+    Mosaic M(opt);
+    vector< Matrix<float> > toPrevious(1, Matrix<float>::Identity(3));
+    Matrix<float> toFirst = Matrix<float>::Identity(3); // Running chain
+    vector<PairMatches> pairs;
+    vector<Features> recent; // Features of the last two images
+    vector< Image<Color> > kept(bundle? names.size(): 0);
+    size_t keptBytes = 0;
+    for(size_t k=0; k<names.size(); k++) {
+        StageTimer timer;
+        Image<Color> I;
+        if(! load(I, names[k])) {
+            cerr << "Unable to load " << names[k] << endl;
+            return 1;
+        }
+        Features f = detectFeatures(I);
+        timer.stage("features");
+        for(size_t d=1; d<=recent.size(); d++) {
+            PairMatches P;
+            P.i = int(k);
+            P.j = int(k-d);
+            matchFeatures(f, recent[recent.size()-d], P.matches, 0.8f,
+                          opt.threads);
+            timer.stage("matching");
+            Matrix<float> H = computeH(P.matches);
+            timer.stage("homography");
+            if(d == 1)
+                toPrevious.push_back(H);
+            if(bundle && (d == 1 || P.matches.size() >= MIN_BUNDLE_MATCHES))
+                pairs.push_back(P);
+        }
+        recent.push_back(f);
+        if(recent.size() > (bundle? 2u: 1u))
+            recent.erase(recent.begin());
+        const size_t bytes = size_t(I.width())*I.height()*sizeof(Color);
+        if(bundle && keptBytes + bytes <= BUNDLE_CACHE) {
+            kept[k] = I;
+            keptBytes += bytes;
+        }
+        if(! bundle) {
+            // Same product as chainHomographies, one factor per image
+            if(k > 0) {
+                toFirst = toFirst*toPrevious.back();
+                toFirst = toFirst/toFirst(2,2);
+            }
+            if(! M.add(I, toFirst))
+                cerr << "Skipping " << names[k] << ": bad homography" << endl;
+            timer.stage("warp");
+        }
+        cout << names[k] << endl;
+        timer.print(cout);
+    }
+    StageTimer timer;
+    if(bundle) {
+        vector< Matrix<float> > H = chainHomographies(toPrevious);
+        BundleOptions bOpt;
+        bOpt.threads = opt.threads;
+        bOpt.verbose = true;
+        double rms = bundleAdjust(H, pairs, bOpt);
+        if(rms < 0)
+            cerr << "Bundle adjustment failed, keeping chained homographies"
+                 << endl;
+        else
+            cout << "Bundle adjustment RMS error: " << rms << " px" << endl;
+        timer.stage("bundle");
+        for(size_t k=0; k<names.size(); k++) {
+            Image<Color> I = kept[k];
+            kept[k] = Image<Color>(); // Released once warped
+            if(I.width() == 0 && ! load(I, names[k])) {
+                cerr << "Unable to load " << names[k] << endl;
+                return 1;
             }
+            if(! M.add(I, H[k]))
+                cerr << "Skipping " << names[k] << ": bad homography" << endl;
+        }
+        timer.stage("warp");
+    }
+    Image<Color> I = M.image();
+    if(! save(I, output, 100)) {
+        cerr << "Unable to save " << output << endl;
+        return 1;
+    }
+    timer.stage("encode");
+    timer.print(cout);
+    if(! batch) {
+        setActiveWindow( openWindow(I.width(), I.height()) );
+        display(I,0,0);
+        endGraphics();
+    }
+    return 0;
+}
 
-            v = H * v;
-            v /= v[2];
-
-            // Left side
-            if(v[0] >= 0 && v[0] < I1.width() && v[1] >= 0 && v[1] < I1.height()) {
-                
-                // Overlaping
-                if(v[0] >=0 && v[0] < I2.width() && v[1] >= 0 && v[1] < I2.height()) {
-                    Color c = I1.interpolate(v[0],v[1]);
-                    I(j,i).r() = (I(j,i).r()+c.r())/2;
-                    I(j,i).g() = (I(j,i).g()+c.g())/2;
-                    I(j,i).b() = (I(j,i).b()+c.b())/2;
-                } else
-                    I(j,i) = I1.interpolate(v[0],v[1]);
+// Homography from I1 to I2, from SIFT matches, a correspondences file
+// or the user's clicks. With verbose, the residuals of the correspondences
+// are printed.
+bool estimateH(const Image<Color,2>& I1, const Image<Color,2>& I2,
+               const char* s1, const char* s2,
+               bool automatic, const char* pointsFile, int threads,
+               bool verbose, StageTimer& timer, Matrix<float>& H) {
+    if(automatic) {
+        Features f1 = detectFeatures(I1), f2 = detectFeatures(I2);
+        cout << "Im1: " << f1.size() << " Im2: " << f2.size() << endl;
+        timer.stage("features");
+        vector<Match> matches;
+        matchFeatures(f1, f2, matches, 0.8f, threads);
+        cout << "matches: " << matches.size() << endl;
+        timer.stage("matching");
+        H = computeH(matches);
+        timer.stage("homography");
+    } else {
+        vector<IntPoint2> pts1, pts2;
+        if(pointsFile) {
+            if(! readCorrespondences(pointsFile, pts1, pts2)) {
+                cerr << "Unable to read correspondences " << pointsFile
+                     << endl;
+                return false;
             }
+        } else {
+            // Display images and get user's clicks
+            Window w1 = openWindow(I1.width(), I1.height(), s1);
+            display(I1,0,0);
+            Window w2 = openWindow(I2.width(), I2.height(), s2);
+            setActiveWindow(w2);
+            display(I2,0,0);
+            getClicks(w1, w2, pts1, pts2);
+        }
+
+        vector<IntPoint2>::const_iterator it;
+        cout << "pts1="<<endl;
+        for(it=pts1.begin(); it != pts1.end(); it++)
+            cout << *it << endl;
+        cout << "pts2="<<endl;
+        for(it=pts2.begin(); it != pts2.end(); it++)
+            cout << *it << endl;
+
+        // Compute homography
+        timer = StageTimer();
+        H = getHomography(pts1, pts2, verbose);
+        timer.stage("homography");
+    }
+    cout << "H=" << H/H(2,2);
+    return true;
+}
+
+// Output file of frame k out of n: output itself if n==1, else with the
+// frame number before the extension
+string frameName(const string& output, size_t k, size_t n) {
+    if(n == 1)
+        return output;
+    size_t dot = output.rfind('.');
+    if(dot == string::npos || output.find('/', dot) != string::npos)
+        dot = output.size();
+    ostringstream name;
+    name << output.substr(0, dot) << '-';
+    name.width(4);
+    name.fill('0');
+    name << k << output.substr(dot);
+    return name.str();
+}
+
+// Pairs of frames of a fixed rig, stitched with the remap table cached in
+// file table. The homography is only estimated, from the first pair, when
+// the table is missing or was built for other frame sizes.
+int rig(const vector<const char*>& names, const string& table,
+        const string& output, bool automatic, const char* pointsFile,
+        const RenderOptions& opt, bool batch, bool verbose) {
+    Image<Color> I1, I2, I;
+    if(! load(I1, names[0]) || ! load(I2, names[1])) {
+        cerr << "Unable to load the images" << endl;
+        return 1;
+    }
+    StageTimer timer;
+    RemapTable T;
+    if(T.load(table) && T.matches(I1.width(), I1.height(),
+                                  I2.width(), I2.height())) {
+        cout << "H=" << T.homography();
+        timer.stage("load table");
+    } else {
+        Matrix<float> H;
+        if(! estimateH(I1, I2, names[0], names[1], automatic, pointsFile,
+                       opt.threads, verbose, timer, H))
+            return 1;
+        float x0, y0, x1, y1;
+        panoramaBox(I1, I2, H, x0, y0, x1, y1);
+        if(! T.build(I1.width(), I1.height(), I2.width(), I2.height(),
+                     H, x0, y0, int(x1 - x0), int(y1 - y0))) {
+            cerr << "Panorama too large for a remap table" << endl;
+            return 1;
         }
+        if(! T.save(table))
+            cerr << "Unable to save " << table << endl;
+        timer.stage("build table");
     }
-        
-    save(I,"ca-panorama.jpg",100);
-    display(I,0,0);
+    timer.print(cout);
+
+    ThreadPool pool(opt.threads);
+    const size_t n = names.size()/2;
+    for(size_t k=0; k<n; k++) {
+        timer = StageTimer();
+        if(k>0 && (! load(I1, names[2*k]) || ! load(I2, names[2*k+1]))) {
+            cerr << "Unable to load " << names[2*k] << ' ' << names[2*k+1]
+                 << endl;
+            return 1;
+        }
+        if(! T.matches(I1.width(), I1.height(), I2.width(), I2.height())) {
+            cerr << "Frame sizes differ from the rig: " << names[2*k] << ' '
+                 << names[2*k+1] << endl;
+            return 1;
+        }
+        timer.stage("decode");
+        T.apply(I1, I2, I, pool);
+        timer.stage("remap");
+        string name = frameName(output, k, n);
+        if(! save(I, name, 100)) {
+            cerr << "Unable to save " << name << endl;
+            return 1;
+        }
+        timer.stage("encode");
+        cout << name << endl;
+        timer.print(cout);
+    }
+    if(! batch) {
+        setActiveWindow( openWindow(I.width(), I.height()) );
+        display(I,0,0);
+        endGraphics();
+    }
+    return 0;
+}
+
+// Frame pairs of a moving rig, stitched as a stream: the homography of
+// the first pair is estimated, then tracked, the canvas is that of the
+// first pair.
+int video(const vector<const char*>& names, const string& output,
+          bool automatic, const char* pointsFile, const RenderOptions& opt,
+          float threshold, bool verbose) {
+    Image<Color> I1, I2;
+    if(! load(I1, names[0]) || ! load(I2, names[1])) {
+        cerr << "Unable to load the images" << endl;
+        return 1;
+    }
+    StageTimer timer;
+    Matrix<float> H;
+    if(! estimateH(I1, I2, names[0], names[1], automatic, pointsFile,
+                   opt.threads, verbose, timer, H))
+        return 1;
+    float x0, y0, x1, y1;
+    panoramaBox(I1, I2, H, x0, y0, x1, y1);
+    timer.print(cout);
+
+    const size_t n = names.size()/2;
+    StreamOptions so;
+    so.threads = opt.threads;
+    so.threshold = threshold;
+    StreamStats stats;
+    FrameReader read = [&](size_t k, Image<Color,2>& J1, Image<Color,2>& J2) {
+        if(k == 0) { // Already decoded
+            J1 = I1;
+            J2 = I2;
+            return true;
+        }
+        if(! load(J1, names[2*k]) || ! load(J2, names[2*k+1])) {
+            cerr << "Unable to load " << names[2*k] << ' ' << names[2*k+1]
+                 << endl;
+            return false;
+        }
+        return true;
+    };
+    FrameWriter write = [&](size_t k, const Image<Color,2>& I) {
+        string name = frameName(output, k, n);
+        if(! save(I, name, 100)) {
+            cerr << "Unable to save " << name << endl;
+            return false;
+        }
+        return true;
+    };
+    bool ok = stitchStream(n, read, write, H, x0, y0, int(x1 - x0),
+                           int(y1 - y0), so, &stats);
+    cout << stats.frames << " frames in " << stats.seconds << " s ("
+         << stats.frames/max(stats.seconds, 1e-9) << " fps), "
+         << stats.rebuilds << " remap tables, tracking lost "
+         << stats.lost << " times" << endl;
+    // Per frame busy time of each stage
+    const double perFrame = 1000.0/max<size_t>(stats.frames, 1);
+    cout << "time read: " << stats.reading*perFrame << " ms" << endl
+         << "time track: " << stats.tracking*perFrame << " ms" << endl
+         << "time warp: " << stats.warping*perFrame << " ms" << endl
+         << "time write: " << stats.writing*perFrame << " ms" << endl;
+    return ok? 0: 1;
+}
+
+void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [options] [image1 image2 [image3...]]"
+         << endl
+         << "  More than two images are mosaicked in the frame of the first"
+         << endl
+         << "  one, each matched automatically to the previous one." << endl
+         << "  -b, --batch       no window, needs --points or --auto" << endl
+         << "  -a, --auto        SIFT matches and RANSAC instead of clicks"
+         << endl
+         << "  -p, --points F    correspondences file: x1 y1 x2 y2 per line"
+         << endl
+         << "  -o, --output F    output image (default ca-panorama.jpg)"
+         << endl
+         << "  -t, --threads N   rendering threads (default 0 = all cores)"
+         << endl
+         << "  -d, --deepzoom F  write tiles F.dzi and F_files/ instead of one"
+         << endl
+         << "                    image, for canvases too large for memory"
+         << endl
+         << "  -s, --tile-size N Deep Zoom tile size (default 256)" << endl
+         << "  -g, --gain        compensate exposure differences" << endl
+         << "  --bundle          refine the homographies of a mosaic together"
+         << endl
+         << "  --blend M         overlap blending: average (default), feather"
+         << endl
+         << "                    or multiband" << endl
+         << "  --seam            cut the overlap along the seam of least color"
+         << endl
+         << "                    difference, the mask of multiband blending"
+         << endl
+         << "                    (two images, no --deepzoom)" << endl
+         << "  --filter F        resampling: bilinear (default, fixed point),"
+         << endl
+         << "                    bicubic (fixed point) or float (bilinear)"
+         << endl
+         << "  -r, --remap F     images are frame pairs of a fixed rig, stitched"
+         << endl
+         << "                    with the remap table F, built if needed" << endl
+         << "  --video           images are frame pairs of a moving rig,"
+         << endl
+         << "                    stitched as a stream, H tracked frame to frame"
+         << endl
+         << "  --move T          with --video, motion in pixels above which the"
+         << endl
+         << "                    remap table is rebuilt (default 0.5)" << endl
+         << "  --projection P    canvas surface: plane (default), cylinder or"
+         << endl
+         << "                    sphere, for wide fields of view (two images,"
+         << endl
+         << "                    no --remap)" << endl
+         << "  -f, --focal F     focal length in pixels of the curved"
+         << endl
+         << "                    projections (default estimated from H)"
+         << endl
+         << "  -v, --verbose     print the residuals of the correspondences"
+         << endl;
 }
 
 // Main function
 int main(int argc, char* argv[]) {
-    const char* s1 = argc>1? argv[1]: srcPath("image0006.jpg");
-    const char* s2 = argc>2? argv[2]: srcPath("image0007.jpg");
+    const char* s1 = srcPath("image0006.jpg");
+    const char* s2 = srcPath("image0007.jpg");
+    const char* pointsFile = 0;
+    string output = "ca-panorama.jpg", deepZoom, remap;
+    bool batch = false, automatic = false, verbose = false, bundle = false;
+    bool stream = false;
+    float threshold = 0.5f;
+    RenderOptions opt;
+    DeepZoomOptions dzOpt;
+    Projection projection = PROJ_PLANE;
+    float focal = 0;
+
+    vector<const char*> images;
+    for(int i=1; i<argc; i++) {
+        string a = argv[i];
+        bool hasValue = i+1<argc;
+        if(a=="-b" || a=="--batch")
+            batch = true;
+        else if(a=="-a" || a=="--auto")
+            automatic = true;
+        else if((a=="-p" || a=="--points") && hasValue)
+            pointsFile = argv[++i];
+        else if((a=="-o" || a=="--output") && hasValue)
+            output = argv[++i];
+        else if((a=="-t" || a=="--threads") && hasValue)
+            opt.threads = atoi(argv[++i]);
+        else if((a=="-d" || a=="--deepzoom") && hasValue)
+            deepZoom = argv[++i];
+        else if((a=="-s" || a=="--tile-size") && hasValue)
+            dzOpt.tileSize = atoi(argv[++i]);
+        else if(a=="--bundle")
+            bundle = true;
+        else if(a=="-v" || a=="--verbose")
+            verbose = true;
+        else if(a=="-g" || a=="--gain")
+            opt.gain = true;
+        else if(a=="--seam")
+            opt.seam = true;
+        else if(a=="--video")
+            stream = true;
+        else if(a=="--move" && hasValue)
+            threshold = float(atof(argv[++i]));
+        else if(a=="--blend" && hasValue) {
+            string m = argv[++i];
+            if(m == "average")
+                opt.blend = BLEND_AVERAGE;
+            else if(m == "feather")
+                opt.blend = BLEND_FEATHER;
+            else if(m == "multiband")
+                opt.blend = BLEND_MULTIBAND;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if(a=="--filter" && hasValue) {
+            string f = argv[++i];
+            if(f == "bilinear")
+                opt.filter = FILTER_BILINEAR;
+            else if(f == "bicubic")
+                opt.filter = FILTER_BICUBIC;
+            else if(f == "float")
+                opt.filter = FILTER_BILINEAR_FLOAT;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if(a=="--projection" && hasValue) {
+            string p = argv[++i];
+            if(p == "plane")
+                projection = PROJ_PLANE;
+            else if(p == "cylinder")
+                projection = PROJ_CYLINDER;
+            else if(p == "sphere")
+                projection = PROJ_SPHERE;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if((a=="-f" || a=="--focal") && hasValue)
+            focal = float(atof(argv[++i]));
+        else if((a=="-r" || a=="--remap") && hasValue)
+            remap = argv[++i];
+        else if(a.size()>1 && a[0]=='-') {
+            usage(argv[0]);
+            return 1;
+        } else
+            images.push_back(argv[i]);
+    }
+    if(stream) {
+        if(images.empty()) {
+            images.push_back(s1);
+            images.push_back(s2);
+        }
+        if(images.size()%2 || (batch && !pointsFile && !automatic) ||
+           (pointsFile && automatic) || projection != PROJ_PLANE ||
+           ! remap.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+        return video(images, output, automatic, pointsFile, opt, threshold,
+                     verbose);
+    }
+    if(! remap.empty()) {
+        if(images.empty()) {
+            images.push_back(s1);
+            images.push_back(s2);
+        }
+        if(images.size()%2 || (batch && !pointsFile && !automatic) ||
+           (pointsFile && automatic) || projection != PROJ_PLANE) {
+            usage(argv[0]);
+            return 1;
+        }
+        return rig(images, remap, output, automatic, pointsFile, opt, batch,
+                   verbose);
+    }
+    if(images.size()>2 && !pointsFile && projection == PROJ_PLANE)
+        return mosaic(images, output, opt, bundle, batch);
+    if(images.size()==1 || images.size()>2 ||
+       (batch && !pointsFile && !automatic) || (pointsFile && automatic)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(images.size()==2) {
+        s1 = images[0];
+        s2 = images[1];
+    }
 
-    // Load and display images
+    // Load images
     Image<Color> I1, I2;
     if( ! load(I1, s1) ||
         ! load(I2, s2) ) {
         cerr<< "Unable to load the images" << endl;
         return 1;
     }
-    Window w1 = openWindow(I1.width(), I1.height(), s1);
-    display(I1,0,0);
-    Window w2 = openWindow(I2.width(), I2.height(), s2);
-    setActiveWindow(w2);
-    display(I2,0,0);
-
-    // Get user's clicks in images
-    vector<IntPoint2> pts1, pts2;
-    getClicks(w1, w2, pts1, pts2);
-
-    vector<IntPoint2>::const_iterator it;
-    cout << "pts1="<<endl;
-    for(it=pts1.begin(); it != pts1.end(); it++)
-        cout << *it << endl;
-    cout << "pts2="<<endl;
-    for(it=pts2.begin(); it != pts2.end(); it++)
-        cout << *it << endl;
-
-    // Compute homography
-    Matrix<float> H = getHomography(pts1, pts2);
-    cout << "H=" << H/H(2,2);
+
+    StageTimer timer;
+    Matrix<float> H;
+    if(! estimateH(I1, I2, s1, s2, automatic, pointsFile, opt.threads,
+                   verbose, timer, H))
+        return 1;
+
+    int w, h;
+    WarpMap M1, M2;
+    if(! panoramaCanvas(I1, I2, H, projection, focal, w, h, M1, M2))
+        return 1;
+    timer.stage("bounding box");
+
+    if(! deepZoom.empty()) {
+        // Tiles straight to disk, the canvas is never allocated
+        dzOpt.threads = opt.threads;
+        dzOpt.blend = opt.blend;
+        dzOpt.gain = opt.gain;
+        dzOpt.filter = opt.filter;
+        if(! writeDeepZoom(deepZoom, I1, I2, M1, M2, w, h, dzOpt)) {
+            cerr << "Unable to write " << deepZoom << ".dzi" << endl;
+            return 1;
+        }
+        timer.stage("tiles");
+        timer.print(cout);
+        return 0;
+    }
 
     // Apply homography
-    panorama(I1, I2, H);
+    Image<Color> I = panorama(I1, I2, w, h, M1, M2, opt, &timer);
+    if(! save(I, output, 100)) {
+        cerr << "Unable to save " << output << endl;
+        return 1;
+    }
+    timer.stage("encode");
+    timer.print(cout);
 
-    endGraphics();
+    if(! batch) {
+        setActiveWindow( openWindow(I.width(), I.height()) );
+        display(I,0,0);
+        endGraphics();
+    }
     return 0;
 }
-
@@ -0,0 +1,123 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Projection.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace Imagine;
+using namespace std;
+
+// Squared focal of one of the cameras from two equations, 0 if none fits
+static double focal2(double n1, double d1, double n2, double d2) {
+    double v1 = n1/d1, v2 = n2/d2;
+    if(v1 < v2)
+        swap(v1, v2);
+    if(v1 > 0 && v2 > 0)
+        return fabs(d1) > fabs(d2)? v1: v2;
+    return v1 > 0? v1: 0;
+}
+
+float focalFromHomography(const Matrix<float>& H,
+                          int w1, int h1, int w2, int h2) {
+    // Centered coordinates: h = T2^-1 * H * T1
+    const double c1x = (w1-1)/2.0, c1y = (h1-1)/2.0;
+    const double c2x = (w2-1)/2.0, c2y = (h2-1)/2.0;
+    double h[9];
+    for(int r=0; r<3; r++) {
+        double a = H(r,0), b = H(r,1);
+        h[3*r+0] = a;
+        h[3*r+1] = b;
+        h[3*r+2] = a*c1x + b*c1y + H(r,2);
+    }
+    for(int c=0; c<3; c++) {
+        h[0+c] -= c2x*h[6+c];
+        h[3+c] -= c2y*h[6+c];
+    }
+    // H ~ K2*R*K1^-1: the columns and the rows of K2^-1*H*K1 are orthogonal
+    // with equal norms. Its first two columns scale the first two rows of h
+    // by 1/f2, which gives the destination focal f2; its rows scale the
+    // first two columns of h by f1, which gives the source focal f1.
+    double f2 = focal2(-(h[0]*h[1] + h[3]*h[4]), h[6]*h[7],
+                       h[0]*h[0] + h[3]*h[3] - h[1]*h[1] - h[4]*h[4],
+                       (h[7]-h[6])*(h[7]+h[6]));
+    double f1 = focal2(-h[2]*h[5], h[0]*h[3] + h[1]*h[4],
+                       h[5]*h[5] - h[2]*h[2],
+                       h[0]*h[0] + h[1]*h[1] - h[3]*h[3] - h[4]*h[4]);
+    if(f1 > 0 && f2 > 0)
+        return float(pow(f1*f2, 0.25));
+    return float(sqrt(max(f1, f2)));
+}
+
+// Longitude and second coordinate (height or latitude) of ray r
+static void angles(Projection proj, const double r[3],
+                   double& theta, double& v) {
+    double rho = sqrt(r[0]*r[0] + r[2]*r[2]);
+    theta = atan2(r[0], r[2]);
+    v = proj==PROJ_SPHERE? atan2(r[1], rho): r[1]/max(rho, 1e-12);
+}
+
+bool projectedCanvas(Projection proj, float f, const Matrix<float>& H,
+                     int w1, int h1, int w2, int h2,
+                     int& w, int& h, WarpMap& M1, WarpMap& M2,
+                     double maxPixels) {
+    // K2: pixel of I2 <- ray in the camera frame of I2
+    Matrix<float> K2 = Matrix<float>::Identity(3);
+    K2(0,0) = K2(1,1) = f;
+    K2(0,2) = (w2-1)/2.0f;
+    K2(1,2) = (h2-1)/2.0f;
+    // Rays of I1: K2^-1*H, with the sign making the determinant positive
+    // as that of a rotation, so that rays point forward
+    Matrix<float> G = H;
+    double det = double(H(0,0))*(double(H(1,1))*H(2,2) - double(H(1,2))*H(2,1))
+               - double(H(0,1))*(double(H(1,0))*H(2,2) - double(H(1,2))*H(2,0))
+               + double(H(0,2))*(double(H(1,0))*H(2,1) - double(H(1,1))*H(2,0));
+    if(det < 0)
+        G = -G;
+
+    // Range of the angles of the rays of the borders of both images
+    double t0=1e9, t1=-1e9, v0=1e9, v1=-1e9;
+    const int n = 64; // Samples per side
+    for(int img=0; img<2; img++) {
+        int iw = img? w2: w1, ih = img? h2: h1;
+        for(int k=0; k<4*n; k++) {
+            double u = double(k%n)/n, x, y;
+            switch(k/n) {
+            case 0: x = u*iw;     y = 0;        break;
+            case 1: x = iw;       y = u*ih;     break;
+            case 2: x = (1-u)*iw; y = ih;       break;
+            default: x = 0;       y = (1-u)*ih; break;
+            }
+            double p[3] = {x, y, 1};
+            if(! img) { // To the frame of I2
+                double q[3];
+                for(int r=0; r<3; r++)
+                    q[r] = G(r,0)*x + G(r,1)*y + G(r,2);
+                copy(q, q+3, p);
+            }
+            double ray[3] = {p[0]-K2(0,2)*p[2], p[1]-K2(1,2)*p[2], f*p[2]};
+            double theta, v;
+            angles(proj, ray, theta, v);
+            t0 = min(t0, theta); t1 = max(t1, theta);
+            v0 = min(v0, v);     v1 = max(v1, v);
+        }
+    }
+    // Heights on the cylinder are bounded at +-80 degrees
+    const double halfPi = 2*atan(1.0);
+    const double vMax = proj==PROJ_SPHERE? halfPi: tan(halfPi*80/90);
+    v0 = max(v0, -vMax);
+    v1 = min(v1, vMax);
+    double cw = ceil((t1-t0)*f), ch = ceil((v1-v0)*f);
+    if(! (cw >= 1 && ch >= 1 && cw*ch <= maxPixels))
+        return false;
+    w = int(cw);
+    h = int(ch);
+
+    const float t[4] = {float(t0), 1/f, float(v0), 1/f};
+    shared_ptr<const CanvasRays> rays = make_shared<CanvasRays>(proj, t, w, h);
+    M1 = warpMap(inverse(G)*K2, rays);
+    M2 = warpMap(K2, rays);
+    return true;
+}
@@ -0,0 +1,33 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Cylindrical and spherical canvases, for fields of view too wide for a
+// plane. Cameras are assumed to rotate about their optical center, with
+// square pixels, the same focal length and the principal point at the
+// image center.
+
+#ifndef PANORAMA_PROJECTION_H
+#define PANORAMA_PROJECTION_H
+
+#include "Warp.h"
+
+// Focal length in pixels of the camera rotation explaining H, mapping a
+// w1 x h1 image to a w2 x h2 one (Shum and Szeliski). 0 if H does not
+// look like a rotation.
+float focalFromHomography(const Imagine::Matrix<float>& H,
+                          int w1, int h1, int w2, int h2);
+
+// Canvas of projection proj (not PROJ_PLANE) and focal f, in the frame of
+// the camera of I2 (w2 x h2), holding I1 (w1 x h1) mapped by H and I2.
+// One canvas pixel is 1/f radian of longitude, so the size follows the
+// field of view. M1 and M2 map it to I1 and I2, sharing the ray tables.
+// False if the canvas would exceed maxPixels.
+bool projectedCanvas(Projection proj, float f,
+                     const Imagine::Matrix<float>& H,
+                     int w1, int h1, int w2, int h2,
+                     int& w, int& h, WarpMap& M1, WarpMap& M2,
+                     double maxPixels=4e8);
+
+#endif
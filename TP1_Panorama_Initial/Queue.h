@@ -0,0 +1,66 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Bounded blocking queue between the threads of a pipeline.
+
+#ifndef PANORAMA_QUEUE_H
+#define PANORAMA_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// FIFO of at most capacity items: push() waits while it is full, pop()
+// while it is empty, so a slow stage holds back the faster ones instead of
+// letting frames pile up. close() ends the stream: pop() then drains the
+// remaining items and returns false, push() drops its item.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+    : cap(capacity>0? capacity: 1), closed(false) {}
+
+    // False if the queue was closed, the item is then dropped
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m);
+        notFull.wait(lock, [this] { return closed || items.size() < cap; });
+        if(closed)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // False once the queue is closed and empty
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m);
+        notEmpty.wait(lock, [this] { return closed || ! items.empty(); });
+        if(items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    BoundedQueue(const BoundedQueue&);
+    void operator=(const BoundedQueue&);
+
+    const size_t cap;
+    bool closed;
+    std::deque<T> items;
+    std::mutex m;
+    std::condition_variable notFull, notEmpty;
+};
+
+#endif
@@ -0,0 +1,336 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Remap.h"
+#include "Warp.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Imagine;
+using namespace std;
+
+static const char MAGIC[8] = {'P','A','N','O','R','M','A','P'};
+static const uint32_t VERSION = 1;
+static const int WEIGHT_BITS = 11;         // Bilinear weights in 1/2048
+static const uint32_t RIGHT = 1u<<30, BOTTOM = 1u<<31, INDEX = RIGHT-1;
+static const double MAX_PIXELS = double(INDEX); // Canvas and sources
+
+// File header, followed by start1, start2, mask and the entries
+struct RemapHeader {
+    char magic[8];
+    uint32_t version, unused;
+    int32_t w, h, w1, h1, w2, h2;
+    float H[9], x0, y0;
+    uint32_t n1, n2;
+};
+
+// Byte offsets of the parts of a table
+struct Layout {
+    size_t start1, start2, mask, entries1, entries2, size;
+    Layout(int w, int h, uint32_t n1, uint32_t n2) {
+        start1 = (sizeof(RemapHeader)+7) & ~size_t(7);
+        start2 = start1 + 4*(size_t(h)+1);
+        mask = start2 + 4*(size_t(h)+1);
+        entries1 = (mask + size_t(w)*h + 7) & ~size_t(7);
+        entries2 = entries1 + sizeof(RemapEntry)*n1;
+        size = entries2 + sizeof(RemapEntry)*n2;
+    }
+};
+
+RemapTable::RemapTable()
+: header(0), start1(0), start2(0), coverage(0), entries1(0), entries2(0),
+  mapped(0), mappedSize(0) {}
+
+RemapTable::~RemapTable() {
+    release();
+}
+
+void RemapTable::release() {
+#ifndef _WIN32
+    if(mapped)
+        munmap(mapped, mappedSize);
+#endif
+    mapped = 0;
+    mappedSize = 0;
+    storage.clear();
+    header = 0;
+    start1 = start2 = 0;
+    coverage = 0;
+    entries1 = entries2 = 0;
+}
+
+// Entries e[0..n) sample a w x h source within its bounds
+static bool validEntries(const RemapEntry* e, uint32_t n, int w, int h) {
+    const uint32_t size = uint32_t(w)*uint32_t(h);
+    for(uint32_t k=0; k<n; k++) {
+        uint32_t index = e[k].offset & INDEX;
+        if(index >= size)
+            return false;
+        if((e[k].offset & RIGHT) && index%uint32_t(w)+1 >= uint32_t(w))
+            return false;
+        if((e[k].offset & BOTTOM) && index/uint32_t(w)+1 >= uint32_t(h))
+            return false;
+    }
+    return true;
+}
+
+// Point the parts of the table into data, after checking its consistency:
+// apply() then reads neither past the entries nor past the sources.
+bool RemapTable::attach(const char* data, size_t size) {
+    const RemapHeader* hd = reinterpret_cast<const RemapHeader*>(data);
+    if(size < sizeof(RemapHeader) || memcmp(hd->magic, MAGIC, 8) != 0 ||
+       hd->version != VERSION || hd->w < 0 || hd->h < 0 ||
+       hd->w1 < 0 || hd->h1 < 0 || hd->w2 < 0 || hd->h2 < 0 ||
+       double(hd->w)*hd->h > MAX_PIXELS ||
+       double(hd->w1)*hd->h1 > MAX_PIXELS || double(hd->w2)*hd->h2 > MAX_PIXELS)
+        return false;
+    Layout L(hd->w, hd->h, hd->n1, hd->n2);
+    if(L.size != size)
+        return false;
+    const uint32_t* s1 = reinterpret_cast<const uint32_t*>(data + L.start1);
+    const uint32_t* s2 = reinterpret_cast<const uint32_t*>(data + L.start2);
+    for(int i=0; i<hd->h; i++)
+        if(s1[i] > s1[i+1] || s2[i] > s2[i+1])
+            return false;
+    if(s1[0] != 0 || s2[0] != 0 || s1[hd->h] != hd->n1 || s2[hd->h] != hd->n2)
+        return false;
+    // Each row of the mask consumes exactly the entries of the row
+    const unsigned char* m = reinterpret_cast<const unsigned char*>(data + L.mask);
+    for(int i=0; i<hd->h; i++) {
+        uint32_t c1 = 0, c2 = 0;
+        for(int j=0; j<hd->w; j++) {
+            unsigned char b = m[size_t(i)*hd->w + j];
+            if(b > 3)
+                return false;
+            c1 += b & 1;
+            c2 += b >> 1;
+        }
+        if(c1 != s1[i+1]-s1[i] || c2 != s2[i+1]-s2[i])
+            return false;
+    }
+    const RemapEntry* e1 = reinterpret_cast<const RemapEntry*>(data + L.entries1);
+    const RemapEntry* e2 = reinterpret_cast<const RemapEntry*>(data + L.entries2);
+    if(! validEntries(e1, hd->n1, hd->w1, hd->h1) ||
+       ! validEntries(e2, hd->n2, hd->w2, hd->h2))
+        return false;
+    header = hd;
+    start1 = s1;
+    start2 = s2;
+    coverage = m;
+    entries1 = e1;
+    entries2 = e2;
+    return true;
+}
+
+// Entry sampling point (x,y) of a w x h source
+static RemapEntry entry(float x, float y, int w, int h) {
+    int ix = int(x), iy = int(y);
+    RemapEntry e;
+    e.offset = uint32_t(iy)*uint32_t(w) + uint32_t(ix);
+    if(ix+1 < w) e.offset |= RIGHT;
+    if(iy+1 < h) e.offset |= BOTTOM;
+    e.fx = uint16_t((x - float(ix))*float(1<<WEIGHT_BITS) + 0.5f);
+    e.fy = uint16_t((y - float(iy))*float(1<<WEIGHT_BITS) + 0.5f);
+    return e;
+}
+
+// Append the entries of row y of the canvas mapped by M to a w x h source,
+// setting bit of mask where covered. Same inside test as warpRow.
+static void compileRow(const WarpMap& M, int y, int w, int h,
+                       int width, unsigned char* mask, unsigned char bit,
+                       vector<RemapEntry>& entries) {
+    float yf = float(y);
+    float bx = M.m[1]*yf + M.m[2];
+    float by = M.m[4]*yf + M.m[5];
+    float bw = M.m[7]*yf + M.m[8];
+    for(int j=0; j<width; j++) {
+        float xf = float(j);
+        float X = bx + xf*M.m[0], Y = by + xf*M.m[3], W = bw + xf*M.m[6];
+        float x = X/W, y = Y/W;
+        if(W > 0 && x >= 0 && x < float(w) && y >= 0 && y < float(h)) {
+            entries.push_back(entry(x, y, w, h));
+            mask[j] |= bit;
+        }
+    }
+}
+
+bool RemapTable::build(int w1, int h1, int w2, int h2,
+                       const Matrix<float>& H, float x0, float y0,
+                       int w, int h) {
+    release();
+    if(w < 0 || h < 0 || double(w)*h > MAX_PIXELS ||
+       double(w1)*h1 > MAX_PIXELS || double(w2)*h2 > MAX_PIXELS)
+        return false;
+    WarpMap M1 = warpMap(inverse(H), x0, y0);
+    WarpMap M2 = warpMap(Matrix<float>::Identity(3), x0, y0);
+    vector<uint32_t> s1(1, 0), s2(1, 0);
+    vector<unsigned char> mask(size_t(w)*h, 0);
+    vector<RemapEntry> e1, e2;
+    for(int i=0; i<h; i++) {
+        unsigned char* m = mask.empty()? 0: &mask[size_t(i)*w];
+        compileRow(M1, i, w1, h1, w, m, 1, e1);
+        compileRow(M2, i, w2, h2, w, m, 2, e2);
+        if(e1.size() > INDEX || e2.size() > INDEX)
+            return false;
+        s1.push_back(uint32_t(e1.size()));
+        s2.push_back(uint32_t(e2.size()));
+    }
+
+    RemapHeader hd;
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, MAGIC, 8);
+    hd.version = VERSION;
+    hd.w = w; hd.h = h;
+    hd.w1 = w1; hd.h1 = h1; hd.w2 = w2; hd.h2 = h2;
+    for(int k=0; k<9; k++)
+        hd.H[k] = H(k/3, k%3);
+    hd.x0 = x0; hd.y0 = y0;
+    hd.n1 = uint32_t(e1.size());
+    hd.n2 = uint32_t(e2.size());
+    Layout L(w, h, hd.n1, hd.n2);
+    storage.assign((L.size+7)/8, 0);
+    char* data = reinterpret_cast<char*>(&storage[0]);
+    memcpy(data, &hd, sizeof(hd));
+    memcpy(data+L.start1, &s1[0], 4*s1.size());
+    memcpy(data+L.start2, &s2[0], 4*s2.size());
+    if(! mask.empty())
+        memcpy(data+L.mask, &mask[0], mask.size());
+    if(! e1.empty())
+        memcpy(data+L.entries1, &e1[0], sizeof(RemapEntry)*e1.size());
+    if(! e2.empty())
+        memcpy(data+L.entries2, &e2[0], sizeof(RemapEntry)*e2.size());
+    return attach(data, L.size);
+}
+
+bool RemapTable::save(const string& file) const {
+    if(! header)
+        return false;
+    ofstream f(file.c_str(), ios::binary);
+    size_t size = Layout(header->w, header->h, header->n1, header->n2).size;
+    f.write(reinterpret_cast<const char*>(header), size);
+    return bool(f);
+}
+
+bool RemapTable::load(const string& file) {
+    release();
+#ifndef _WIN32
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return false;
+    mapped = p;
+    mappedSize = size_t(st.st_size);
+    if(! attach(static_cast<const char*>(p), mappedSize)) {
+        release();
+        return false;
+    }
+    return true;
+#else
+    ifstream f(file.c_str(), ios::binary);
+    if(! f.seekg(0, ios::end))
+        return false;
+    size_t size = size_t(f.tellg());
+    storage.assign((size+7)/8, 0);
+    f.seekg(0);
+    if(size == 0 || ! f.read(reinterpret_cast<char*>(&storage[0]), size) ||
+       ! attach(reinterpret_cast<const char*>(&storage[0]), size)) {
+        release();
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool RemapTable::matches(int w1, int h1, int w2, int h2) const {
+    return header && header->w1==w1 && header->h1==h1 &&
+           header->w2==w2 && header->h2==h2;
+}
+
+int RemapTable::width() const {
+    return header? header->w: 0;
+}
+
+int RemapTable::height() const {
+    return header? header->h: 0;
+}
+
+Matrix<float> RemapTable::homography() const {
+    Matrix<float> H = Matrix<float>::Identity(3);
+    if(header)
+        for(int k=0; k<9; k++)
+            H(k/3, k%3) = header->H[k];
+    return H;
+}
+
+// Bilinear gather of one pixel of src, w pixels per row
+static inline void fetch(const byte* src, int w, const RemapEntry& e,
+                         int rgb[3]) {
+    const byte* p = src + 3*size_t(e.offset & INDEX);
+    const byte* q = (e.offset & BOTTOM)? p+3*w: p;
+    const int dx = (e.offset & RIGHT)? 3: 0;
+    const unsigned fx = e.fx, gx = (1u<<WEIGHT_BITS) - fx;
+    const unsigned fy = e.fy, gy = (1u<<WEIGHT_BITS) - fy;
+    const unsigned round = 1u << (2*WEIGHT_BITS-1);
+    for(int k=0; k<3; k++) {
+        unsigned top = p[k]*gx + p[dx+k]*fx;
+        unsigned bot = q[k]*gx + q[dx+k]*fx;
+        rgb[k] = int((top*gy + bot*fy + round) >> (2*WEIGHT_BITS));
+    }
+}
+
+void RemapTable::apply(const Image<Color,2>& I1, const Image<Color,2>& I2,
+                       Image<Color,2>& I, ThreadPool& pool) const {
+    const int w = width(), h = height();
+    if(I.width() != w || I.height() != h)
+        I = Image<Color>(w, h);
+    if(w == 0 || h == 0)
+        return;
+    // Colors are packed r,g,b bytes
+    const byte* src1 = reinterpret_cast<const byte*>(I1.data());
+    const byte* src2 = reinterpret_cast<const byte*>(I2.data());
+    const int w1 = I1.width(), w2 = I2.width();
+    const int rows = 16;
+    pool.run((h+rows-1)/rows, [&](int t, int) {
+        int a[3], b[3];
+        for(int i=t*rows; i<min(h, (t+1)*rows); i++) {
+            const unsigned char* m = coverage + size_t(i)*w;
+            const RemapEntry* e1 = entries1 + start1[i];
+            const RemapEntry* e2 = entries2 + start2[i];
+            Color* out = &I(0,i);
+            for(int j=0; j<w; j++) {
+                switch(m[j]) {
+                case 3: // Overlapping
+                    fetch(src1, w1, *e1++, a);
+                    fetch(src2, w2, *e2++, b);
+                    out[j] = Color((a[0]+b[0])/2, (a[1]+b[1])/2, (a[2]+b[2])/2);
+                    break;
+                case 1:
+                    fetch(src1, w1, *e1++, a);
+                    out[j] = Color(a[0], a[1], a[2]);
+                    break;
+                case 2:
+                    fetch(src2, w2, *e2++, b);
+                    out[j] = Color(b[0], b[1], b[2]);
+                    break;
+                default:
+                    out[j] = WHITE;
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,83 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Precomputed remap table of a fixed camera rig, to stitch streams of
+// frame pairs with a pure gather instead of a projective warp.
+
+#ifndef PANORAMA_REMAP_H
+#define PANORAMA_REMAP_H
+
+#include "ThreadPool.h"
+#include <Imagine/Images.h>
+#include <Imagine/LinAlg.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Bilinear fetch of one canvas pixel: top-left source pixel index
+// y*width+x, bit 30 set if the right neighbour is distinct, bit 31 if the
+// bottom one is (else the border is replicated), and weights of the right
+// and bottom neighbours in units of 1/2048.
+struct RemapEntry {
+    uint32_t offset;
+    uint16_t fx, fy;
+};
+
+struct RemapHeader;
+
+// Canvas pixel (j,i) is point (j+x0,i+y0) of the frame of I2, I1 maps to
+// it by H, as in panorama(). The table keeps for each row and source the
+// entries of the covered pixels only, in order, plus a coverage mask. It
+// is one contiguous block, laid out as on disk, so load() maps the file
+// as is. The file uses the byte order of the machine that wrote it.
+class RemapTable {
+public:
+    RemapTable();
+    ~RemapTable();
+
+    // Compile the table for sources of sizes w1 x h1 and w2 x h2 and a
+    // canvas of w x h. Returns false if the canvas is too large.
+    bool build(int w1, int h1, int w2, int h2,
+               const Imagine::Matrix<float>& H, float x0, float y0,
+               int w, int h);
+    bool save(const std::string& file) const;
+    // Map the table of file, read it in memory where mmap is unavailable
+    bool load(const std::string& file);
+
+    // Table built for sources of these sizes
+    bool matches(int w1, int h1, int w2, int h2) const;
+    bool empty() const { return header==0; }
+    int width() const;
+    int height() const;
+    // Homography the table was built with
+    Imagine::Matrix<float> homography() const;
+    // Per canvas pixel, bit 0 set if I1 covers it, bit 1 if I2 does
+    const unsigned char* mask() const { return coverage; }
+
+    // Stitch frames I1 and I2, of the sizes the table was built for, into
+    // I (resized to width() x height()). Overlapping pixels are averaged,
+    // uncovered ones are white. Rows are split among the workers of pool.
+    void apply(const Imagine::Image<Imagine::Color,2>& I1,
+               const Imagine::Image<Imagine::Color,2>& I2,
+               Imagine::Image<Imagine::Color,2>& I, ThreadPool& pool) const;
+
+private:
+    RemapTable(const RemapTable&);
+    void operator=(const RemapTable&);
+    bool attach(const char* data, size_t size);
+    void release();
+
+    const RemapHeader* header;
+    const uint32_t* start1;    // First entry of each row, h+1 values
+    const uint32_t* start2;
+    const unsigned char* coverage;
+    const RemapEntry* entries1;
+    const RemapEntry* entries2;
+    std::vector<uint64_t> storage; // Built or read table
+    void* mapped;                  // Or mapped file
+    size_t mappedSize;
+};
+
+#endif
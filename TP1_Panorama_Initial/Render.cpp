@@ -0,0 +1,294 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Render.h"
+#include "Gain.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+using namespace Imagine;
+using namespace std;
+
+// Scratch rows of one worker, allocated once per render
+struct RowBuffers {
+    vector<byte> rgb1, rgb2, in1, in2;
+    explicit RowBuffers(int w): rgb1(3*w), rgb2(3*w), in1(w), in2(w) {}
+};
+
+// Bounding box [x0,x1)x[y0,y1) of overlapping pixels
+struct OverlapBox {
+    int x0, y0, x1, y1;
+    OverlapBox(): x0(INT_MAX), y0(INT_MAX), x1(INT_MIN), y1(INT_MIN) {}
+    void add(int x, int y) {
+        x0 = min(x0, x); x1 = max(x1, x+1);
+        y0 = min(y0, y); y1 = max(y1, y+1);
+    }
+    void add(const OverlapBox& b) {
+        x0 = min(x0, b.x0); x1 = max(x1, b.x1);
+        y0 = min(y0, b.y0); y1 = max(y1, b.y1);
+    }
+};
+
+// Both warped sources over the overlap, filled by the render pass so that
+// the seam is applied without warping them again: per pixel of box
+// [x0,x1)x[y0,y1), the colors of I1 and I2 and whether it overlaps.
+struct OverlapRows {
+    int x0, y0, x1, y1;
+    vector<byte> rgb1, rgb2, both;
+    explicit OverlapRows(const OverlapBox& b)
+    : x0(b.x0), y0(b.y0), x1(max(b.x0, b.x1)), y1(max(b.y0, b.y1)),
+      rgb1(3*size_t(x1-x0)*(y1-y0)), rgb2(rgb1.size()),
+      both(size_t(x1-x0)*(y1-y0), 0) {}
+    void set(int x, int y, const byte* c1, const byte* c2) {
+        if(x<x0 || x>=x1 || y<y0 || y>=y1)
+            return;
+        const size_t q = size_t(y-y0)*(x1-x0) + (x-x0);
+        copy(c1, c1+3, &rgb1[3*q]);
+        copy(c2, c2+3, &rgb2[3*q]);
+        both[q] = 1;
+    }
+    // Overlapping pixels of canvas row y taken on their side of seam
+    void cut(Color* row, int y, const Seam& seam) const {
+        const size_t q0 = size_t(y-y0)*(x1-x0);
+        for(int x=x0; x<x1; x++) {
+            const size_t q = q0 + (x-x0);
+            if(! both[q])
+                continue;
+            const byte* c = seam.takesFirst(x, y)? &rgb1[3*q]: &rgb2[3*q];
+            row[x] = Color(c[0], c[1], c[2]);
+        }
+    }
+};
+
+// Columns of row y within [x0,x1) that a source mapped by M may cover,
+// [a,b), and that it surely covers, [sa,sb) inside: the exact span of
+// sourceSpan widened, respectively narrowed, by 2 pixels. Without an exact
+// span, the whole row may be covered and none surely is.
+struct Span {
+    int a, b, sa, sb;
+    bool has(int x) const { return x >= a && x < b; }
+    bool surely(int x) const { return x >= sa && x < sb; }
+};
+
+static Span rowSpan(const WarpSource& S, const WarpMap& M, int y,
+                    int x0, int x1) {
+    Span s = {x0, x1, x0, x0};
+    double lo, hi;
+    if(! sourceSpan(M, S.width(), S.height(), y, lo, hi))
+        return s;
+    lo = max(lo, x0-4.0);
+    hi = min(hi, x1+4.0);
+    if(lo >= hi) {
+        s.b = x0;
+        return s;
+    }
+    s.a = min(x1, max(x0, int(floor(lo))-1));
+    s.b = max(s.a, min(x1, int(ceil(hi))+2));
+    s.sa = max(s.a, int(ceil(lo))+2);
+    s.sb = min(s.b, int(floor(hi))-1);
+    if(s.sb <= s.sa)
+        s.sa = s.sb = s.a;
+    return s;
+}
+
+// Resample the part of row y that S mapped by M may cover into the row
+// buffers rgb and in, starting at column x0; in is 0 elsewhere. The sure
+// part of the span is dropped unless warpRow agrees on both of its ends.
+static void spanRow(const WarpSource& S, const WarpMap& M, int y,
+                    int x0, int x1, Span& s, byte* rgb, byte* in) {
+    fill(in, in+(s.a-x0), byte(0));
+    fill(in+(s.b-x0), in+(x1-x0), byte(0));
+    warpRow(S, M, y, s.a, s.b, rgb+3*(s.a-x0), in+(s.a-x0));
+    if(s.sa < s.sb && ! (in[s.sa-x0] && in[s.sb-1-x0]))
+        s.sa = s.sb = s.a;
+}
+
+// Copy pixels [u,v) of the row buffer rgb
+static void copyRun(Color* out, const vector<byte>& rgb, int x0, int u,
+                    int v) {
+    for(int j=u-x0; j<v-x0; j++)
+        out[j] = Color(rgb[3*j], rgb[3*j+1], rgb[3*j+2]);
+}
+
+// Compose overlapping pixels [u,v) of row y, at j=x-x0 in the row buffers
+static void overlapRun(Color* out, const RowBuffers& B, int x0, int u, int v,
+                       int y, const WarpSource& S1, const WarpMap& M1,
+                       const WarpSource& S2, const WarpMap& M2,
+                       BlendMode blend, OverlapRows* rows, BlendBand* band) {
+    if(band)
+        band->addOverlap(y, u, v, x0, &B.rgb1[0], &B.rgb2[0]);
+    if(blend == BLEND_MULTIBAND) { // Cut by the mask, no rows
+        for(int x=u; x<v; ) {
+            bool first;
+            const int e = band->maskRun(y, x, v, x0, first);
+            copyRun(out, first? B.rgb1: B.rgb2, x0, x, e);
+            x = e;
+        }
+        return;
+    }
+    for(int x=u; x<v; x++) {
+        const int j = x-x0;
+        const byte* c1 = &B.rgb1[3*j];
+        const byte* c2 = &B.rgb2[3*j];
+        if(rows)
+            rows->set(x, y, c1, c2);
+        if(blend == BLEND_AVERAGE)
+            out[j] = Color((c1[0]+c2[0])/2, (c1[1]+c2[1])/2,
+                           (c1[2]+c2[2])/2);
+        else {
+            float xf = float(x), yf = float(y);
+            float w1 = featherWeight(M1, S1.width(), S1.height(), xf, yf);
+            float w2 = featherWeight(M2, S2.width(), S2.height(), xf, yf);
+            float t = w1/(w1+w2);
+            out[j] = Color(byte(c2[0] + t*(c1[0]-c2[0]) + .5f),
+                           byte(c2[1] + t*(c1[1]-c2[1]) + .5f),
+                           byte(c2[2] + t*(c1[2]-c2[2]) + .5f));
+        }
+    }
+}
+
+// Compose pixels [x0,x1) of row y. Overlapping pixels widen box and are
+// blended; both of their sources go to rows if not null. The part of the
+// row in band, if not null, is filled from the row buffers. The spans of
+// the sources split the row into runs: uncovered runs are filled white,
+// runs surely covered by one or both sources are composed without testing
+// pixels, only the few pixels around the ends of the spans are, by runs.
+static void renderRow(Color* out, const WarpSource& S1, const WarpMap& M1,
+                      const WarpSource& S2, const WarpMap& M2,
+                      int y, int x0, int x1, BlendMode blend,
+                      RowBuffers& B, OverlapBox& box, OverlapRows* rows=0,
+                      BlendBand* band=0) {
+    Span p = rowSpan(S1, M1, y, x0, x1), q = rowSpan(S2, M2, y, x0, x1);
+    spanRow(S1, M1, y, x0, x1, p, &B.rgb1[0], &B.in1[0]);
+    spanRow(S2, M2, y, x0, x1, q, &B.rgb2[0], &B.in2[0]);
+    int cut[10] = {x0, x1, p.a, p.b, p.sa, p.sb, q.a, q.b, q.sa, q.sb};
+    sort(cut, cut+10);
+    for(int k=0; k<9; k++) {
+        const int u = cut[k], v = cut[k+1];
+        if(u >= v)
+            continue;
+        // Coverage is constant over the run
+        const bool in1 = p.has(u), in2 = q.has(u);
+        if(band && (p.surely(u) || ! in1) && (q.surely(u) || ! in2))
+            band->setCover(y, u, v, x0, in1, in2);
+        if(p.surely(u) && q.surely(u)) { // Overlapping
+            box.add(u, y);
+            box.add(v-1, y);
+            overlapRun(out, B, x0, u, v, y, S1, M1, S2, M2, blend, rows,
+                       band);
+        } else if(p.surely(u) && ! in2) // Left side
+            copyRun(out, B.rgb1, x0, u, v);
+        else if(q.surely(u) && ! in1) // Right side
+            copyRun(out, B.rgb2, x0, u, v);
+        else if(! in1 && ! in2)
+            fill(out+(u-x0), out+(v-x0), WHITE);
+        else // Ends of spans, by runs of the same pixel coverage
+            for(int x=u; x<v; ) {
+                const bool c1 = B.in1[x-x0] != 0, c2 = B.in2[x-x0] != 0;
+                int e = x+1;
+                while(e<v && (B.in1[e-x0]!=0) == c1 && (B.in2[e-x0]!=0) == c2)
+                    e++;
+                if(band)
+                    band->setCover(y, x, e, x0, c1, c2);
+                if(c1 && c2) {
+                    box.add(x, y);
+                    box.add(e-1, y);
+                    overlapRun(out, B, x0, x, e, y, S1, M1, S2, M2, blend,
+                               rows, band);
+                } else if(c1)
+                    copyRun(out, B.rgb1, x0, x, e);
+                else if(c2)
+                    copyRun(out, B.rgb2, x0, x, e);
+                else
+                    fill(out+(x-x0), out+(e-x0), WHITE);
+                x = e;
+            }
+    }
+}
+
+// Bounding box of the pixels of a w x h canvas that both sources may
+// cover, from their row spans, before any pixel is warped
+static OverlapBox spanOverlap(const WarpSource& S1, const WarpMap& M1,
+                              const WarpSource& S2, const WarpMap& M2,
+                              int w, int h) {
+    OverlapBox box;
+    for(int y=0; y<h; y++) {
+        Span p = rowSpan(S1, M1, y, 0, w), q = rowSpan(S2, M2, y, 0, w);
+        int a = max(p.a, q.a), b = min(p.b, q.b);
+        if(a < b) {
+            box.add(a, y);
+            box.add(b-1, y);
+        }
+    }
+    return box;
+}
+
+void renderPanorama(Image<Color,2>& I,
+                    const WarpSource& S1, const WarpMap& map1,
+                    const WarpSource& S2, const WarpMap& map2,
+                    const RenderOptions& opt) {
+    WarpMap M1 = map1, M2 = map2;
+    M1.filter = M2.filter = opt.filter;
+    if(opt.gain)
+        compensateGains(S1, M1, S2, M2, I.width(), I.height());
+    const int tw = max(1<<MULTIBAND_FINE, opt.tileWidth);
+    const int th = max(1, opt.tileHeight);
+    const int nx = (I.width()+tw-1)/tw, ny = (I.height()+th-1)/th;
+    ThreadPool pool(opt.threads);
+    vector<RowBuffers> buffers(pool.size(), RowBuffers(tw));
+    vector<OverlapBox> boxes(pool.size());
+    // Multi-band tiles cut the overlap by the mask of the band, which they
+    // fill on the way, and the blend then corrects the cut
+    BlendBand band;
+    OverlapBox predicted;
+    if(opt.blend == BLEND_MULTIBAND || opt.seam)
+        predicted = spanOverlap(S1, M1, S2, M2, I.width(), I.height());
+    if(opt.blend == BLEND_MULTIBAND)
+        band.reset(predicted.x0, predicted.y0, predicted.x1, predicted.y1,
+                   opt.bands, I.width(), I.height());
+    BlendBand* pband = band.empty()? 0: &band;
+    BlendMode blend = opt.blend==BLEND_FEATHER? BLEND_FEATHER: BLEND_AVERAGE;
+    if(pband && ! opt.seam) {
+        band.featherMask(S1, M1, S2, M2);
+        blend = BLEND_MULTIBAND;
+    }
+    // A seam cuts the overlap from the sources kept over it by the tiles
+    OverlapRows rows(opt.seam? predicted: OverlapBox());
+    OverlapRows* prows = rows.both.empty()? 0: &rows;
+    pool.run(nx*ny, [&](int t, int worker) {
+        int x0 = (t%nx)*tw, x1 = min(x0+tw, I.width());
+        int y0 = (t/nx)*th, y1 = min(y0+th, I.height());
+        for(int y=y0; y<y1; y++)
+            renderRow(&I(x0,y), S1, M1, S2, M2, y, x0, x1, blend,
+                      buffers[worker], boxes[worker], prows, pband);
+    });
+    OverlapBox box;
+    for(size_t k=0; k<boxes.size(); k++)
+        box.add(boxes[k]);
+    Seam seam;
+    if(opt.seam && box.x1 > box.x0) {
+        seam = findSeam(S1, M1, S2, M2, box.x0, box.y0, box.x1, box.y1, pool);
+        if(prows)
+            pool.run(rows.y1-rows.y0, [&](int i, int) {
+                rows.cut(&I(0,rows.y0+i), rows.y0+i, seam);
+            });
+    }
+    if(opt.blend == BLEND_MULTIBAND)
+        blendMultiband(I, band, opt.bands, pool, seam.empty()? 0: &seam);
+}
+
+void renderTile(Image<Color,2>& tile, int x0, int y0,
+                const WarpSource& S1, const WarpMap& M1,
+                const WarpSource& S2, const WarpMap& M2, BlendMode blend) {
+    RowBuffers B(tile.width());
+    OverlapBox box;
+    if(blend == BLEND_MULTIBAND)
+        blend = BLEND_FEATHER;
+    for(int y=0; y<tile.height(); y++)
+        renderRow(&tile(0,y), S1, M1, S2, M2, y0+y, x0, x0+tile.width(),
+                  blend, B, box);
+}
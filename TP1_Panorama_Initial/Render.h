@@ -0,0 +1,54 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Tiled, multi-threaded composition of the panorama canvas.
+
+#ifndef PANORAMA_RENDER_H
+#define PANORAMA_RENDER_H
+
+#include "Blend.h"
+#include "Warp.h"
+
+// Rendering parameters
+struct RenderOptions {
+    int threads;    // Worker threads, <=0 = all hardware threads
+    int tileWidth;  // Tile size in pixels, chosen so that a tile and its
+    int tileHeight; // row buffers stay in the per-core cache
+    BlendMode blend; // Combination of overlapping pixels
+    int bands;      // Pyramid levels of BLEND_MULTIBAND
+    bool gain;      // Compensate exposure differences in the overlap
+    WarpFilter filter; // Resampling of the sources
+    bool seam;      // Cut the overlap along the cheapest seam
+    RenderOptions(): threads(0), tileWidth(256), tileHeight(32),
+                     blend(BLEND_AVERAGE), bands(5), gain(false),
+                     filter(FILTER_BILINEAR), seam(false) {}
+};
+
+// Fill canvas I with source S1 mapped by M1 and source S2 mapped by M2.
+// Overlapping pixels are blended as opt.blend says, uncovered pixels are
+// white. Tiles are independent, so the result does not depend on the
+// number of threads. With multi-band blending, the tiles cut the overlap
+// by the mask of the blend and sum its band in cells as they warp the
+// sources, so that these are warped once, and a second pass over the
+// cells corrects the cut. With opt.seam, overlapping pixels are taken on
+// their side of the seam of findSeam, from both sources as the tiles kept
+// them over the overlap, and the seam is the mask of the multi-band blend.
+// The filters of M1 and M2 are replaced by opt.filter and, with opt.gain,
+// their gains by those equalizing the overlap.
+void renderPanorama(Imagine::Image<Imagine::Color,2>& I,
+                    const WarpSource& S1, const WarpMap& M1,
+                    const WarpSource& S2, const WarpMap& M2,
+                    const RenderOptions& opt=RenderOptions());
+
+// Same composition, in the calling thread, for the region of the canvas
+// starting at pixel (x0,y0) and covered by tile. A tile does not see the
+// whole overlap, so BLEND_MULTIBAND falls back to BLEND_FEATHER and there
+// is no seam.
+void renderTile(Imagine::Image<Imagine::Color,2>& tile, int x0, int y0,
+                const WarpSource& S1, const WarpMap& M1,
+                const WarpSource& S2, const WarpMap& M2,
+                BlendMode blend=BLEND_AVERAGE);
+
+#endif
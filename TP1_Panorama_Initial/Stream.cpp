@@ -0,0 +1,161 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Stream.h"
+#include "Queue.h"
+#include "Remap.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+using namespace Imagine;
+using namespace std;
+
+// A frame pair on its way through the pipeline
+struct Frame {
+    size_t k;
+    Image<Color> I1, I2, I;
+    Matrix<float> H;
+};
+typedef shared_ptr<Frame> FramePtr;
+
+// Largest distance between the images of the corners of a w x h image by
+// homographies A and B
+static float motion(const Matrix<float>& A, const Matrix<float>& B,
+                    int w, int h) {
+    float m = 0;
+    for(int k=0; k<4; k++) {
+        float x = float((k&1)? w: 0), y = float((k&2)? h: 0);
+        float pa[2], pb[2];
+        const Matrix<float>* M[2] = {&A, &B};
+        float* p[2] = {pa, pb};
+        for(int i=0; i<2; i++) {
+            const Matrix<float>& G = *M[i];
+            float z = G(2,0)*x + G(2,1)*y + G(2,2);
+            p[i][0] = (G(0,0)*x + G(0,1)*y + G(0,2))/z;
+            p[i][1] = (G(1,0)*x + G(1,1)*y + G(1,2))/z;
+        }
+        m = max(m, hypot(pa[0]-pb[0], pa[1]-pb[1]));
+    }
+    return m;
+}
+
+bool stitchStream(size_t n, const FrameReader& read, const FrameWriter& write,
+                  const Matrix<float>& H, float x0, float y0, int w, int h,
+                  const StreamOptions& opt, StreamStats* stats) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    BoundedQueue<FramePtr> decoded(opt.queue), tracked(opt.queue),
+        warped(opt.queue);
+    atomic<bool> ok(true);
+    atomic<size_t> lost(0), written(0);
+    double busy[4] = {0, 0, 0, 0}; // Read, track, warp, write, one writer each
+    auto since = [](Clock::time_point t) {
+        return chrono::duration<double>(Clock::now()-t).count();
+    };
+    // A failing stage closes every queue, so that the others stop
+    auto fail = [&]() {
+        ok = false;
+        decoded.close();
+        tracked.close();
+        warped.close();
+    };
+
+    thread decoder([&]() {
+        for(size_t k=0; k<n && ok; k++) {
+            FramePtr f = make_shared<Frame>();
+            f->k = k;
+            Clock::time_point t = Clock::now();
+            if(! read(k, f->I1, f->I2)) {
+                fail();
+                break;
+            }
+            busy[0] += since(t);
+            if(! decoded.push(f))
+                break;
+        }
+        decoded.close();
+    });
+
+    thread tracker([&]() {
+        Matrix<float> G = H.clone();
+        FramePtr f;
+        while(decoded.pop(f)) {
+            if(opt.track && f->k > 0) {
+                Clock::time_point t = Clock::now();
+                Matrix<float> F = G.clone();
+                if(trackHomography(f->I1, f->I2, F, opt.tracking))
+                    G = F;
+                else
+                    lost++;
+                busy[1] += since(t);
+            }
+            f->H = G.clone();
+            if(! tracked.push(f))
+                break;
+        }
+        tracked.close();
+    });
+
+    thread encoder([&]() {
+        FramePtr f;
+        while(warped.pop(f)) {
+            Clock::time_point t = Clock::now();
+            if(! write(f->k, f->I)) {
+                fail();
+                break;
+            }
+            busy[3] += since(t);
+            written++;
+        }
+    });
+
+    // Warp stage in the calling thread, which is worker 0 of the pool
+    ThreadPool pool(opt.threads);
+    RemapTable T;
+    Matrix<float> Ht;
+    size_t rebuilds = 0;
+    FramePtr f;
+    while(tracked.pop(f)) {
+        Clock::time_point t = Clock::now();
+        const int w1 = f->I1.width(), h1 = f->I1.height();
+        const int w2 = f->I2.width(), h2 = f->I2.height();
+        if(T.empty() || ! T.matches(w1, h1, w2, h2) ||
+           motion(Ht, f->H, w1, h1) > opt.threshold) {
+            if(! T.build(w1, h1, w2, h2, f->H, x0, y0, w, h)) {
+                fail();
+                break;
+            }
+            Ht = f->H.clone();
+            rebuilds++;
+        }
+        T.apply(f->I1, f->I2, f->I, pool);
+        f->I1 = Image<Color>(); // Sources are no longer needed
+        f->I2 = Image<Color>();
+        busy[2] += since(t);
+        if(! warped.push(f))
+            break;
+    }
+    warped.close();
+    decoder.join();
+    tracker.join();
+    encoder.join();
+
+    if(stats) {
+        stats->frames = written;
+        stats->rebuilds = rebuilds;
+        stats->lost = lost;
+        stats->seconds = since(start);
+        stats->reading = busy[0];
+        stats->tracking = busy[1];
+        stats->warping = busy[2];
+        stats->writing = busy[3];
+    }
+    return ok && written == n;
+}
@@ -0,0 +1,64 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Streaming stitch of the synchronized frames of a camera pair: decode,
+// tracking, warp and encode run as a pipeline of threads.
+
+#ifndef PANORAMA_STREAM_H
+#define PANORAMA_STREAM_H
+
+#include "Track.h"
+#include <Imagine/Images.h>
+#include <Imagine/LinAlg.h>
+#include <cstddef>
+#include <functional>
+
+// Video stitching parameters
+struct StreamOptions {
+    int threads;     // Workers of the warp stage, <=0 = all cores
+    int queue;       // Frames waiting between two stages
+    bool track;      // Follow H from frame to frame, else keep it fixed
+    float threshold; // Motion of I1 on the canvas, in pixels, below which
+                     // the remap table is reused
+    TrackOptions tracking;
+    StreamOptions(): threads(0), queue(4), track(true), threshold(0.5f) {}
+};
+
+// What happened to the frames of a stream
+struct StreamStats {
+    size_t frames;   // Frames written
+    size_t rebuilds; // Remap tables built, the first one included
+    size_t lost;     // Frames whose tracking failed and kept the last H
+    double seconds;  // Wall clock time of the whole stream
+    // Busy time of each stage, queue waits excluded, in seconds: the
+    // slowest one sets the frame rate
+    double reading, tracking, warping, writing;
+    StreamStats(): frames(0), rebuilds(0), lost(0), seconds(0), reading(0),
+                   tracking(0), warping(0), writing(0) {}
+};
+
+// Fill I1 and I2 with frame pair k, false on failure
+typedef std::function<bool(size_t k, Imagine::Image<Imagine::Color,2>& I1,
+                           Imagine::Image<Imagine::Color,2>& I2)> FrameReader;
+// Store stitched frame k, false on failure
+typedef std::function<bool(size_t k,
+                           const Imagine::Image<Imagine::Color,2>& I)>
+    FrameWriter;
+
+// Stitch frame pairs 0..n-1 onto the w x h canvas of panorama(): canvas
+// pixel (j,i) is point (j+x0,i+y0) of the frame of I2, I1 maps to it by
+// the homography, H for the first pair. Reading, tracking H with
+// trackHomography, warping with a RemapTable and writing each run in a
+// thread of their own, connected by queues of opt.queue frames: the
+// slowest stage sets the frame rate and memory stays bounded. The table
+// is rebuilt only when the corners of I1 move by more than opt.threshold
+// since it was built. Stops at the first failure of read or write and
+// returns false.
+bool stitchStream(size_t n, const FrameReader& read, const FrameWriter& write,
+                  const Imagine::Matrix<float>& H, float x0, float y0,
+                  int w, int h, const StreamOptions& opt=StreamOptions(),
+                  StreamStats* stats=0);
+
+#endif
@@ -0,0 +1,120 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int nThreads)
+: job(0), generation(0), pending(0), active(0), quit(false) {
+    if(nThreads <= 0)
+        nThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    for(int i=0; i<nThreads; i++)
+        queues.push_back(new Queue);
+    for(int i=1; i<nThreads; i++)
+        threads.push_back(std::thread(&ThreadPool::loop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        quit = true;
+    }
+    wake.notify_all();
+    for(size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    for(size_t i=0; i<queues.size(); i++)
+        delete queues[i];
+}
+
+// Pop from the back of our own queue, else steal from the front of another
+bool ThreadPool::next(int worker, int& task) {
+    int n = size();
+    for(int k=0; k<n; k++) {
+        Queue& q = *queues[(worker+k)%n];
+        std::lock_guard<std::mutex> lock(q.m);
+        if(q.tasks.empty())
+            continue;
+        if(k == 0) {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        } else {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(int worker, const Task& f) {
+    int task, count=0;
+    while(next(worker, task)) {
+        f(task, worker);
+        ++count;
+    }
+    if(count > 0) {
+        std::lock_guard<std::mutex> lock(m);
+        pending -= count;
+        if(pending == 0)
+            done.notify_all();
+    }
+}
+
+void ThreadPool::loop(int worker) {
+    int seen = 0;
+    while(true) {
+        const Task* f;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            while(!quit && generation == seen)
+                wake.wait(lock);
+            if(quit)
+                return;
+            // A worker waking after the run of this generation is over
+            // must not touch its body, which is gone with run()
+            seen = generation;
+            if(job == 0)
+                continue;
+            f = job;
+            ++active;
+        }
+        work(worker, *f);
+        std::lock_guard<std::mutex> lock(m);
+        if(--active == 0)
+            done.notify_all();
+    }
+}
+
+void ThreadPool::run(int n, const Task& f) {
+    if(n <= 0)
+        return;
+    if(size() == 1) {
+        for(int t=0; t<n; t++)
+            f(t, 0);
+        return;
+    }
+    {
+        // A worker still holding the previous job must leave before new
+        // tasks are queued, or it would run them with a stale body.
+        std::unique_lock<std::mutex> lock(m);
+        while(active > 0)
+            done.wait(lock);
+        int nq = size();
+        for(int i=0; i<nq; i++) {
+            std::lock_guard<std::mutex> qlock(queues[i]->m);
+            for(int t=n*i/nq; t<n*(i+1)/nq; t++)
+                queues[i]->tasks.push_back(t);
+        }
+        job = &f;
+        pending = n;
+        ++generation;
+    }
+    wake.notify_all();
+    work(0, f);
+    std::unique_lock<std::mutex> lock(m);
+    while(pending > 0 || active > 0)
+        done.wait(lock);
+    job = 0;
+}
@@ -0,0 +1,53 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Small work-stealing thread pool for data-parallel loops.
+
+#ifndef PANORAMA_THREADPOOL_H
+#define PANORAMA_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // Task body: task index and index of the worker running it, in
+    // [0,size()). The calling thread of run() is worker 0.
+    typedef std::function<void(int task, int worker)> Task;
+
+    // nThreads<=0 uses all hardware threads.
+    explicit ThreadPool(int nThreads=0);
+    ~ThreadPool();
+    int size() const { return int(queues.size()); }
+
+    // Run f on tasks [0,n) and return when all are done. Tasks are dealt
+    // in contiguous blocks; idle workers steal from the others.
+    void run(int n, const Task& f);
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<int> tasks;
+    };
+    bool next(int worker, int& task);
+    void work(int worker, const Task& f);
+    void loop(int worker);
+
+    std::vector<Queue*> queues;
+    std::vector<std::thread> threads;
+    std::mutex m;
+    std::condition_variable wake, done;
+    const Task* job; // Body of the current run, 0 between runs
+    int generation;
+    int pending;  // Tasks of the current run not finished yet
+    int active;   // Workers (other than the caller) inside a run
+    bool quit;
+};
+
+#endif
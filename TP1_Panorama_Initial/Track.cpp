@@ -0,0 +1,187 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Track.h"
+#include "Dense.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Imagine;
+using namespace std;
+
+// Huber threshold of the residuals, in gray levels
+static const double HUBER = 10;
+// Gradient magnitude of I2 below which a pixel is not a sample
+static const float MIN_GRADIENT = 3;
+
+// Gray levels averaged over blocks of s x s pixels
+struct Gray {
+    int w, h;
+    vector<float> v;
+    float operator()(int x, int y) const { return v[size_t(y)*w+x]; }
+};
+
+static Gray reduce(const Image<Color,2>& I, int s) {
+    Gray G;
+    G.w = I.width()/s;
+    G.h = I.height()/s;
+    G.v.assign(size_t(G.w)*G.h, 0);
+    const float norm = 1.0f/(3*s*s);
+    for(int y=0; y<G.h*s; y++) {
+        float* out = &G.v[size_t(y/s)*G.w];
+        for(int x=0; x<G.w*s; x++) {
+            Color c = I(x,y);
+            out[x/s] += float(c.r() + c.g() + c.b());
+        }
+    }
+    for(size_t k=0; k<G.v.size(); k++)
+        G.v[k] *= norm;
+    return G;
+}
+
+// Central differences, 0 on the border
+static void gradient(const Gray& G, Gray& gx, Gray& gy) {
+    gx = gy = G;
+    for(int y=0; y<G.h; y++)
+        for(int x=0; x<G.w; x++) {
+            bool in = x>0 && y>0 && x<G.w-1 && y<G.h-1;
+            gx.v[size_t(y)*G.w+x] = in? (G(x+1,y)-G(x-1,y))/2: 0;
+            gy.v[size_t(y)*G.w+x] = in? (G(x,y+1)-G(x,y-1))/2: 0;
+        }
+}
+
+// Bilinear interpolation, (x,y) in [0,w-1)x[0,h-1)
+static inline double bilinear(const Gray& G, int ix, int iy,
+                              double fx, double fy) {
+    const float* p = &G.v[size_t(iy)*G.w+ix];
+    double top = p[0] + fx*(p[1]-p[0]);
+    double bot = p[G.w] + fx*(p[G.w+1]-p[G.w]);
+    return top + fy*(bot-top);
+}
+
+// Sample of I2: normalized coordinates and gray level
+struct Sample {
+    double u, v, t;
+};
+
+bool trackHomography(const Image<Color,2>& I1, const Image<Color,2>& I2,
+                     Matrix<float>& H, const TrackOptions& opt) {
+    const int s = max(1, opt.scale);
+    Gray G1 = reduce(I1, s), G2 = reduce(I2, s);
+    if(G1.w < 3 || G1.h < 3 || G2.w < 3 || G2.h < 3)
+        return false;
+    Gray gx, gy, hx, hy;
+    gradient(G1, gx, gy);
+    gradient(G2, hx, hy);
+
+    // Normalized coordinates of reduced pixels: centered, unit half size
+    const double d = max(max(G1.w, G1.h), max(G2.w, G2.h))/2.0;
+    const double c1x = (G1.w-1)/2.0, c1y = (G1.h-1)/2.0;
+    const double c2x = (G2.w-1)/2.0, c2y = (G2.h-1)/2.0;
+    vector<Sample> samples;
+    for(int y=1; y<G2.h-1; y++)
+        for(int x=1; x<G2.w-1; x++)
+            if(fabs(hx(x,y)) + fabs(hy(x,y)) >= MIN_GRADIENT) {
+                Sample p = {(x-c2x)/d, (y-c2y)/d, G2(x,y)};
+                samples.push_back(p);
+            }
+
+    // G maps normalized I2 to normalized I1: N1*L*inverse(H)*L^-1*N2^-1,
+    // L from full to reduced pixels and Nk from reduced to normalized
+    double Hf[9], Gf[9];
+    for(int k=0; k<9; k++)
+        Hf[k] = H(k/3, k%3);
+    if(! inverse3(Hf, Gf))
+        return false;
+    const double o = (s-1)/2.0;
+    const double L[9] = {1.0/s, 0, -o/s, 0, 1.0/s, -o/s, 0, 0, 1};
+    const double Li[9] = {double(s), 0, o, 0, double(s), o, 0, 0, 1};
+    const double N1[9] = {1/d, 0, -c1x/d, 0, 1/d, -c1y/d, 0, 0, 1};
+    const double N1i[9] = {d, 0, c1x, 0, d, c1y, 0, 0, 1};
+    const double N2[9] = {1/d, 0, -c2x/d, 0, 1/d, -c2y/d, 0, 0, 1};
+    const double N2i[9] = {d, 0, c2x, 0, d, c2y, 0, 0, 1};
+    double T[9], U[9], g[9];
+    mul3(N1, L, T);
+    mul3(T, Gf, U);
+    mul3(U, Li, T);
+    mul3(T, N2i, g);
+    if(g[8] == 0)
+        return false;
+    for(int k=0; k<9; k++)
+        g[k] /= g[8];
+
+    double gain = 1, bias = 0, rms = 0;
+    int n = 0;
+    for(int it=0; it<=opt.iterations; it++) {
+        double A[100] = {0}, b[10] = {0}, sse = 0;
+        n = 0;
+        for(size_t k=0; k<samples.size(); k++) {
+            const Sample& p = samples[k];
+            double W = g[6]*p.u + g[7]*p.v + 1;
+            if(! (W > 0))
+                continue;
+            double qx = (g[0]*p.u + g[1]*p.v + g[2])/W;
+            double qy = (g[3]*p.u + g[4]*p.v + g[5])/W;
+            double x = d*qx + c1x, y = d*qy + c1y;
+            if(! (x >= 0 && y >= 0 && x < G1.w-1 && y < G1.h-1))
+                continue;
+            int ix = int(x), iy = int(y);
+            double fx = x-ix, fy = y-iy;
+            double I = bilinear(G1, ix, iy, fx, fy);
+            double r = gain*I + bias - p.t;
+            double w = fabs(r) <= HUBER? 1: HUBER/fabs(r);
+            sse += r*r;
+            n++;
+            // Derivatives of r: dr/dq, then dq/dg by the quotient rule
+            double jx = gain*d*bilinear(gx, ix, iy, fx, fy)/W;
+            double jy = gain*d*bilinear(gy, ix, iy, fx, fy)/W;
+            double jw = -(jx*qx + jy*qy);
+            const double J[10] = {jx*p.u, jx*p.v, jx, jy*p.u, jy*p.v, jy,
+                                  jw*p.u, jw*p.v, I, 1};
+            for(int i=0; i<10; i++) {
+                double wj = w*J[i];
+                b[i] -= wj*r;
+                for(int j=0; j<=i; j++)
+                    A[10*i+j] += wj*J[j];
+            }
+        }
+        if(n < opt.minSamples)
+            return false;
+        rms = sqrt(sse/n);
+        if(it == opt.iterations)
+            break;
+        for(int i=0; i<10; i++) {
+            for(int j=0; j<i; j++)
+                A[10*j+i] = A[10*i+j];
+            A[11*i] *= 1 + 1e-6; // Directions the overlap does not see
+        }
+        if(! choleskySolve(A, b, 10))
+            return false;
+        for(int k=0; k<8; k++)
+            g[k] += b[k];
+        gain += b[8];
+        bias += b[9];
+        // Converged when the corners move by less than 1/100 pixel
+        double step = 0;
+        for(int k=0; k<8; k++)
+            step = max(step, fabs(b[k]));
+        if(step*d < 0.01)
+            break;
+    }
+    if(! (rms <= opt.maxRms))
+        return false;
+
+    // Back to full resolution pixels: H = inverse(L^-1*N1^-1*G*N2*L)
+    mul3(Li, N1i, T);
+    mul3(T, g, U);
+    mul3(U, N2, T);
+    mul3(T, L, Gf);
+    if(! inverse3(Gf, Hf) || Hf[8] == 0)
+        return false;
+    for(int k=0; k<9; k++)
+        H(k/3, k%3) = float(Hf[k]/Hf[8]);
+    return true;
+}
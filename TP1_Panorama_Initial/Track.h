@@ -0,0 +1,35 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Frame to frame tracking of the homography of a camera pair, by direct
+// alignment of the overlap instead of feature matching.
+
+#ifndef PANORAMA_TRACK_H
+#define PANORAMA_TRACK_H
+
+#include <Imagine/Images.h>
+#include <Imagine/LinAlg.h>
+
+// Tracking parameters
+struct TrackOptions {
+    int scale;        // Frames are aligned at 1/scale of their resolution
+    int iterations;   // Largest number of Gauss-Newton iterations
+    int minSamples;   // Overlap samples below which tracking is lost
+    float maxRms;     // Gray level residual above which tracking is lost
+    TrackOptions(): scale(4), iterations(10), minSamples(200), maxRms(40) {}
+};
+
+// Refine homography H from I1 to I2, valid for the previous frames, to
+// frames I1 and I2. The gray levels of the overlap, reduced by opt.scale,
+// are aligned by Gauss-Newton on the 8 parameters of H and a gain and bias
+// between the cameras, with Huber weights. Textureless pixels of I2 are
+// skipped, so an iteration costs a few thousand samples. Returns false,
+// H unchanged, if the overlap gets too small or the residual too large.
+bool trackHomography(const Imagine::Image<Imagine::Color,2>& I1,
+                     const Imagine::Image<Imagine::Color,2>& I2,
+                     Imagine::Matrix<float>& H,
+                     const TrackOptions& opt=TrackOptions());
+
+#endif
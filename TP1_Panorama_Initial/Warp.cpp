@@ -0,0 +1,713 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+
+#include "Warp.h"
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define WARP_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace Imagine;
+
+WarpSource::WarpSource(const Image<Color,2>& I)
+: w(I.width()), h(I.height()), s(I.width()+4), pix(size_t(w+4)*(h+4)) {
+    for(int y=-2; y<=h+1; y++) {
+        int sy = y<0? 0: (y<h? y: h-1);
+        unsigned int* row = &pix[size_t(y+2)*s + 2];
+        for(int x=-2; x<=w+1; x++) {
+            int sx = x<0? 0: (x<w? x: w-1);
+            Color c = I(sx,sy);
+            row[x] = c.r() | (c.g()<<8) | (c.b()<<16);
+        }
+    }
+}
+
+CanvasRays::CanvasRays(Projection p, const float param[4], int width,
+                       int height)
+: proj(p), w(width), h(height), sinCol(w), cosCol(w), aRow(h), bRow(h) {
+    std::copy(param, param+4, t);
+    for(int x=0; x<w; x++)
+        longitude(float(x), sinCol[x], cosCol[x]);
+    for(int y=0; y<h; y++)
+        rowFactors(float(y), aRow[y], bRow[y]);
+}
+
+const float* CanvasRays::columns(int xBegin, int xEnd, float* tmp,
+                                 bool cosine) const {
+    if(xBegin>=0 && xEnd<=w)
+        return (cosine? &cosCol[0]: &sinCol[0]) + xBegin;
+    for(int x=xBegin; x<xEnd; x++) {
+        float sinT, cosT;
+        column(x, sinT, cosT);
+        tmp[x-xBegin] = cosine? cosT: sinT;
+    }
+    return tmp;
+}
+
+WarpMap warpMap(const Matrix<float>& H, float x0, float y0) {
+    WarpMap M;
+    for(int r=0; r<3; r++) {
+        M.m[3*r+0] = H(r,0);
+        M.m[3*r+1] = H(r,1);
+        M.m[3*r+2] = float(double(H(r,0))*x0 + double(H(r,1))*y0 + H(r,2));
+        M.gain[r] = 1;
+    }
+    M.filter = FILTER_BILINEAR;
+    return M;
+}
+
+WarpMap warpMap(const Matrix<float>& H,
+                const std::shared_ptr<const CanvasRays>& rays) {
+    WarpMap M = warpMap(H, 0, 0);
+    M.rays = rays;
+    return M;
+}
+
+WarpMap scaledMap(const WarpMap& M, float s, float o, float r, float q,
+                  int w, int h) {
+    WarpMap N = M;
+    // Source side: rows x and y of m times r, plus q times row w
+    for(int c=0; c<3; c++) {
+        N.m[0+c] = r*M.m[0+c] + q*M.m[6+c];
+        N.m[3+c] = r*M.m[3+c] + q*M.m[6+c];
+    }
+    if(M.rays) { // Canvas side: affine change of the angles
+        const float* t = M.rays->param();
+        float u[4] = {t[0]+t[1]*o, t[1]*s, t[2]+t[3]*o, t[3]*s};
+        N.rays = std::make_shared<CanvasRays>(M.rays->projection(), u, w, h);
+    } else // Columns x and y of m times s, plus o times their sum
+        for(int k=0; k<3; k++) {
+            float a = N.m[3*k+0], b = N.m[3*k+1];
+            N.m[3*k+0] = s*a;
+            N.m[3*k+1] = s*b;
+            N.m[3*k+2] += o*(a+b);
+        }
+    return N;
+}
+
+// Filter and gains of a map, the gains also in 8.8 fixed point
+struct Sampling {
+    WarpFilter filter;
+    const float* gain;
+    int fixedGain[3];
+    explicit Sampling(const WarpMap& M): filter(M.filter), gain(M.gain) {
+        for(int c=0; c<3; c++)
+            fixedGain[c] = int(std::min(std::max(M.gain[c], 0.0f), 127.0f)*256
+                               + 0.5f);
+    }
+};
+
+// Float bilinear fetch of one pixel. This is the reference: vector
+// versions perform exactly the same float operations in the same order.
+static inline void floatPixel(const WarpSource& S, const float* gain,
+                              float x, float y,
+                              unsigned char* rgb, unsigned char* in) {
+    int ix = int(x), iy = int(y);
+    float fx = x - float(ix), fy = y - float(iy);
+    const unsigned int* p = S.origin() + iy*S.stride() + ix;
+    unsigned int p00=p[0], p01=p[1], p10=p[S.stride()], p11=p[S.stride()+1];
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        float a = float((p00>>sh)&255), b = float((p01>>sh)&255);
+        float d = float((p10>>sh)&255), e = float((p11>>sh)&255);
+        float top = a + fx*(b-a);
+        float bot = d + fx*(e-d);
+        float v = top + fy*(bot-top);
+        v = std::min(v*gain[c], 255.0f);
+        rgb[c] = (unsigned char)int(v + 0.5f);
+    }
+    *in = 1;
+}
+
+// Value v in 8.7 fixed point times gain g in 8.8, rounded and saturated
+static inline unsigned char fixedGain(int v, int g) {
+    return (unsigned char)std::min((v*g + (1<<14)) >> 15, 255);
+}
+
+// Fixed-point bilinear fetch of one pixel, the reference of the vector
+// versions. Horizontal sums are exact (15 bits), the vertical one is
+// rounded to 8.7 bits.
+static inline void bilinearPixel(const WarpSource& S, const int* gain,
+                                 float x, float y,
+                                 unsigned char* rgb, unsigned char* in) {
+    int xi = int(x*128.0f), yi = int(y*128.0f);
+    int fx = xi&127, fy = yi&127;
+    const unsigned int* p = S.origin() + (yi>>7)*S.stride() + (xi>>7);
+    unsigned int p00=p[0], p01=p[1], p10=p[S.stride()], p11=p[S.stride()+1];
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        int top = int((p00>>sh)&255)*(128-fx) + int((p01>>sh)&255)*fx;
+        int bot = int((p10>>sh)&255)*(128-fx) + int((p11>>sh)&255)*fx;
+        int v = (top*(128-fy) + bot*fy + 64) >> 7;
+        rgb[c] = fixedGain(v, gain[c]);
+    }
+    *in = 1;
+}
+
+// Catmull-Rom weights of the 4 taps at offsets -1..2, 7 bits, for each
+// fraction f/128. Rounding errors go to the largest tap so rows sum to 128.
+static const short (*cubicWeights())[4] {
+    static short table[128][4];
+    static bool init = [] {
+        for(int f=0; f<128; f++) {
+            double t = f/128.0, t2 = t*t, t3 = t2*t;
+            double w[4] = {(-t3 + 2*t2 - t)/2, (3*t3 - 5*t2 + 2)/2,
+                           (-3*t3 + 4*t2 + t)/2, (t3 - t2)/2};
+            int sum = 0;
+            for(int k=0; k<4; k++) {
+                table[f][k] = short(std::floor(w[k]*128 + 0.5));
+                sum += table[f][k];
+            }
+            table[f][f<64? 1: 2] += short(128-sum);
+        }
+        return true;
+    }();
+    (void)init;
+    return table;
+}
+
+// Fixed-point bicubic fetch of one pixel. The result is clamped to 0..255
+// before the gain, since the negative lobes may over- or undershoot.
+static inline void bicubicPixel(const WarpSource& S, const int* gain,
+                                float x, float y,
+                                unsigned char* rgb, unsigned char* in) {
+    static const short (*table)[4] = cubicWeights();
+    int xi = int(x*128.0f), yi = int(y*128.0f);
+    const short* wx = table[xi&127];
+    const short* wy = table[yi&127];
+    const int s = S.stride();
+    const unsigned int* p = S.origin() + ((yi>>7)-1)*s + (xi>>7)-1;
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        int v = 0;
+        for(int r=0; r<4; r++) {
+            const unsigned int* q = p + r*s;
+            int h = 0;
+            for(int k=0; k<4; k++)
+                h += int((q[k]>>sh)&255)*wx[k];
+            v += h*wy[r];
+        }
+        v = std::min((std::max(v, 0) + 64) >> 7, 255*128);
+        rgb[c] = fixedGain(v, gain[c]);
+    }
+    *in = 1;
+}
+
+// Fetch of the pixel of homogeneous source point (X,Y,W) with the filter
+// of P; in is 0 when the point falls outside S.
+static inline void warpPixel(const WarpSource& S, const Sampling& P,
+                             float X, float Y, float W,
+                             unsigned char* rgb, unsigned char* in) {
+    float x = X/W, y = Y/W;
+    if(! (W > 0 && x >= 0 && x < float(S.width()) &&
+                   y >= 0 && y < float(S.height()))) {
+        *in = 0;
+        return;
+    }
+    switch(P.filter) {
+    case FILTER_BILINEAR:
+        bilinearPixel(S, P.fixedGain, x, y, rgb, in);
+        break;
+    case FILTER_BICUBIC:
+        bicubicPixel(S, P.fixedGain, x, y, rgb, in);
+        break;
+    default:
+        floatPixel(S, P.gain, x, y, rgb, in);
+    }
+}
+
+static void warpRowScalar(const WarpSource& S, const WarpMap& M,
+                          float bx, float by, float bw, int xBegin, int xEnd,
+                          unsigned char* rgb, unsigned char* in) {
+    const Sampling P(M);
+    for(int j=xBegin; j<xEnd; j++, rgb+=3, in++) {
+        float xf = float(j);
+        warpPixel(S, P, bx + xf*M.m[0], by + xf*M.m[3], bw + xf*M.m[6],
+                  rgb, in);
+    }
+}
+
+// Coefficients of the source point along a row of a projected canvas:
+// X = q[0] + p[0]*sin(theta) + r[0]*cos(theta), same for Y (1) and W (2).
+struct RowRays {
+    float q[3], p[3], r[3];
+};
+
+static void warpRowRaysScalar(const WarpSource& S, const WarpMap& M,
+                              const RowRays& R, const float* sinT,
+                              const float* cosT, int n,
+                              unsigned char* rgb, unsigned char* in) {
+    const Sampling P(M);
+    for(int j=0; j<n; j++, rgb+=3, in++) {
+        float s = sinT[j], c = cosT[j];
+        warpPixel(S, P, R.q[0] + R.p[0]*s + R.r[0]*c,
+                  R.q[1] + R.p[1]*s + R.r[1]*c, R.q[2] + R.p[2]*s + R.r[2]*c,
+                  rgb, in);
+    }
+}
+
+#ifdef WARP_X86
+
+// Store packed (r,g,b,0) words and the inside mask of n lanes.
+static inline void storeLanes(const unsigned int* packed, int bits, int n,
+                              unsigned char* rgb, unsigned char* in) {
+    for(int k=0; k<n; k++, rgb+=3) {
+        memcpy(rgb, packed+k, 3);
+        in[k] = (unsigned char)((bits>>k)&1);
+    }
+}
+
+__attribute__((target("sse2")))
+static inline __m128 channelSse2(__m128i p, __m128i sh) {
+    return _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(p,sh),
+                                         _mm_set1_epi32(255)));
+}
+
+// Channel sh of p in the low 16 bits and of q in the high 16 bits of each
+// lane, the operand of _mm_madd_epi16 for weights (wp,wq)
+__attribute__((target("sse2")))
+static inline __m128i pairSse2(__m128i p, __m128i q, __m128i sh) {
+    const __m128i mask = _mm_set1_epi32(255);
+    return _mm_or_si128(_mm_and_si128(_mm_srl_epi32(p,sh),mask),
+                        _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(q,sh),mask),
+                                       16));
+}
+
+// The 2x2 neighbourhoods of pixels (ix,iy) of 4 lanes
+__attribute__((target("sse2")))
+static inline void gatherSse2(const WarpSource& S, __m128i ix, __m128i iy,
+                              __m128i p[4]) {
+    const unsigned int* base = S.origin();
+    const int s = S.stride();
+    int ixs[4], iys[4];
+    _mm_storeu_si128((__m128i*)ixs, ix);
+    _mm_storeu_si128((__m128i*)iys, iy);
+    unsigned int q[4][4];
+    for(int k=0; k<4; k++) {
+        const unsigned int* b = base + iys[k]*s + ixs[k];
+        q[0][k]=b[0]; q[1][k]=b[1]; q[2][k]=b[s]; q[3][k]=b[s+1];
+    }
+    for(int k=0; k<4; k++)
+        p[k] = _mm_loadu_si128((const __m128i*)q[k]);
+}
+
+// Same float operations as floatPixel, 4 lanes of source points (x,y)
+__attribute__((target("sse2")))
+static inline __m128i floatSse2(const WarpSource& S, const float* gain,
+                                __m128 x, __m128 y) {
+    const __m128 half=_mm_set1_ps(0.5f), vmax=_mm_set1_ps(255.0f);
+    __m128i ix = _mm_cvttps_epi32(x), iy = _mm_cvttps_epi32(y);
+    __m128 fx = _mm_sub_ps(x,_mm_cvtepi32_ps(ix));
+    __m128 fy = _mm_sub_ps(y,_mm_cvtepi32_ps(iy));
+    __m128i p[4];
+    gatherSse2(S, ix, iy, p);
+    __m128i packed = _mm_setzero_si128();
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        __m128i vsh = _mm_cvtsi32_si128(sh);
+        __m128 a=channelSse2(p[0],vsh), b=channelSse2(p[1],vsh);
+        __m128 d=channelSse2(p[2],vsh), e=channelSse2(p[3],vsh);
+        __m128 top = _mm_add_ps(a,_mm_mul_ps(fx,_mm_sub_ps(b,a)));
+        __m128 bot = _mm_add_ps(d,_mm_mul_ps(fx,_mm_sub_ps(e,d)));
+        __m128 v = _mm_add_ps(top,_mm_mul_ps(fy,_mm_sub_ps(bot,top)));
+        v = _mm_min_ps(_mm_mul_ps(v,_mm_set1_ps(gain[c])),vmax);
+        __m128i q = _mm_cvttps_epi32(_mm_add_ps(v,half));
+        packed = _mm_or_si128(packed,_mm_sll_epi32(q,vsh));
+    }
+    return packed;
+}
+
+// Same integer operations as bilinearPixel, 4 lanes of source points
+// (x,y). Each product pair is one _mm_madd_epi16: both taps of a row, both
+// rows, then the value and its gain.
+__attribute__((target("sse2")))
+static inline __m128i bilinearSse2(const WarpSource& S, const int* gain,
+                                   __m128 x, __m128 y) {
+    const __m128 scale = _mm_set1_ps(128.0f);
+    const __m128i frac = _mm_set1_epi32(127), one = _mm_set1_epi32(128);
+    const __m128i vmax = _mm_set1_epi32(255);
+    __m128i xi = _mm_cvttps_epi32(_mm_mul_ps(x,scale));
+    __m128i yi = _mm_cvttps_epi32(_mm_mul_ps(y,scale));
+    __m128i fx = _mm_and_si128(xi,frac), fy = _mm_and_si128(yi,frac);
+    __m128i wx = _mm_or_si128(_mm_sub_epi32(one,fx), _mm_slli_epi32(fx,16));
+    __m128i wy = _mm_or_si128(_mm_sub_epi32(one,fy), _mm_slli_epi32(fy,16));
+    __m128i p[4];
+    gatherSse2(S, _mm_srai_epi32(xi,7), _mm_srai_epi32(yi,7), p);
+    __m128i packed = _mm_setzero_si128();
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        __m128i vsh = _mm_cvtsi32_si128(sh);
+        __m128i top = _mm_madd_epi16(pairSse2(p[0],p[1],vsh), wx);
+        __m128i bot = _mm_madd_epi16(pairSse2(p[2],p[3],vsh), wx);
+        __m128i v = _mm_madd_epi16(_mm_or_si128(top,_mm_slli_epi32(bot,16)),
+                                   wy);
+        v = _mm_srai_epi32(_mm_add_epi32(v,_mm_set1_epi32(64)), 7);
+        v = _mm_madd_epi16(v, _mm_set1_epi32(gain[c]));
+        v = _mm_srai_epi32(_mm_add_epi32(v,_mm_set1_epi32(1<<14)), 15);
+        v = _mm_min_epi16(v, vmax); // High halves are 0
+        packed = _mm_or_si128(packed,_mm_sll_epi32(v,vsh));
+    }
+    return packed;
+}
+
+// Fetch of 4 pixels of homogeneous source points (X,Y,W), bilinear
+__attribute__((target("sse2")))
+static inline void resampleSse2(const WarpSource& S, const Sampling& P,
+                                __m128 X, __m128 Y, __m128 W,
+                                unsigned char* rgb, unsigned char* in) {
+    const __m128 zero=_mm_setzero_ps();
+    const __m128 width=_mm_set1_ps(float(S.width()));
+    const __m128 height=_mm_set1_ps(float(S.height()));
+    __m128 x = _mm_div_ps(X,W), y = _mm_div_ps(Y,W);
+    __m128 ok = _mm_and_ps(_mm_cmpgt_ps(W,zero),
+                _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x,zero),
+                                      _mm_cmplt_ps(x,width)),
+                           _mm_and_ps(_mm_cmpge_ps(y,zero),
+                                      _mm_cmplt_ps(y,height))));
+    int bits = _mm_movemask_ps(ok);
+    if(bits == 0) {
+        memset(in, 0, 4);
+        return;
+    }
+    // Outside lanes are zeroed so that they fetch pixel (0,0).
+    x = _mm_and_ps(x,ok);
+    y = _mm_and_ps(y,ok);
+    __m128i packed = P.filter==FILTER_BILINEAR?
+        bilinearSse2(S, P.fixedGain, x, y): floatSse2(S, P.gain, x, y);
+    unsigned int out[4];
+    _mm_storeu_si128((__m128i*)out, packed);
+    storeLanes(out, bits, 4, rgb, in);
+}
+
+__attribute__((target("sse2")))
+static void warpRowSse2(const WarpSource& S, const WarpMap& M,
+                        float bx, float by, float bw, int xBegin, int xEnd,
+                        unsigned char* rgb, unsigned char* in) {
+    const __m128 m0=_mm_set1_ps(M.m[0]), m3=_mm_set1_ps(M.m[3]),
+                 m6=_mm_set1_ps(M.m[6]);
+    const __m128 vbx=_mm_set1_ps(bx), vby=_mm_set1_ps(by), vbw=_mm_set1_ps(bw);
+    const __m128i lane=_mm_setr_epi32(0,1,2,3);
+    const Sampling P(M);
+    int j=xBegin;
+    for(; j+4<=xEnd; j+=4, rgb+=12, in+=4) {
+        __m128 xf = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(j),lane));
+        __m128 X = _mm_add_ps(vbx,_mm_mul_ps(xf,m0));
+        __m128 Y = _mm_add_ps(vby,_mm_mul_ps(xf,m3));
+        __m128 W = _mm_add_ps(vbw,_mm_mul_ps(xf,m6));
+        resampleSse2(S, P, X, Y, W, rgb, in);
+    }
+    warpRowScalar(S, M, bx, by, bw, j, xEnd, rgb, in);
+}
+
+__attribute__((target("sse2")))
+static void warpRowRaysSse2(const WarpSource& S, const WarpMap& M,
+                            const RowRays& R, const float* sinT,
+                            const float* cosT, int n,
+                            unsigned char* rgb, unsigned char* in) {
+    __m128 q[3], p[3], r[3];
+    for(int k=0; k<3; k++) {
+        q[k] = _mm_set1_ps(R.q[k]);
+        p[k] = _mm_set1_ps(R.p[k]);
+        r[k] = _mm_set1_ps(R.r[k]);
+    }
+    const Sampling P(M);
+    int j=0;
+    for(; j+4<=n; j+=4, rgb+=12, in+=4) {
+        __m128 sn = _mm_loadu_ps(sinT+j), cs = _mm_loadu_ps(cosT+j);
+        __m128 H[3];
+        for(int k=0; k<3; k++)
+            H[k] = _mm_add_ps(_mm_add_ps(q[k],_mm_mul_ps(p[k],sn)),
+                              _mm_mul_ps(r[k],cs));
+        resampleSse2(S, P, H[0], H[1], H[2], rgb, in);
+    }
+    warpRowRaysScalar(S, M, R, sinT+j, cosT+j, n-j, rgb, in);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 channelAvx2(__m256i p, __m128i sh) {
+    return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p,sh),
+                                               _mm256_set1_epi32(255)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pairAvx2(__m256i p, __m256i q, __m128i sh) {
+    const __m256i mask = _mm256_set1_epi32(255);
+    return _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi32(p,sh),mask),
+                           _mm256_slli_epi32(
+                               _mm256_and_si256(_mm256_srl_epi32(q,sh),mask),
+                               16));
+}
+
+__attribute__((target("avx2")))
+static inline void gatherAvx2(const WarpSource& S, __m256i ix, __m256i iy,
+                              __m256i p[4]) {
+    const int* base = (const int*)S.origin();
+    const int s = S.stride();
+    __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(iy,
+                                                      _mm256_set1_epi32(s)),
+                                   ix);
+    p[0] = _mm256_i32gather_epi32(base,     idx, 4);
+    p[1] = _mm256_i32gather_epi32(base+1,   idx, 4);
+    p[2] = _mm256_i32gather_epi32(base+s,   idx, 4);
+    p[3] = _mm256_i32gather_epi32(base+s+1, idx, 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i floatAvx2(const WarpSource& S, const float* gain,
+                                __m256 x, __m256 y) {
+    const __m256 half=_mm256_set1_ps(0.5f), vmax=_mm256_set1_ps(255.0f);
+    __m256i ix = _mm256_cvttps_epi32(x), iy = _mm256_cvttps_epi32(y);
+    __m256 fx = _mm256_sub_ps(x,_mm256_cvtepi32_ps(ix));
+    __m256 fy = _mm256_sub_ps(y,_mm256_cvtepi32_ps(iy));
+    __m256i p[4];
+    gatherAvx2(S, ix, iy, p);
+    __m256i packed = _mm256_setzero_si256();
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        __m128i vsh = _mm_cvtsi32_si128(sh);
+        __m256 a=channelAvx2(p[0],vsh), b=channelAvx2(p[1],vsh);
+        __m256 d=channelAvx2(p[2],vsh), e=channelAvx2(p[3],vsh);
+        __m256 top = _mm256_add_ps(a,_mm256_mul_ps(fx,_mm256_sub_ps(b,a)));
+        __m256 bot = _mm256_add_ps(d,_mm256_mul_ps(fx,_mm256_sub_ps(e,d)));
+        __m256 v = _mm256_add_ps(top,_mm256_mul_ps(fy,_mm256_sub_ps(bot,top)));
+        v = _mm256_min_ps(_mm256_mul_ps(v,_mm256_set1_ps(gain[c])),vmax);
+        __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(v,half));
+        packed = _mm256_or_si256(packed,_mm256_sll_epi32(q,vsh));
+    }
+    return packed;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i bilinearAvx2(const WarpSource& S, const int* gain,
+                                   __m256 x, __m256 y) {
+    const __m256 scale = _mm256_set1_ps(128.0f);
+    const __m256i frac = _mm256_set1_epi32(127), one = _mm256_set1_epi32(128);
+    const __m256i vmax = _mm256_set1_epi32(255);
+    __m256i xi = _mm256_cvttps_epi32(_mm256_mul_ps(x,scale));
+    __m256i yi = _mm256_cvttps_epi32(_mm256_mul_ps(y,scale));
+    __m256i fx = _mm256_and_si256(xi,frac), fy = _mm256_and_si256(yi,frac);
+    __m256i wx = _mm256_or_si256(_mm256_sub_epi32(one,fx),
+                                 _mm256_slli_epi32(fx,16));
+    __m256i wy = _mm256_or_si256(_mm256_sub_epi32(one,fy),
+                                 _mm256_slli_epi32(fy,16));
+    __m256i p[4];
+    gatherAvx2(S, _mm256_srai_epi32(xi,7), _mm256_srai_epi32(yi,7), p);
+    __m256i packed = _mm256_setzero_si256();
+    for(int c=0, sh=0; c<3; c++, sh+=8) {
+        __m128i vsh = _mm_cvtsi32_si128(sh);
+        __m256i top = _mm256_madd_epi16(pairAvx2(p[0],p[1],vsh), wx);
+        __m256i bot = _mm256_madd_epi16(pairAvx2(p[2],p[3],vsh), wx);
+        __m256i v = _mm256_madd_epi16(
+            _mm256_or_si256(top,_mm256_slli_epi32(bot,16)), wy);
+        v = _mm256_srai_epi32(_mm256_add_epi32(v,_mm256_set1_epi32(64)), 7);
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(gain[c]));
+        v = _mm256_srai_epi32(_mm256_add_epi32(v,_mm256_set1_epi32(1<<14)),
+                              15);
+        v = _mm256_min_epi32(v, vmax);
+        packed = _mm256_or_si256(packed,_mm256_sll_epi32(v,vsh));
+    }
+    return packed;
+}
+
+// Fetch of 8 pixels of homogeneous source points (X,Y,W), bilinear
+__attribute__((target("avx2")))
+static inline void resampleAvx2(const WarpSource& S, const Sampling& P,
+                                __m256 X, __m256 Y, __m256 W,
+                                unsigned char* rgb, unsigned char* in) {
+    const __m256 zero=_mm256_setzero_ps();
+    const __m256 width=_mm256_set1_ps(float(S.width()));
+    const __m256 height=_mm256_set1_ps(float(S.height()));
+    __m256 x = _mm256_div_ps(X,W), y = _mm256_div_ps(Y,W);
+    __m256 ok = _mm256_and_ps(_mm256_cmp_ps(W,zero,_CMP_GT_OQ),
+                _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(x,zero,_CMP_GE_OQ),
+                                  _mm256_cmp_ps(x,width,_CMP_LT_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(y,zero,_CMP_GE_OQ),
+                                  _mm256_cmp_ps(y,height,_CMP_LT_OQ))));
+    int bits = _mm256_movemask_ps(ok);
+    if(bits == 0) {
+        memset(in, 0, 8);
+        return;
+    }
+    // Outside lanes are zeroed so that they fetch pixel (0,0).
+    x = _mm256_and_ps(x,ok);
+    y = _mm256_and_ps(y,ok);
+    __m256i packed = P.filter==FILTER_BILINEAR?
+        bilinearAvx2(S, P.fixedGain, x, y): floatAvx2(S, P.gain, x, y);
+    unsigned int out[8];
+    _mm256_storeu_si256((__m256i*)out, packed);
+    storeLanes(out, bits, 8, rgb, in);
+}
+
+__attribute__((target("avx2")))
+static void warpRowAvx2(const WarpSource& S, const WarpMap& M,
+                        float bx, float by, float bw, int xBegin, int xEnd,
+                        unsigned char* rgb, unsigned char* in) {
+    const __m256 m0=_mm256_set1_ps(M.m[0]), m3=_mm256_set1_ps(M.m[3]),
+                 m6=_mm256_set1_ps(M.m[6]);
+    const __m256 vbx=_mm256_set1_ps(bx), vby=_mm256_set1_ps(by),
+                 vbw=_mm256_set1_ps(bw);
+    const __m256i lane=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const Sampling P(M);
+    int j=xBegin;
+    for(; j+8<=xEnd; j+=8, rgb+=24, in+=8) {
+        __m256 xf = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(j),
+                                                        lane));
+        __m256 X = _mm256_add_ps(vbx,_mm256_mul_ps(xf,m0));
+        __m256 Y = _mm256_add_ps(vby,_mm256_mul_ps(xf,m3));
+        __m256 W = _mm256_add_ps(vbw,_mm256_mul_ps(xf,m6));
+        resampleAvx2(S, P, X, Y, W, rgb, in);
+    }
+    warpRowScalar(S, M, bx, by, bw, j, xEnd, rgb, in);
+}
+
+__attribute__((target("avx2")))
+static void warpRowRaysAvx2(const WarpSource& S, const WarpMap& M,
+                            const RowRays& R, const float* sinT,
+                            const float* cosT, int n,
+                            unsigned char* rgb, unsigned char* in) {
+    __m256 q[3], p[3], r[3];
+    for(int k=0; k<3; k++) {
+        q[k] = _mm256_set1_ps(R.q[k]);
+        p[k] = _mm256_set1_ps(R.p[k]);
+        r[k] = _mm256_set1_ps(R.r[k]);
+    }
+    const Sampling P(M);
+    int j=0;
+    for(; j+8<=n; j+=8, rgb+=24, in+=8) {
+        __m256 sn = _mm256_loadu_ps(sinT+j), cs = _mm256_loadu_ps(cosT+j);
+        __m256 H[3];
+        for(int k=0; k<3; k++)
+            H[k] = _mm256_add_ps(_mm256_add_ps(q[k],_mm256_mul_ps(p[k],sn)),
+                                 _mm256_mul_ps(r[k],cs));
+        resampleAvx2(S, P, H[0], H[1], H[2], rgb, in);
+    }
+    warpRowRaysScalar(S, M, R, sinT+j, cosT+j, n-j, rgb, in);
+}
+
+#endif
+
+WarpIsa warpIsaDetected() {
+#ifdef WARP_X86
+    if(__builtin_cpu_supports("avx2"))
+        return WARP_AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return WARP_SSE2;
+#endif
+    return WARP_SCALAR;
+}
+
+static WarpIsa currentIsa = warpIsaDetected();
+
+void setWarpIsa(WarpIsa isa) {
+    WarpIsa best = warpIsaDetected();
+    currentIsa = isa<best? isa: best;
+}
+
+WarpIsa warpIsa() {
+    return currentIsa;
+}
+
+static void warpRowRaysIsa(const WarpSource& S, const WarpMap& M,
+                           const RowRays& R, const float* sinT,
+                           const float* cosT, int n,
+                           unsigned char* rgb, unsigned char* in) {
+    switch(M.filter==FILTER_BICUBIC? WARP_SCALAR: currentIsa) {
+#ifdef WARP_X86
+    case WARP_AVX2:
+        warpRowRaysAvx2(S, M, R, sinT, cosT, n, rgb, in);
+        break;
+    case WARP_SSE2:
+        warpRowRaysSse2(S, M, R, sinT, cosT, n, rgb, in);
+        break;
+#endif
+    default:
+        warpRowRaysScalar(S, M, R, sinT, cosT, n, rgb, in);
+    }
+}
+
+// Columns out of the tables of the canvas are computed by chunks of this
+// size, a multiple of the vector widths, in buffers on the stack
+static const int RAY_CHUNK = 256;
+
+// Row y of a projected canvas: the ray factors of the row are folded into
+// the coefficients, the longitudes come from the column tables.
+static void warpRowRays(const WarpSource& S, const WarpMap& M, int y,
+                        int xBegin, int xEnd,
+                        unsigned char* rgb, unsigned char* in) {
+    if(xEnd <= xBegin)
+        return;
+    float a, b;
+    M.rays->row(y, a, b);
+    RowRays R;
+    for(int k=0; k<3; k++) {
+        R.q[k] = M.m[3*k+1]*b;
+        R.p[k] = M.m[3*k+0]*a;
+        R.r[k] = M.m[3*k+2]*a;
+    }
+    const bool inside = xBegin>=0 && xEnd<=M.rays->width();
+    float tmpSin[RAY_CHUNK], tmpCos[RAY_CHUNK];
+    for(int x=xBegin; x<xEnd; ) {
+        const int e = inside? xEnd: std::min(xEnd, x+RAY_CHUNK);
+        const float* sinT = M.rays->columns(x, e, tmpSin, false);
+        const float* cosT = M.rays->columns(x, e, tmpCos, true);
+        warpRowRaysIsa(S, M, R, sinT, cosT, e-x,
+                       rgb+3*(x-xBegin), in+(x-xBegin));
+        x = e;
+    }
+}
+
+// Keep x of (lo,hi) with c+d*x>0
+static inline void halfLine(double c, double d, double& lo, double& hi) {
+    if(d > 0)
+        lo = std::max(lo, -c/d);
+    else if(d < 0)
+        hi = std::min(hi, -c/d);
+    else if(c < 0)
+        hi = lo;
+}
+
+bool sourceSpan(const WarpMap& M, int w, int h, int y, double& lo, double& hi) {
+    if(M.rays)
+        return false;
+    // Same row coefficients as warpRow
+    float yf = float(y);
+    double bx = M.m[1]*yf + M.m[2], by = M.m[4]*yf + M.m[5];
+    double bw = M.m[7]*yf + M.m[8];
+    double ax = M.m[0], ay = M.m[3], aw = M.m[6];
+    lo = -HUGE_VAL;
+    hi = HUGE_VAL;
+    halfLine(bw, aw, lo, hi);
+    halfLine(bx, ax, lo, hi);
+    halfLine(w*bw - bx, w*aw - ax, lo, hi);
+    halfLine(by, ay, lo, hi);
+    halfLine(h*bw - by, h*aw - ay, lo, hi);
+    return true;
+}
+
+void warpRow(const WarpSource& S, const WarpMap& M, int y,
+             int xBegin, int xEnd,
+             unsigned char* rgb, unsigned char* in) {
+    if(M.rays) {
+        warpRowRays(S, M, y, xBegin, xEnd, rgb, in);
+        return;
+    }
+    // Homogeneous coordinates of pixel (0,y); they advance by the first
+    // column of M at each step along the row.
+    float yf = float(y);
+    float bx = M.m[1]*yf + M.m[2];
+    float by = M.m[4]*yf + M.m[5];
+    float bw = M.m[7]*yf + M.m[8];
+    switch(M.filter==FILTER_BICUBIC? WARP_SCALAR: currentIsa) {
+#ifdef WARP_X86
+    case WARP_AVX2:
+        warpRowAvx2(S, M, bx, by, bw, xBegin, xEnd, rgb, in);
+        break;
+    case WARP_SSE2:
+        warpRowSse2(S, M, bx, by, bw, xBegin, xEnd, rgb, in);
+        break;
+#endif
+    default:
+        warpRowScalar(S, M, bx, by, bw, xBegin, xEnd, rgb, in);
+    }
+}
@@ -0,0 +1,162 @@
+// Imagine++ project
+// Project:  Panorama
+// Author:   Camillo ARGUELLO
+// Date:     2020/10
+//
+// Homography warp kernel: resamples a source image along rows of the
+// output canvas without per-pixel allocation. The canvas is planar, or
+// cylindrical or spherical around the camera of the reference image.
+
+#ifndef PANORAMA_WARP_H
+#define PANORAMA_WARP_H
+
+#include <Imagine/Images.h>
+#include <Imagine/LinAlg.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Source image repacked as one 32-bit word per pixel (r,g,b,0) with a two
+// pixel replicated border, so the bilinear and bicubic fetches never need
+// clamping.
+class WarpSource {
+public:
+    explicit WarpSource(const Imagine::Image<Imagine::Color,2>& I);
+    int width() const { return w; }
+    int height() const { return h; }
+    int stride() const { return s; }
+    // Pixel (0,0). Valid indices go from -2 to width()/height()+1 included.
+    const unsigned int* origin() const { return &pix[2*s+2]; }
+private:
+    int w, h, s;
+    std::vector<unsigned int> pix;
+};
+
+// Surface the canvas is drawn on
+enum Projection { PROJ_PLANE, PROJ_CYLINDER, PROJ_SPHERE };
+
+// Viewing rays of the pixels of a cylindrical or spherical canvas. Pixel
+// (x,y) has longitude theta=t[0]+t[1]*x and, on the cylinder, height
+// t[2]+t[3]*y, on the sphere, latitude phi=t[2]+t[3]*y. Its ray is
+// (a*sin(theta), b, a*cos(theta)), with a=1 and b the height on the
+// cylinder, a=cos(phi) and b=sin(phi) on the sphere: sin and cos of theta
+// are tabulated per column and a, b per row of the w x h canvas.
+class CanvasRays {
+public:
+    CanvasRays(Projection proj, const float t[4], int w, int h);
+    Projection projection() const { return proj; }
+    const float* param() const { return t; }
+    int width() const { return w; }
+    int height() const { return h; }
+    // Longitude of column x, tabulated if 0<=x<width()
+    void column(int x, float& sinT, float& cosT) const {
+        if(x>=0 && x<w) {
+            sinT = sinCol[x];
+            cosT = cosCol[x];
+        } else
+            longitude(x, sinT, cosT);
+    }
+    // Factors of row y, tabulated if 0<=y<height()
+    void row(int y, float& a, float& b) const {
+        if(y>=0 && y<h) {
+            a = aRow[y];
+            b = bRow[y];
+        } else
+            rowFactors(y, a, b);
+    }
+    // Columns [xBegin,xEnd): the table itself when inside, else tmp (of
+    // xEnd-xBegin floats) filled
+    const float* columns(int xBegin, int xEnd, float* tmp, bool cosine) const;
+private:
+    void longitude(float x, float& sinT, float& cosT) const {
+        double theta = double(t[0]) + double(t[1])*x;
+        sinT = float(std::sin(theta));
+        cosT = float(std::cos(theta));
+    }
+    void rowFactors(float y, float& a, float& b) const {
+        double v = double(t[2]) + double(t[3])*y;
+        a = proj==PROJ_SPHERE? float(std::cos(v)): 1.0f;
+        b = float(proj==PROJ_SPHERE? std::sin(v): v);
+    }
+    Projection proj;
+    float t[4];
+    int w, h;
+    std::vector<float> sinCol, cosCol, aRow, bRow;
+};
+
+// Resampling of the source. The fixed-point filters work on integers only:
+// source point coordinates are cut to 1/128 pixel, weights have 7 bits,
+// the interpolated value is rounded to 8.7 bits and the gain to 8.8 bits.
+enum WarpFilter {
+    FILTER_BILINEAR_FLOAT, // Bilinear in float
+    FILTER_BILINEAR,       // Bilinear in fixed point
+    FILTER_BICUBIC         // Catmull-Rom in fixed point, not vectorized
+};
+
+// Map from canvas pixel (x,y) to source point, row-major 3x3, gain
+// applied to each channel of the resampled color (saturated) and filter.
+// On a planar canvas (rays null) the source point is m*(x,y,1), else
+// m*ray(x,y).
+struct WarpMap {
+    float m[9];
+    float gain[3];
+    WarpFilter filter;
+    std::shared_ptr<const CanvasRays> rays;
+};
+
+// Map canvas pixel (x,y) to source point H*(x+x0,y+y0,1), unit gains,
+// fixed-point bilinear filter.
+WarpMap warpMap(const Imagine::Matrix<float>& H, float x0, float y0);
+
+// Map canvas pixel (x,y) to source point H*ray(x,y), same defaults.
+WarpMap warpMap(const Imagine::Matrix<float>& H,
+                const std::shared_ptr<const CanvasRays>& rays);
+
+// Map N(x,y) = r*M(s*x+o,s*y+o) + q, on a canvas w x h: the canvas of M
+// scaled down by s and the source scaled by r. Rays are tabulated again.
+WarpMap scaledMap(const WarpMap& M, float s, float o, float r, float q,
+                  int w, int h);
+
+// Homogeneous source point (X,Y,W) of canvas point (x,y) by M
+inline void warpPoint(const WarpMap& M, float x, float y,
+                      float& X, float& Y, float& W) {
+    if(! M.rays) {
+        W = M.m[6]*x + M.m[7]*y + M.m[8];
+        X = M.m[0]*x + M.m[1]*y + M.m[2];
+        Y = M.m[3]*x + M.m[4]*y + M.m[5];
+        return;
+    }
+    float s, c, a, b;
+    M.rays->column(int(std::floor(x)), s, c);
+    M.rays->row(int(std::floor(y)), a, b);
+    float rx = a*s, rz = a*c;
+    W = M.m[6]*rx + M.m[7]*b + M.m[8]*rz;
+    X = M.m[0]*rx + M.m[1]*b + M.m[2]*rz;
+    Y = M.m[3]*rx + M.m[4]*b + M.m[5]*rz;
+}
+
+// Open interval (lo,hi) of the canvas columns x of row y whose source
+// point by M falls inside a w x h source, in exact arithmetic: on a planar
+// canvas W>0, 0<=X<w*W and 0<=Y<h*W are linear in x. warpRow may disagree
+// within rounding of the ends. False on projected canvases, where the
+// interval is not computed; it is empty if lo>=hi.
+bool sourceSpan(const WarpMap& M, int w, int h, int y, double& lo, double& hi);
+
+// Instruction set used by warpRow.
+enum WarpIsa { WARP_SCALAR, WARP_SSE2, WARP_AVX2 };
+
+// Best instruction set supported by the CPU.
+WarpIsa warpIsaDetected();
+// Force an instruction set (capped to the detected one), e.g. for checks.
+void setWarpIsa(WarpIsa isa);
+WarpIsa warpIsa();
+
+// Resample pixels [xBegin,xEnd) of canvas row y from S. Pixel j goes to
+// rgb[3*(j-xBegin)] and in[j-xBegin] is 1 when it falls inside S, else 0
+// (rgb is then unspecified). All instruction sets give the same bytes, and
+// unit gains give the same bytes as no gain at all.
+void warpRow(const WarpSource& S, const WarpMap& M, int y,
+             int xBegin, int xEnd,
+             unsigned char* rgb, unsigned char* in);
+
+#endif
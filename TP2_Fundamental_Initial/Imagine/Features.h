@@ -10,6 +10,7 @@
 #include <string>
 #include <fstream>
 #include <list>
+#include <memory>
 
 #include <Imagine/Images.h>
 
@@ -12,6 +12,9 @@ namespace Imagine {
 
 	/// SIFT descriptor
 	typedef FeaturePoint<FVector<byte,128> > SIFT;
+
+	// VLFeat filters kept by a detector between runs
+	class SIFTFilterPool;
 	
 	/// SIFT detector. VLFeat implementation.
 	/// SIFT detector. VLFeat implementation.
@@ -26,6 +29,17 @@ namespace Imagine {
 		float edgeThresh;
 		// Min contrast.
         float peakThresh;
+		// Number of threads, 0 = all cores.
+		int numThreads;
+		// Tile size in pixels, 0 = whole image.
+		int tileSize;
+		// Smoothing from which the recursive Gaussian is used, <0 = default.
+		float iirSigma;
+		// Memory of the filters kept between runs, in bytes.
+		size_t poolMemory;
+		// Filters kept between runs, shared by the copies of the detector.
+		std::shared_ptr<SIFTFilterPool> pool;
+		static std::shared_ptr<SIFTFilterPool> newPool();
 	public:
 		/// Constructor.
 		/// Constructor.
@@ -37,6 +51,8 @@ namespace Imagine {
 			numOctaves=-1;
 			numScales=3;
 			edgeThresh=10.0f; peakThresh=0.04f;
+			numThreads=0; tileSize=0; iirSigma=-1;
+			poolMemory=size_t(256)<<20; pool=newPool();
 		}
 		/// Number of octaves.
 		/// Sets number of octaves.  -1 = max. default=-1
@@ -68,6 +84,31 @@ namespace Imagine {
 		/// \dontinclude Features/test/test.cpp \skip main()
 		/// \skipline sift, min contrast
 		void setPeakThresh(float t) { peakThresh=t; }
+		/// Number of threads.
+		/// Sets number of threads. The keypoints of an octave are described
+		/// concurrently, features are the same as with 1 thread.
+		/// 0 = all cores. default=0
+		void setNumThreads(int n) { numThreads=n; }
+		/// Tile size.
+		/// Sets tile size. The finest octaves, up to octave 0, of larger
+		/// images are computed on overlapping tiles in parallel, the
+		/// coarser ones on the image reduced by 2. Features differ from
+		/// the whole image ones by rounding. 0 = no tiles. default=0
+		void setTileSize(int n) { tileSize=n; }
+		/// Recursive smoothing.
+		/// Sets the blur from which the scale space is smoothed by a
+		/// recursive Gaussian, whose cost does not depend on the blur,
+		/// rather than by convolution. 0 = never. default=10, above the
+		/// blurs of the usual octaves.
+		void setIirSigma(float s) { iirSigma=s; }
+		/// Filter memory.
+		/// Sets the memory, in bytes, that the scale space buffers of a
+		/// run may keep to be reused by the next runs on images of the
+		/// same size, as frames of a video: they are then not allocated
+		/// again. The least recently used are freed first, 0 = none kept.
+		/// default=256MB, the filters of a 640x480 image, or of the
+		/// tiles of a few threads.
+		void setPoolMemory(size_t bytes) { poolMemory=bytes; }
 
 		// Implementation
 		Array<SIFT> run(const Image<byte>& I) const;
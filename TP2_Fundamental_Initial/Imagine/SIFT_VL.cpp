@@ -1,5 +1,11 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "Features.h"
 
@@ -7,49 +13,297 @@ using namespace std;
 
 extern "C" {
 #include "vl/sift.h"
+#include "vl/imop.h"
 }
 
 namespace Imagine {
 
-	Array<SIFT> SIFTDetector::run(const Image<byte>& I) const {
-		
-		int w=I.width(),h=I.height();
-		Image<float,2> If(I);
+	// Nominal smoothing of the images, as set by vl_sift_new
+	static const double SIGMAN=0.5;
+
+	// Geometry and settings of a filter, which is reused by the same only
+	struct FilterKey {
+		int w, h, O, S, o_min;
+		bool coarse;
+		float edge, peak, iir;
+		bool operator==(const FilterKey& k) const {
+			return w==k.w && h==k.h && O==k.O && S==k.S && o_min==k.o_min &&
+				coarse==k.coarse && edge==k.edge && peak==k.peak && iir==k.iir;
+		}
+	};
+
+	class SIFTFilterPool {
+	public:
+		SIFTFilterPool(): bytes(0) {}
+		~SIFTFilterPool() {
+			for (auto i=kept.begin();i!=kept.end();++i)
+				vl_sift_delete(i->second);
+		}
+		// A kept filter of key k, 0 if none
+		VlSiftFilt* take(const FilterKey& k) {
+			lock_guard<mutex> lock(m);
+			for (auto i=kept.begin();i!=kept.end();++i)
+				if (i->first==k) {
+					VlSiftFilt* f=i->second;
+					bytes-=size(f);
+					kept.erase(i);
+					return f;
+				}
+			return 0;
+		}
+		// Keep f, freeing the least recently kept filters beyond cap bytes
+		void give(const FilterKey& k, VlSiftFilt* f, size_t cap) {
+			lock_guard<mutex> lock(m);
+			kept.push_front(make_pair(k,f));
+			bytes+=size(f);
+			while (bytes>cap) {
+				bytes-=size(kept.back().second);
+				vl_sift_delete(kept.back().second);
+				kept.pop_back();
+			}
+		}
+	private:
+		// Scale space buffers: levels, DoG, gradients and temp, plus
+		// the smoothing and detection scratch and the keypoints
+		static size_t size(const VlSiftFilt* f) {
+			size_t w=VL_SHIFT_LEFT(f->width,-f->o_min);
+			size_t nel=w*VL_SHIFT_LEFT(f->height,-f->o_min);
+			int levels=f->s_max-f->s_min;
+			return sizeof(vl_sift_pix)*(nel*(4*levels+2)+f->scratch_size)+
+				sizeof(int)*w+
+				sizeof(VlSiftKeypoint)*(f->keys_res+f->keys_tmp_res);
+		}
+		mutex m;
+		list<pair<FilterKey,VlSiftFilt*> > kept; // Most recent first
+		size_t bytes;
+	};
 
-		VlSiftFilt *filt=vl_sift_new (w,h,numOctaves,numScales,firstOctave);
-		if (edgeThresh >= 0)
-            vl_sift_set_edge_thresh (filt, edgeThresh) ;
-		if (peakThresh >= 0)
-            vl_sift_set_peak_thresh (filt, 255*peakThresh/numScales) ;
+	shared_ptr<SIFTFilterPool> SIFTDetector::newPool() {
+		return make_shared<SIFTFilterPool>();
+	}
 
-		list<SIFT> L;
-        vl_sift_process_first_octave (filt, If.data());
+	static int workers(int n) {
+		if (n > 0)
+			return n;
+		return max(1, int(thread::hardware_concurrency()));
+	}
+
+	// Run task(i) for each i in [0,n), spread among threads
+	template <typename Task>
+	static void parallel(int threads, int n, Task task) {
+		atomic<int> next(0);
+		auto work=[&]() {
+			int i;
+			while ((i=next++)<n)
+				task(i);
+		};
+		vector<thread> pool;
+		for (int t=1;t<min(threads,n);t++)
+			pool.push_back(thread(work));
+		work();
+		for (size_t t=0;t<pool.size();t++)
+			pool[t].join();
+	}
+
+	// Features written in place, then handed over to the returned Array
+	class SIFTBuffer {
+	public:
+		SIFTBuffer(): p(0), n(0), cap(0) {}
+		~SIFTBuffer() { delete[] p; }
+		size_t size() const { return n; }
+		const SIFT* data() const { return p; }
+		// m more features at the end, to be filled
+		SIFT* grow(size_t m) {
+			if (n+m>cap) {
+				cap=max(n+m,2*cap);
+				SIFT* q=new SIFT[cap];
+				copy(p,p+n,q);
+				delete[] p;
+				p=q;
+			}
+			n+=m;
+			return p+n-m;
+		}
+		Array<SIFT> release() {
+			if (n==0)
+				return Array<SIFT>();
+			Array<SIFT> A(p,n,true);
+			p=0; n=cap=0;
+			return A;
+		}
+	private:
+		SIFTBuffer(const SIFTBuffer&);
+		SIFTBuffer& operator=(const SIFTBuffer&);
+		SIFT* p;
+		size_t n, cap;
+	};
+
+	// Part of the image seen by one filter. Its features are mapped to
+	// the image by p -> (ox,oy)+scale*p, and kept in [x0,x1)x[y0,y1) only.
+	struct Part {
+		float ox, oy, scale;
+		float x0, y0, x1, y1;
+	};
+
+	// Descriptors computed by a single call of the batched VLFeat function
+	static const int DESCR_BATCH=16;
+
+	// Run f on image im of the part, appending the features to out. The
+	// orientations of the keypoints of an octave, then their descriptors
+	// by batches, are computed by the threads, the descriptors being
+	// written straight into out in the serial order.
+	static void extract(VlSiftFilt* f, const vl_sift_pix* im, const Part& P,
+						int threads, SIFTBuffer& out) {
+		vector<VlSiftKeypoint> keys, dkeys;
+		vector<double> angles, dangles;
+		vector<int> counts;
+		if (vl_sift_process_first_octave(f, im))
+			return;
 		while (true) {
-			vl_sift_detect (filt) ;
-
-			VlSiftKeypoint const *keys  = vl_sift_get_keypoints     (filt) ;
-			int nkeys = vl_sift_get_nkeypoints (filt) ;
-			for (int i=0;i<nkeys;++i) {
-				double angles [4];
-				int	nangles=vl_sift_calc_keypoint_orientations(filt,angles,keys+i) ;
-
-				for (int q=0 ; q < nangles ; ++q) {
-					vl_sift_pix descr[128] ;
-					vl_sift_calc_keypoint_descriptor(filt,descr, keys+i, angles [q]) ;
-					SIFT fp;
-					fp.pos=FloatPoint2(keys[i].x,keys[i].y);
-					fp.scale=keys[i].sigma;
-					fp.angle=float(angles[q]);
-					for (int k=0;k<128;k++)
-						fp.desc[k]=byte(512*descr[k]);
-					L.push_back(fp);
+			vl_sift_detect(f);
+			const VlSiftKeypoint* k=vl_sift_get_keypoints(f);
+			keys.clear();
+			for (int i=0;i<vl_sift_get_nkeypoints(f);++i) {
+				float x=P.ox+P.scale*k[i].x, y=P.oy+P.scale*k[i].y;
+				if (x>=P.x0 && x<P.x1 && y>=P.y0 && y<P.y1)
+					keys.push_back(k[i]);
+			}
+			const int n=int(keys.size());
+			if (n>0) {
+				// Gradients around the keypoints only, read only from now on
+				for (int i=0;i<n;i++)
+					vl_sift_update_keypoint_gradient(f,&keys[i]);
+				angles.resize(4*size_t(n));
+				counts.assign(n,0);
+				parallel(threads,n,[&](int i) {
+					counts[i]=vl_sift_calc_keypoint_orientations(f,&angles[4*size_t(i)],&keys[i]);
+				});
+				dkeys.clear();
+				dangles.clear();
+				for (int i=0;i<n;i++)
+					for (int q=0;q<counts[i];++q) {
+						dkeys.push_back(keys[i]);
+						dangles.push_back(angles[4*size_t(i)+q]);
+					}
+				const int m=int(dkeys.size());
+				SIFT* fp=out.grow(m);
+				for (int j=0;j<m;j++) {
+					fp[j].pos=FloatPoint2(P.ox+P.scale*dkeys[j].x,
+										  P.oy+P.scale*dkeys[j].y);
+					fp[j].scale=P.scale*dkeys[j].sigma;
+					fp[j].angle=float(dangles[j]);
 				}
+				parallel(threads,(m+DESCR_BATCH-1)/DESCR_BATCH,[&](int b) {
+					int j=b*DESCR_BATCH;
+					vl_sift_calc_keypoint_descriptors(f,&fp[j].desc[0],int(sizeof(SIFT)),
+													  &dkeys[j],&dangles[j],
+													  min(DESCR_BATCH,m-j));
+				});
 			}
-			if (vl_sift_process_next_octave(filt))
+			if (vl_sift_process_next_octave(f))
 				break; // Last octave
 		}
-		vl_sift_delete(filt);
-		return(Array<SIFT>(L));
+	}
+
+	Array<SIFT> SIFTDetector::run(const Image<byte>& I) const {
+
+		int w=I.width(),h=I.height();
+		Image<float,2> If(I);
+		const int threads=workers(numThreads);
+		// Filters come from the pool when it has them, and go back to it
+		auto create=[&](const FilterKey& k) {
+			VlSiftFilt *filt=pool->take(k);
+			if (filt)
+				return filt;
+			filt=vl_sift_new (k.w,k.h,k.O,k.S,k.o_min);
+			vl_sift_set_lazy_gradient (filt, 1) ;
+			if (edgeThresh >= 0)
+				vl_sift_set_edge_thresh (filt, edgeThresh) ;
+			if (peakThresh >= 0)
+				vl_sift_set_peak_thresh (filt, 255*peakThresh/numScales) ;
+			if (iirSigma >= 0)
+				vl_sift_set_iir_sigma (filt, iirSigma) ;
+			return filt;
+		};
+		auto release=[&](const FilterKey& k, VlSiftFilt* filt) {
+			pool->give(k,filt,poolMemory);
+		};
+		auto key=[&](int fw,int fh,int O,int o_min,bool coarse) {
+			FilterKey k={fw,fh,O,numScales,o_min,coarse,
+						 edgeThresh,peakThresh,iirSigma};
+			return k;
+		};
+
+		// Octaves up to 0 on tiles, the next ones on the reduced image
+		int O=numOctaves;
+		if (O < 0) // As vl_sift_new
+			O=max(int(floor(log2(double(min(w,h)))))-firstOctave-3,1);
+		const int tiled=min(O,1-firstOctave);
+		if (tileSize<=0 || tiled<=0 || (w<=tileSize && h<=tileSize)) {
+			FilterKey k=key(w,h,numOctaves,firstOctave,false);
+			VlSiftFilt *filt=create(k);
+			Part P={0,0,1,-1,-1,float(w+1),float(h+1)};
+			SIFTBuffer L;
+			extract(filt,If.data(),P,threads,L);
+			release(k,filt);
+			return L.release();
+		}
+
+		// Margin over which a tile sees the same blurred image and the same
+		// descriptor windows as the whole image: the descriptor radius of
+		// the largest keypoints of octave 0, plus the blur of its top level.
+		const double sigmaTop=1.6*pow(2.0,(numScales+2.0)/numScales);
+		const int margin=int(ceil(10*sigmaTop));
+		const int nx=(w+tileSize-1)/tileSize, ny=(h+tileSize-1)/tileSize;
+		const int tasks=nx*ny+(O>tiled? 1: 0);
+		vector<SIFTBuffer> found(tasks);
+		parallel(threads,tasks,[&](int t) {
+			if (t<nx*ny) { // Tile
+				int x0=(t%nx)*tileSize, y0=(t/nx)*tileSize;
+				int x1=min(w,x0+tileSize), y1=min(h,y0+tileSize);
+				int ax=max(0,x0-margin), ay=max(0,y0-margin);
+				int tw=min(w,x1+margin)-ax, th=min(h,y1+margin)-ay;
+				vector<vl_sift_pix> T(size_t(tw)*th);
+				for (int y=0;y<th;y++)
+					copy(&If(ax,ay+y),&If(ax,ay+y)+tw,&T[size_t(y)*tw]);
+				// Keypoints are kept by the tile they fall in: once only
+				Part P={float(ax),float(ay),1,float(x0),float(y0),
+						float(x1==w? w+1: x1),float(y1==h? h+1: y1)};
+				if (x0==0) P.x0=-1;
+				if (y0==0) P.y0=-1;
+				FilterKey k=key(tw,th,tiled,firstOctave,false);
+				VlSiftFilt *filt=create(k);
+				extract(filt,T.data(),P,1,found[t]);
+				release(k,filt);
+			} else { // Coarse octaves
+				int cw=w/2, ch=h/2;
+				FilterKey k=key(cw,ch,O-tiled,0,true);
+				VlSiftFilt *filt=create(k);
+				// The base of octave 1 is the image blurred to scale
+				// sigma0*sigmak^s_min of that octave, then subsampled
+				double sb=filt->sigma0*pow(filt->sigmak,filt->s_min);
+				vector<vl_sift_pix> B(size_t(w)*h), tmp(size_t(w)*h);
+				vl_imsmooth_f(B.data(),tmp.data(),If.data(),w,h,
+							  sqrt(4*sb*sb-SIGMAN*SIGMAN));
+				vector<vl_sift_pix> C(size_t(cw)*ch);
+				for (int y=0;y<ch;y++)
+					for (int x=0;x<cw;x++)
+						C[size_t(y)*cw+x]=B[size_t(2*y)*w+2*x];
+				filt->sigman=sb; // Already blurred: no more smoothing
+				Part P={0,0,2,-1,-1,float(w+1),float(h+1)};
+				extract(filt,C.data(),P,1,found[t]);
+				release(k,filt);
+			}
+		});
+
+		size_t total=0;
+		for (int t=0;t<tasks;t++)
+			total+=found[t].size();
+		Array<SIFT> A(total);
+		SIFT* a=A.data();
+		for (int t=0;t<tasks;t++)
+			a=copy(found[t].data(),found[t].data()+found[t].size(),a);
+		return A;
 	}
 
 
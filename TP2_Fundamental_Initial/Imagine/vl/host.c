@@ -327,7 +327,13 @@ GNU GPLv2, or (at your option) any later version.
 VL_INLINE void
 _vl_cpuid (vl_int32* info, int function)
 {
-  __cpuid(info, function) ;
+  __cpuidex(info, function, 0) ;
+}
+
+VL_INLINE vl_uint64
+_vl_xgetbv ()
+{
+  return _xgetbv(0) ;
 }
 #endif
 
@@ -347,22 +353,35 @@ _vl_cpuid (vl_int32* info, int function)
    "movl %%ebx, %1   \n" /* save what cpuid just put in %ebx */
    "popl %%ebx       \n" /* restore the old %ebx */
    : "=a"(info[0]), "=r"(info[1]), "=c"(info[2]), "=d"(info[3])
-   : "a"(function)
+   : "a"(function), "c"(0)
    : "cc") ; /* clobbered (cc=condition codes) */
 #else /* no -fPIC or -fPIC with a 64-bit target */
   __asm__ __volatile__
   ("cpuid"
    : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3])
-   : "a"(function)
+   : "a"(function), "c"(0)
    : "cc") ;
 #endif
 }
+
+/* Only call if the CPU has OSXSAVE */
+VL_INLINE vl_uint64
+_vl_xgetbv ()
+{
+  vl_uint32 eax, edx ;
+  __asm__ __volatile__
+  (".byte 0x0f, 0x01, 0xd0" /* xgetbv */
+   : "=a"(eax), "=d"(edx)
+   : "c"(0)) ;
+  return ((vl_uint64) edx << 32) | eax ;
+}
 #endif
 
 #ifdef HAS_CPUID
 struct x86cpu_
 {
   char vendor_string [0x20] ;
+  vl_bool has_avx2 ;
   vl_bool has_sse42 ;
   vl_bool has_sse41 ;
   vl_bool has_sse3 ;
@@ -391,9 +410,31 @@ void _vl_x86cpu_init ()
     x86cpu.has_sse3  = info[2] & (1 <<  0) ;
     x86cpu.has_sse41 = info[2] & (1 << 19) ;
     x86cpu.has_sse42 = info[2] & (1 << 20) ;
+
+    /* AVX2 needs the OS to save the YMM registers (OSXSAVE, then
+       XCR0 bits 1 and 2) */
+    if ((info[2] & (1 << 27)) && (_vl_xgetbv() & 0x6) == 0x6 &&
+        max_func >= 7) {
+      _vl_cpuid(info, 7) ;
+      x86cpu.has_avx2 = info[1] & (1 << 5) ;
+    }
   }
+  x86cpu_initialized = 1 ;
 }
 
+/* The CPU is inspected when the library is loaded, before any thread
+   can query it, rather than by the first query: threads then only read
+   x86cpu. */
+#if defined(VL_COMPILER_GNUC)
+static void _vl_x86cpu_load (void) __attribute__((constructor)) ;
+static void _vl_x86cpu_load (void) { _vl_x86cpu_init () ; }
+#elif defined(VL_COMPILER_MSC)
+#pragma section(".CRT$XCU", read)
+static void __cdecl _vl_x86cpu_load (void) { _vl_x86cpu_init () ; }
+__declspec(allocate(".CRT$XCU"))
+void (__cdecl *_vl_x86cpu_load_ptr) (void) = _vl_x86cpu_load ;
+#endif
+
 VL_INLINE
 struct x86cpu_ const* _vl_x86cpu_get()
 {
@@ -412,7 +453,7 @@ vl_bool simd_enabled = 1 ;
  ** Notice that usage of SIMD instructions may be prevented due
  ** to lack of CPU support and data alignment issues.
  **
- ** @see ::vl_cpu_has_sse2(), ::vl_cpu_has_sse3(), etc.
+ ** @see ::vl_cpu_has_sse2(), ::vl_cpu_has_avx2(), etc.
  **/
 void vl_set_simd_enabled (vl_bool x)
 {
@@ -451,6 +492,18 @@ vl_bool vl_cpu_has_sse2 ()
 #endif
 }
 
+/** @brief Check for AVX2 instruction set
+ ** @return @c true if AVX2 is present and enabled by the OS.
+ **/
+vl_bool vl_cpu_has_avx2 ()
+{
+#ifdef HAS_CPUID
+  return _vl_x86cpu_get()->has_avx2 ;
+#else
+  return 0 ;
+#endif
+}
+
 /** ------------------------------------------------------------------
  ** @brief Print host information
  **/
@@ -515,6 +568,7 @@ void vl_print_host_info ()
     VL_PRINTF("      CPU has SSE3: %s\n",   YESNO(c->has_sse3)) ;
     VL_PRINTF("      CPU has SSE4.1: %s\n", YESNO(c->has_sse41)) ;
     VL_PRINTF("      CPU has SSE4.2: %s\n", YESNO(c->has_sse42)) ;
+    VL_PRINTF("      CPU has AVX2: %s\n",   YESNO(c->has_avx2)) ;
     VL_PRINTF("VLFeat uses SIMD: %s\n", YESNO(vl_get_simd_enabled())) ;
   }
 #endif
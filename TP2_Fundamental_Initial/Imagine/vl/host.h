@@ -299,6 +299,7 @@ VL_INLINE void vl_swap_host_big_endianness_2 (void *dst, void* src) ;
 VL_EXPORT void vl_print_host_info() ;
 VL_EXPORT vl_bool vl_cpu_has_sse3 () ;
 VL_EXPORT vl_bool vl_cpu_has_sse2 () ;
+VL_EXPORT vl_bool vl_cpu_has_avx2 () ;
 /** @} */
 
 VL_EXPORT void vl_set_simd_enabled (vl_bool x) ;
@@ -39,12 +39,121 @@ void vl_convtransp_d(double       *dst,
                      double const *filt,
                      int width, int height, int filt_width,
                      int mode) ;
+
+/** @brief Pixels of the scratch of ::vl_convtransp_buf_f */
+#define VL_CONVTRANSP_BUF_SIZE(width,filt_width) \
+  (8 * ((width) + 2 * (filt_width)))
+
+VL_EXPORT
+void vl_convtransp_buf_f(float       *dst,
+                         float const *src,
+                         float const *filt,
+                         int width, int height, int filt_width,
+                         int mode,
+                         float       *buf) ;
+
+VL_EXPORT
+void vl_convtransp_buf_d(double       *dst,
+                         double const *src,
+                         double const *filt,
+                         int width, int height, int filt_width,
+                         int mode,
+                         double       *buf) ;
 /* @} */
 
 
 /** @name Image Smoothing
  ** @{ 
  **/
+
+/** @brief Half width of the Gaussian kernel of deviation @a sigma */
+#define VL_GAUSSIAN_WIDTH(sigma) ((int)ceil (4.0 * (sigma)))
+
+VL_EXPORT
+void vl_gaussian_filt_f(float *filt, int filt_width, double sigma) ;
+
+VL_EXPORT
+void vl_gaussian_filt_d(double *filt, int filt_width, double sigma) ;
+
+VL_EXPORT
+void vl_imsmooth_filt_f(float       *dst,
+                        float       *temp,
+                        float const *src,
+                        int width, int height,
+                        float const *filt, int filt_width) ;
+
+VL_EXPORT
+void vl_imsmooth_filt_d(double       *dst,
+                        double       *temp,
+                        double const *src,
+                        int width, int height,
+                        double const *filt, int filt_width) ;
+
+VL_EXPORT
+void vl_imsmooth_filt_buf_f(float       *dst,
+                            float       *temp,
+                            float       *buf,
+                            float const *src,
+                            int width, int height,
+                            float const *filt, int filt_width) ;
+
+VL_EXPORT
+void vl_imsmooth_filt_buf_d(double       *dst,
+                            double       *temp,
+                            double       *buf,
+                            double const *src,
+                            int width, int height,
+                            double const *filt, int filt_width) ;
+
+/** @brief Recursive Gaussian filter
+ **
+ ** Coefficients of the fourth order recursive approximation of a
+ ** Gaussian by Deriche, filled by ::vl_gaussian_iir. The filter is
+ ** the sum of a causal and an anticausal part with the same poles.
+ **/
+typedef struct _VlGaussianIir
+{
+  double n [4] ;  /**< causal part, inputs n to n-3. */
+  double m [4] ;  /**< anticausal part, inputs n+1 to n+4. */
+  double d [4] ;  /**< feedback of outputs n-1 to n-4 (n+1 to n+4). */
+} VlGaussianIir ;
+
+VL_EXPORT
+void vl_gaussian_iir (VlGaussianIir *g, double sigma) ;
+
+VL_EXPORT
+void vl_imsmooth_iir_f(float       *dst,
+                       float       *temp,
+                       float const *src,
+                       int width, int height,
+                       VlGaussianIir const *g) ;
+
+VL_EXPORT
+void vl_imsmooth_iir_d(double       *dst,
+                       double       *temp,
+                       double const *src,
+                       int width, int height,
+                       VlGaussianIir const *g) ;
+
+/** @brief Pixels of the scratch of ::vl_imsmooth_iir_buf_f */
+#define VL_IMSMOOTH_IIR_BUF_SIZE(width) (8 * (3 * (width) + 16))
+
+VL_EXPORT
+void vl_imsmooth_iir_buf_f(float       *dst,
+                           float       *temp,
+                           float       *buf,
+                           float const *src,
+                           int width, int height,
+                           VlGaussianIir const *g) ;
+
+VL_EXPORT
+void vl_imsmooth_iir_buf_d(double       *dst,
+                           double       *temp,
+                           double       *buf,
+                           double const *src,
+                           int width, int height,
+                           VlGaussianIir const *g) ;
+
 VL_EXPORT
 void vl_imsmooth_f(float       *dst, 
                    float       *temp,
@@ -56,6 +165,20 @@ void vl_imsmooth_d(double       *dst,
                    double       *temp,
                    double const *src,
                    int width, int height, double sigma) ;
+
+VL_EXPORT
+void vl_imsmooth_buf_f(float       *dst,
+                       float       *temp,
+                       float       *buf,
+                       float const *src,
+                       int width, int height, double sigma) ;
+
+VL_EXPORT
+void vl_imsmooth_buf_d(double       *dst,
+                       double       *temp,
+                       double       *buf,
+                       double const *src,
+                       int width, int height, double sigma) ;
 /*@}*/
 
 /* VL_IMOP */
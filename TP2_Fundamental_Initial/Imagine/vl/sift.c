@@ -34,6 +34,7 @@ multiple images of the same size.
 - @ref sift-intro
   - @ref sift-intro-detector
   - @ref sift-intro-descriptor
+  - @ref sift-intro-smoothing
   - @ref sift-intro-extensions
 - @ref sift-usage
 - @ref sift-tech
@@ -238,6 +239,25 @@ measured counter-clockwise.
  </tr>
 </table>
 
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@subsection sift-intro-smoothing Scale space smoothing
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+Each level of the scale space is obtained by smoothing the previous
+one. The Gaussian kernels of ::vl_imsmooth_f cost 8 sigma operations
+per pixel and pass; from the deviation set by ::vl_sift_set_iir_sigma
+on, the recursive filter ::vl_imsmooth_iir_f is used instead, whose
+cost does not depend on sigma. The default, 10, is where the two take
+the same time with the vectorized kernels, at 1280x960; the steps of
+the standard pyramid, about 1.2 to 3.1, stay below it. Without
+vectorization the recursive filter is faster from sigma 1.
+
+The recursive filter deviates from the sampled Gaussian by 1e-3 of its
+peak. Using it for all the steps of a 1280x960 image, 99.7% of the
+keypoints are found again with the same scale and orientation, 99%
+of them within 0.05 pixel, and their descriptors move by 0.5% of
+their norm; the others, near the thresholds, come and go.
+
 
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
 @section sift-intro-extensions Extensions
@@ -277,6 +297,8 @@ To use a <b>SIFT filter</b> object:
     - Use ::vl_sift_calc_keypoint_orientations() to get the keypoint orientation(s).
     - For each orientation:
       - Use ::vl_sift_calc_keypoint_descriptor() to get the keypoint descriptor.
+  - Alternatively, use ::vl_sift_calc_keypoint_descriptors() to get the
+    8-bit descriptors of all the keypoint orientations at once.
 - Delete the SIFT filter by ::vl_sift_delete().
 
 To compute SIFT descriptors of custom keypoints, use
@@ -688,13 +710,123 @@ Gaussian window size is set to have standard deviation
 
 #define EXPN_SZ  256          /**< ::fast_expn table size @internal */
 #define EXPN_MAX 25.0         /**< ::fast_expn table max  @internal */
-double expn_tab [EXPN_SZ+1] ; /**< ::fast_expn table      @internal */
+
+/** @internal
+ ** @brief ::fast_expn table
+ **
+ ** Values of exp(- k EXPN_MAX / EXPN_SZ) for k = 0, ..., EXPN_SZ, as
+ ** computed by the C library. The table is constant rather than filled
+ ** by the first ::vl_sift_new, so that filters can be created by
+ ** several threads at once.
+ **/
+static double const expn_tab [EXPN_SZ+1] = {
+  1, 0.90696061788738358, 0.82257756239866464,
+  0.74604545425339064, 0.67663384616172895, 0.61368025119835856,
+  0.556583819812148, 0.50479960512294586, 0.45783336177161427,
+  0.41523682868184131, 0.37660345071088042, 0.34156449835526093,
+  0.30978554847668166, 0.28096329245899321, 0.25482264133228211,
+  0.23111410023442172, 0.20961138715109781, 0.19010927320679125,
+  0.17242162389375282, 0.15637962254382412, 0.14183015908734253,
+  0.1286343687209221, 0.11666630653668103, 0.10581174546314712,
+  0.09596708604499847, 0.087038367656223511, 0.078940371709397744,
+  0.071595808301815111, 0.064934578535560894, 0.058893105470869143,
+  0.05341372732716633, 0.048444147140314996, 0.04393693362340742,
+  0.039849068467162553, 0.036141535759214402, 0.032778949603576059,
+  0.02972921638615875, 0.026963228462898267, 0.024454586346948901,
+  0.022179346743409149, 0.02011579402674089, 0.018244232979788257,
+  0.016546800816230139, 0.015007296692347551, 0.013611027080910821,
+  0.01234466553138479, 0.011196125477957834, 0.010154444881433316,
+  0.0092096816039681402, 0.0083528185180810136, 0.0075756774442599355,
+  0.0068708410957615063, 0.0062315822856178829, 0.0056517997201800691,
+  0.0051259597663902571, 0.0046490436369911762, 0.0042164994895909262,
+  0.0038241989824012237, 0.0034683978720029172, 0.0031457002770710523,
+  0.0028530262669808752, 0.0025875824659499099, 0.00234683539215249,
+  0.0021284872773466024, 0.0019304541362277093, 0.0017508458761963386,
+  0.0015879482577006087, 0.0014402065329773381, 0.0013062106070345731,
+  0.0011846815792471309, 0.0010744595371137791, 0.00097449248567570525,
+  0.00088382630693504996, 0.00080159565344293724, 0.00072701568914244734,
+  0.00065937459863845598, 0.00059802679340037956, 0.00054238675005561891,
+  0.00049192342196437405, 0.0004461551707380848, 0.00040464516932626452,
+  0.00036699723279729379, 0.00033285203702079351, 0.00030188368916145319,
+  0.0002737966172519944, 0.00024832274915834434, 0.00022521895401214571,
+  0.00020426472169080589, 0.00018526005819728775, 0.00016802357685246475,
+  0.00015239076708175971, 0.00013821242427280515, 0.00012535322571817655,
+  0.00011369043905153408, 0.00010311275085006726, 9.3519204223044844e-05,
+  8.4818235246469155e-05, 7.6926799047255122e-05, 6.9769577195997096e-05,
+  6.3278258843423041e-05, 5.7390888739468748e-05, 5.2051275912254659e-05,
+  4.7208457363205169e-05, 4.2816211659642766e-05, 3.8832617782426598e-05,
+  3.5219655018134224e-05, 3.1942840077027507e-05, 2.8970897973338749e-05,
+  2.6275463526651657e-05, 2.3830810635409398e-05, 2.1613606738648142e-05,
+  1.9602690122459233e-05, 1.7778867945720539e-05, 1.6124733057388896e-05,
+  1.4624497856998555e-05, 1.3263843612676125e-05, 1.2029783798514364e-05,
+  1.0910540146952225e-05, 9.8954302331648945e-06, 8.9747655185327283e-06,
+  8.1397588800828274e-06, 7.3824407433342391e-06, 6.6955830180914168e-06,
+  6.0726301112044633e-06, 5.507636357859531e-06, 4.9952092742232995e-06,
+  4.5304580898263518e-06, 4.1089470684618039e-06, 3.7266531720786709e-06,
+  3.3799276636004495e-06, 3.0654612821937241e-06, 2.7802526586082712e-06,
+  2.5215796691343987e-06, 2.2869734547703984e-06, 2.0741948576306049e-06,
+  1.881213049695487e-06, 1.7061861499296281e-06, 1.5474436447710716e-06,
+  1.403470444207476e-06, 1.272892421265093e-06, 1.1544632968947564e-06,
+  1.0470527450799744e-06, 9.4963560463841462e-07, 8.6128209475071563e-07,
+  7.811489408304491e-07, 7.0847132603765933e-07, 6.4255559161860949e-07,
+  5.8277261640140736e-07, 5.2855181225926759e-07, 4.7937567823216166e-07,
+  4.3477486132962491e-07, 3.9432367687341812e-07, 3.5763604562474029e-07,
+  3.2436180891861498e-07, 2.9418338663589649e-07, 2.668127461154957e-07,
+  2.419886530771396e-07, 2.1947417831657823e-07, 1.9905443637632959e-07,
+  1.8053453460910078e-07, 1.6373771305908126e-07, 1.4850365740753147e-07,
+  1.3468696888087105e-07, 1.2215577651757361e-07, 1.1079047854889171e-07,
+  1.0048260088074174e-07, 9.1133761781728885e-08, 8.2654732895958446e-08,
+  7.4964587618635126e-08, 6.7989928706270212e-08, 6.1664187749557989e-08,
+  5.5926989822862745e-08, 5.0723577246325008e-08, 4.6004286960785361e-08,
+  4.172407652742239e-08, 3.7842094228091493e-08, 3.4321289163262447e-08,
+  3.1128057626204074e-08, 2.8231922378296127e-08, 2.5605241764368108e-08,
+  2.3222945891767137e-08, 2.1062297355162399e-08, 1.9102674223365895e-08,
+  1.7325373216925327e-08, 1.5713431197952121e-08, 1.4251463268425545e-08,
+  1.2925515931730584e-08, 1.172293391595559e-08, 1.0632239387868047e-08,
+  9.643022404747381e-09, 8.7458415585115687e-09, 7.9321338638528102e-09,
+  7.1941330303253834e-09, 6.5247953383479449e-09, 5.9177324116567718e-09,
+  5.3671502445684228e-09, 4.8677939021081986e-09, 4.4148973652044893e-09,
+  4.0041380422552452e-09, 3.6315955129101957e-09, 3.2937141103060809e-09,
+  2.9872689846275972e-09, 2.7093353240936622e-09, 2.4572604396041024e-09,
+  2.2286384466135608e-09, 2.0212873025882135e-09, 1.833227980883329e-09,
+  1.6626655822703847e-09, 1.5079722038360346e-09, 1.3676714017481293e-09,
+  1.2404240995963874e-09, 1.125015807812341e-09, 1.0203450321865548e-09,
+  9.2541276085023993e-10, 8.3931292938160318e-10, 7.6122377303280873e-10,
+  6.903999835404016e-10, 6.2616559566124212e-10, 5.6790753554074176e-10,
+  5.150697693369324e-10, 4.6714799625293631e-10, 4.2368483532641628e-10,
+  3.8426546003716083e-10, 3.4851363906808312e-10, 3.1608814543136926e-10,
+  2.866794996873118e-10, 2.6000701617205031e-10, 2.3581612404245766e-10,
+  2.1387593756935531e-10, 1.9397705248914596e-10, 1.7592954738152924e-10,
+  1.5956117099779949e-10, 1.4471569823899869e-10, 1.3125143909284639e-10,
+  1.1903988629825626e-10, 1.0796448883031038e-10, 9.7919539499433826e-11,
+  8.8809166047654571e-11, 8.0546416112644029e-11, 7.3052427326137936e-11,
+  6.6255674625887254e-11, 6.0091287597240141e-11, 5.450043132884139e-11,
+  4.9429744873134901e-11, 4.4830831952154158e-11, 4.0659799047731196e-11,
+  3.6876836467507136e-11, 3.344583838830227e-11, 3.0334058250416203e-11,
+  2.7511796213829361e-11, 2.4952115693286458e-11, 2.2630586266780565e-11,
+  2.0525050503673039e-11, 1.8615412486981054e-11, 1.6883446011420853e-11,
+  1.5312620626586539e-11, 1.3887943864964021e-11
+} ;
 
 #define NBO 8
 #define NBP 4
 
+#define GRAD_TILE 32   /**< side of the gradient tiles @internal */
+#define GRAD_TILES(n) (((n) + GRAD_TILE - 1) / GRAD_TILE)
+
 #define log2(x) (log(x)/VL_LOG_OF_2)
 
+#if (defined(VL_COMPILER_GNUC) || defined(VL_COMPILER_MSC)) && \
+    (defined(VL_ARCH_X64) || defined(VL_ARCH_IX86))
+#define VL_SIFT_X86
+#include <immintrin.h>
+#if defined(VL_COMPILER_GNUC)
+#define VL_TARGET(x) __attribute__((target(x)))
+#else
+#define VL_TARGET(x)
+#endif
+#endif
+
 /** ------------------------------------------------------------------
  ** @internal
  ** @brief Fast @f$exp(-x)@f$ approximation
@@ -723,20 +855,6 @@ fast_expn (double x)
   return a + r * (b - a) ;
 }
 
-/** ------------------------------------------------------------------
- ** @internal
- ** @brief Initialize tables for ::fast_expn
- **/
-
-VL_INLINE void
-fast_expn_init ()
-{
-  int k  ;
-  for(k = 0 ; k < EXPN_SZ + 1 ; ++ k) {
-    expn_tab [k] = exp (- (double) k * (EXPN_MAX / EXPN_SZ)) ;
-  }
-}
-
 /** ------------------------------------------------------------------
  ** @internal
  ** @brief Copy image, upsample rows and take transpose
@@ -810,6 +928,91 @@ copy_and_downsample
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Scratch of the smoothing of the filter
+ **
+ ** @param f SIFT filter.
+ ** @param n pixels needed.
+ **
+ ** ::vl_sift_new sizes it for the level kernels and filters of the
+ ** first octave, so that it only grows for an unusual base smoothing.
+ **/
+
+static vl_sift_pix *
+get_scratch (VlSiftFilt *f, int n)
+{
+  if (n > f->scratch_size) {
+    if (f->scratch) vl_free (f->scratch) ;
+    f->scratch      = vl_malloc (sizeof(vl_sift_pix) * n) ;
+    f->scratch_size = n ;
+  }
+  return f->scratch ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Smooth the levels of the current octave from its first one
+ **
+ ** @param f SIFT filter.
+ **
+ ** The kernels are those precomputed by ::vl_sift_new.
+ **/
+
+static void
+fill_octave (VlSiftFilt *f)
+{
+  int s ;
+  int w = f-> octave_width ;
+  int h = f-> octave_height ;
+
+  for(s = f->s_min + 1 ; s <= f->s_max ; ++s) {
+    int    i  = s - f->s_min - 1 ;
+    double sd = f->dsigma0 * pow (f->sigmak, s) ;
+    if (f->iir_sigma > 0 && sd >= f->iir_sigma) {
+      vl_imsmooth_iir_buf_f (vl_sift_get_octave(f, s    ), f->temp,
+                             get_scratch (f, VL_IMSMOOTH_IIR_BUF_SIZE (w)),
+                             vl_sift_get_octave(f, s - 1), w, h,
+                             f->iir + i) ;
+    } else {
+      int n = VL_CONVTRANSP_BUF_SIZE (VL_MAX(w, h), f->filt_width [i]) ;
+      vl_imsmooth_filt_buf_f (vl_sift_get_octave(f, s    ), f->temp,
+                              get_scratch (f, n),
+                              vl_sift_get_octave(f, s - 1), w, h,
+                              f->filt + i * f->filt_stride,
+                              f->filt_width [i]) ;
+    }
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Smooth the first level of the current octave
+ **
+ ** @param f  SIFT filter.
+ ** @param sd standard deviation.
+ **/
+
+static void
+smooth_base (VlSiftFilt *f, double sd)
+{
+  vl_sift_pix *octave = vl_sift_get_octave (f, f->s_min) ;
+  int w = f-> octave_width ;
+  int h = f-> octave_height ;
+
+  if (f->iir_sigma > 0 && sd >= f->iir_sigma) {
+    VlGaussianIir g ;
+    vl_gaussian_iir (&g, sd) ;
+    vl_imsmooth_iir_buf_f (octave, f->temp,
+                           get_scratch (f, VL_IMSMOOTH_IIR_BUF_SIZE (w)),
+                           octave, w, h, &g) ;
+  } else {
+    int n = VL_CONVTRANSP_BUF_SIZE (VL_MAX(w, h), VL_GAUSSIAN_WIDTH (sd)) ;
+    vl_imsmooth_buf_f (octave, f->temp, get_scratch (f, n),
+                       octave, w, h, sd) ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Create a new SIFT filter
  **
@@ -860,8 +1063,7 @@ vl_sift_new (int width, int height,
                         * (f->s_max - f->s_min + 1)  ) ;
   f-> dog     = vl_malloc (sizeof(vl_sift_pix) * nel
                         * (f->s_max - f->s_min    )  ) ;
-  f-> grad    = vl_malloc (sizeof(vl_sift_pix) * nel * 2
-                        * (f->s_max - f->s_min    )  ) ;
+  f-> grad    = 0 ;
 
   f-> sigman  = 0.5 ;
   f-> sigmak  = pow (2.0, 1.0 / nlevels) ;
@@ -879,6 +1081,9 @@ vl_sift_new (int width, int height,
   f-> keys     = 0 ;
   f-> nkeys    = 0 ;
   f-> keys_res = 0 ;
+  f-> keys_tmp     = 0 ;
+  f-> keys_tmp_res = 0 ;
+  f-> cols     = vl_malloc (sizeof(int) * w) ;
 
   f-> peak_thresh = 0.0 ;
   f-> edge_thresh = 10.0 ;
@@ -886,10 +1091,43 @@ vl_sift_new (int width, int height,
   f-> magnif      = 3.0 ;
   f-> windowSize  = NBP / 2 ;
 
-  f-> grad_o  = o_min - 1 ;
+  f-> grad_o    = o_min - 1 ;
+  f-> grad_lazy = 0 ;
+  f-> grad_all  = 0 ;
+  f-> grad_done = vl_malloc (GRAD_TILES(w) * GRAD_TILES(h)
+                             * (f->s_max - f->s_min)) ;
+
+  /* detect the CPU now rather than in the first smoothing, which may
+     run concurrently with other filters */
+  vl_cpu_has_avx2 () ;
+
+  /* kernels smoothing level s-1 into level s, the same in all octaves */
+  f-> filt_width  = vl_malloc (sizeof(int) * (f->s_max - f->s_min)) ;
+  f-> filt_stride = 2 * VL_GAUSSIAN_WIDTH
+    (f->dsigma0 * pow (f->sigmak, f->s_max)) + 1 ;
+  f-> filt        = vl_malloc (sizeof(vl_sift_pix) * f->filt_stride
+                               * (f->s_max - f->s_min)) ;
+  f-> iir         = vl_malloc (sizeof(VlGaussianIir)
+                               * (f->s_max - f->s_min)) ;
+  f-> iir_sigma   = 10.0 ;
+  {
+    int s ;
+    for(s = f->s_min + 1 ; s <= f->s_max ; ++s) {
+      double sd = f->dsigma0 * pow (f->sigmak, s) ;
+      int    i  = s - f->s_min - 1 ;
+      f->filt_width [i] = VL_GAUSSIAN_WIDTH (sd) ;
+      vl_gaussian_filt_f (f->filt + i * f->filt_stride,
+                          f->filt_width [i], sd) ;
+      vl_gaussian_iir (f->iir + i, sd) ;
+    }
+  }
 
-  /* initialize fast_expn stuff */
-  fast_expn_init () ;
+  /* scratch of the smoothing of the first octave, the largest */
+  f-> scratch      = 0 ;
+  f-> scratch_size = 0 ;
+  get_scratch (f, VL_MAX(VL_IMSMOOTH_IIR_BUF_SIZE (w),
+                         VL_CONVTRANSP_BUF_SIZE (VL_MAX(w, h),
+                                                 (f->filt_stride - 1) / 2))) ;
 
   return f ;
 }
@@ -907,8 +1145,15 @@ void
 vl_sift_delete (VlSiftFilt* f)
 {
   if(f) {
+    if(f-> scratch) vl_free (f-> scratch) ;
+    if(f-> filt   ) vl_free (f-> filt   ) ;
+    if(f-> filt_width) vl_free (f-> filt_width) ;
+    if(f-> iir    ) vl_free (f-> iir    ) ;
     if(f-> keys   ) vl_free (f-> keys   ) ;
+    if(f-> keys_tmp) vl_free (f-> keys_tmp) ;
+    if(f-> cols   ) vl_free (f-> cols   ) ;
     if(f-> grad   ) vl_free (f-> grad   ) ;
+    if(f-> grad_done) vl_free (f-> grad_done) ;
     if(f-> dog    ) vl_free (f-> dog    ) ;
     if(f-> octave ) vl_free (f-> octave ) ;
     if(f-> temp   ) vl_free (f-> temp   ) ;
@@ -924,7 +1169,8 @@ vl_sift_delete (VlSiftFilt* f)
  **
  ** The function starts processing a new image by computing its
  ** Gaussian scale space at the lower octave. It also empties the
- ** internal keypoint buffer.
+ ** internal keypoint buffer. A filter can so process any number of
+ ** images of its size, its buffers allocated once.
  **
  ** @return error code. The function returns ::VL_ERR_EOF if there are
  ** no more octaves to process.
@@ -936,7 +1182,7 @@ VL_EXPORT
 int
 vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
 {
-  int o, s, h, w ;
+  int o ;
   double sa, sb ;
   vl_sift_pix *octave ;
 
@@ -946,17 +1192,16 @@ vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
   int height          = f-> height ;
   int o_min           = f-> o_min ;
   int s_min           = f-> s_min ;
-  int s_max           = f-> s_max ;
   double sigma0       = f-> sigma0 ;
   double sigmak       = f-> sigmak ;
   double sigman       = f-> sigman ;
-  double dsigma0      = f-> dsigma0 ;
 
-  /* restart from the first */
-  f->o_cur = o_min ;
-  f->nkeys = 0 ;
-  w = f-> octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
-  h = f-> octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
+  /* restart from the first, gradients of the last image are stale */
+  f->o_cur  = o_min ;
+  f->nkeys  = 0 ;
+  f->grad_o = o_min - 1 ;
+  f-> octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
+  f-> octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
 
   /* is there at least one octave? */
   if (f->O == 0)
@@ -1007,18 +1252,14 @@ vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
 
   if (sa > sb) {
     double sd = sqrt (sa*sa - sb*sb) ;
-    vl_imsmooth_f (octave, temp, octave, w, h, sd) ;
+    smooth_base (f, sd) ;
   }
 
   /* -----------------------------------------------------------------
    *                                          Compute the first octave
    * -------------------------------------------------------------- */
 
-  for(s = s_min + 1 ; s <= s_max ; ++s) {
-    double sd = dsigma0 * pow (sigmak, s) ;
-    vl_imsmooth_f (vl_sift_get_octave(f, s    ), temp,
-                   vl_sift_get_octave(f, s - 1), w, h, sd) ;
-  }
+  fill_octave (f) ;
 
   return VL_ERR_OK ;
 }
@@ -1043,12 +1284,11 @@ int
 vl_sift_process_next_octave (VlSiftFilt *f)
 {
 
-  int s, h, w, s_best ;
+  int h, w, s_best ;
   double sa, sb ;
   vl_sift_pix *octave, *pt ;
 
   /* shortcuts */
-  vl_sift_pix *temp   = f-> temp ;
   int O               = f-> O ;
   int S               = f-> S ;
   int o_min           = f-> o_min ;
@@ -1056,7 +1296,6 @@ vl_sift_process_next_octave (VlSiftFilt *f)
   int s_max           = f-> s_max ;
   double sigma0       = f-> sigma0 ;
   double sigmak       = f-> sigmak ;
-  double dsigma0      = f-> dsigma0 ;
 
   /* is there another octave ? */
   if (f->o_cur == o_min + O - 1)
@@ -1074,30 +1313,348 @@ vl_sift_process_next_octave (VlSiftFilt *f)
 
   f-> o_cur            += 1 ;
   f-> nkeys             = 0 ;
-  w = f-> octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
-  h = f-> octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
+  f-> octave_width      = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
+  f-> octave_height     = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
 
   sa = sigma0 * powf (sigmak, s_min     ) ;
   sb = sigma0 * powf (sigmak, s_best - S) ;
 
   if (sa > sb) {
     double sd = sqrt (sa*sa - sb*sb) ;
-    vl_imsmooth_f (octave, temp, octave, w, h, sd) ;
+    smooth_base (f, sd) ;
   }
 
   /* ------------------------------------------------------------------
    *                                                        Fill octave
    * --------------------------------------------------------------- */
 
-  for(s = s_min + 1 ; s <= s_max ; ++s) {
-    double sd = dsigma0 * pow (sigmak, s) ;
-    vl_imsmooth_f (vl_sift_get_octave(f, s    ), temp,
-                   vl_sift_get_octave(f, s - 1), w, h, sd) ;
-  }
+  fill_octave (f) ;
 
   return VL_ERR_OK ;
 }
 
+/* ---------------------------------------------------------------- */
+/*                                                Extremum detection */
+/* ---------------------------------------------------------------- */
+
+/* A DoG pixel is a keypoint candidate if it is above 0.8 tp and above
+ * its 26 neighbours in space and scale, or below -0.8 tp and below
+ * them. The vector versions test 4 (SSE2) or 8 (AVX2) pixels of a row
+ * at once, giving up on the group as soon as none of them is left. */
+
+#ifdef VL_SIFT_X86
+
+/** @internal @brief DoG row by groups of 4 with SSE2
+ ** @return first column left to compute.
+ **/
+VL_TARGET("sse2") static int
+_vl_sift_diff_sse2 (vl_sift_pix *dst, vl_sift_pix const *a,
+                    vl_sift_pix const *b, int w, int x)
+{
+  for ( ; x + 4 <= w ; x += 4) {
+    _mm_storeu_ps (dst + x, _mm_sub_ps (_mm_loadu_ps (b + x),
+                                        _mm_loadu_ps (a + x))) ;
+  }
+  return x ;
+}
+
+/** @internal @brief DoG row by groups of 8 with AVX2
+ ** @return first column left to compute.
+ **/
+VL_TARGET("avx2") static int
+_vl_sift_diff_avx2 (vl_sift_pix *dst, vl_sift_pix const *a,
+                    vl_sift_pix const *b, int w, int x)
+{
+  for ( ; x + 8 <= w ; x += 8) {
+    _mm256_storeu_ps (dst + x, _mm256_sub_ps (_mm256_loadu_ps (b + x),
+                                              _mm256_loadu_ps (a + x))) ;
+  }
+  return x ;
+}
+
+/** @internal @brief Scan a DoG row by groups of 4 with SSE2
+ ** @return first column left to scan.
+ **/
+VL_TARGET("sse2") static int
+_vl_sift_scan_sse2 (vl_sift_pix const *pt, int const *off, int end,
+                    float tf, int *xs, int *n, int x)
+{
+  __m128 const hi = _mm_set1_ps (  tf) ;
+  __m128 const lo = _mm_set1_ps (- tf) ;
+  for ( ; x + 4 <= end ; x += 4) {
+    __m128 v  = _mm_loadu_ps (pt + x) ;
+    __m128 gt = _mm_cmpge_ps (v, hi) ;
+    __m128 lt = _mm_cmple_ps (v, lo) ;
+    int    k, m ;
+    for (k = 0 ; k < 26 ; ++k) {
+      __m128 u = _mm_loadu_ps (pt + x + off [k]) ;
+      gt = _mm_and_ps (gt, _mm_cmpgt_ps (v, u)) ;
+      lt = _mm_and_ps (lt, _mm_cmplt_ps (v, u)) ;
+      if (! _mm_movemask_ps (_mm_or_ps (gt, lt))) break ;
+    }
+    for (m = _mm_movemask_ps (_mm_or_ps (gt, lt)), k = 0 ; m ; m >>= 1, ++k) {
+      if (m & 1) xs [(*n) ++] = x + k ;
+    }
+  }
+  return x ;
+}
+
+/** @internal @brief Scan a DoG row by groups of 8 with AVX2
+ ** @return first column left to scan.
+ **/
+VL_TARGET("avx2") static int
+_vl_sift_scan_avx2 (vl_sift_pix const *pt, int const *off, int end,
+                    float tf, int *xs, int *n, int x)
+{
+  __m256 const hi = _mm256_set1_ps (  tf) ;
+  __m256 const lo = _mm256_set1_ps (- tf) ;
+  for ( ; x + 8 <= end ; x += 8) {
+    __m256 v  = _mm256_loadu_ps (pt + x) ;
+    __m256 gt = _mm256_cmp_ps (v, hi, _CMP_GE_OQ) ;
+    __m256 lt = _mm256_cmp_ps (v, lo, _CMP_LE_OQ) ;
+    int    k, m ;
+    for (k = 0 ; k < 26 ; ++k) {
+      __m256 u = _mm256_loadu_ps (pt + x + off [k]) ;
+      gt = _mm256_and_ps (gt, _mm256_cmp_ps (v, u, _CMP_GT_OQ)) ;
+      lt = _mm256_and_ps (lt, _mm256_cmp_ps (v, u, _CMP_LT_OQ)) ;
+      if (! _mm256_movemask_ps (_mm256_or_ps (gt, lt))) break ;
+    }
+    for (m = _mm256_movemask_ps (_mm256_or_ps (gt, lt)), k = 0 ; m ; m >>= 1, ++k) {
+      if (m & 1) xs [(*n) ++] = x + k ;
+    }
+  }
+  return x ;
+}
+
+/* The gradient kernels compute the magnitude and angle of 4 (SSE2) or
+ * 8 (AVX2) pixels of a row at once, with the operations of
+ * vl_fast_sqrt_f, vl_fast_atan2_f and vl_mod_2pi_f in the same order
+ * and precision: the results are the scalar ones. */
+
+/** @internal @brief Smallest float not below @a x */
+static float
+_vl_sift_float_above (double x)
+{
+  union { float f ; vl_uint32 i ; } u ;
+  u.f = (float) x ;
+  if (u.f < x) u.i ++ ;
+  return u.f ;
+}
+
+/** @internal @brief Gradient of the middle of a row by groups of 4 with SSE2
+ ** @return first column left to compute.
+ **/
+VL_TARGET("sse2") static int
+_vl_sift_grad_sse2 (vl_sift_pix *g, vl_sift_pix const *r,
+                    vl_sift_pix const *ru, vl_sift_pix const *rd,
+                    float cy, int x, int end)
+{
+  __m128  const half  = _mm_set1_ps (0.5F) ;
+  __m128  const vcy   = _mm_set1_ps (cy) ;
+  __m128  const small = _mm_set1_ps (_vl_sift_float_above (1e-8)) ;
+  __m128  const sign  = _mm_set1_ps (-0.0F) ;
+  __m128  const eps   = _mm_set1_ps (VL_EPSILON_F) ;
+  __m128  const c1    = _mm_set1_ps (0.9675F) ;
+  __m128  const c3    = _mm_set1_ps (0.1821F) ;
+  __m128  const q1    = _mm_set1_ps ((float) (VL_PI / 4)) ;
+  __m128  const q3    = _mm_set1_ps ((float) (3 * VL_PI / 4)) ;
+  __m128  const p2    = _mm_set1_ps ((float) (2 * VL_PI)) ;
+  __m128d const d2    = _mm_set1_pd (2 * VL_PI) ;
+  __m128i const magic = _mm_set1_epi32 (0x5f3759df) ;
+
+  for ( ; x + 4 <= end ; x += 4) {
+    __m128 gx = _mm_mul_ps (half, _mm_sub_ps (_mm_loadu_ps (r + x + 1),
+                                              _mm_loadu_ps (r + x - 1))) ;
+    __m128 gy = _mm_mul_ps (vcy,  _mm_sub_ps (_mm_loadu_ps (rd + x),
+                                              _mm_loadu_ps (ru + x))) ;
+    __m128 m, a, t, u, pos, n, d ;
+
+    /* vl_fast_sqrt_f */
+    m = _mm_add_ps (_mm_mul_ps (gx, gx), _mm_mul_ps (gy, gy)) ;
+    t = _mm_mul_ps (half, m) ;
+    u = _mm_castsi128_ps (_mm_sub_epi32 (magic, _mm_srai_epi32
+                                         (_mm_castps_si128 (m), 1))) ;
+    u = _mm_mul_ps (u, _mm_sub_ps (_mm_set1_ps (1.5F),
+                                   _mm_mul_ps (_mm_mul_ps (t, u), u))) ;
+    u = _mm_mul_ps (u, _mm_sub_ps (_mm_set1_ps (1.5F),
+                                   _mm_mul_ps (_mm_mul_ps (t, u), u))) ;
+    m = _mm_andnot_ps (_mm_cmplt_ps (m, small), _mm_mul_ps (m, u)) ;
+
+    /* vl_fast_atan2_f */
+    t   = _mm_add_ps (_mm_andnot_ps (sign, gy), eps) ;
+    pos = _mm_cmpge_ps (gx, _mm_setzero_ps ()) ;
+    n   = _mm_or_ps (_mm_and_ps    (pos, _mm_sub_ps (gx, t)),
+                     _mm_andnot_ps (pos, _mm_add_ps (gx, t))) ;
+    d   = _mm_or_ps (_mm_and_ps    (pos, _mm_add_ps (gx, t)),
+                     _mm_andnot_ps (pos, _mm_sub_ps (t, gx))) ;
+    u   = _mm_div_ps (n, d) ;
+    a   = _mm_or_ps (_mm_and_ps (pos, q1), _mm_andnot_ps (pos, q3)) ;
+    a   = _mm_add_ps (a, _mm_mul_ps (_mm_sub_ps (_mm_mul_ps
+                                                 (_mm_mul_ps (c3, u), u), c1), u)) ;
+    a   = _mm_xor_ps (a, _mm_and_ps (sign, _mm_cmplt_ps (gy, _mm_setzero_ps ()))) ;
+
+    /* vl_mod_2pi_f (a + 2 pi), the sum in double */
+    a = _mm_movelh_ps (_mm_cvtpd_ps (_mm_add_pd (_mm_cvtps_pd (a), d2)),
+                       _mm_cvtpd_ps (_mm_add_pd (_mm_cvtps_pd
+                                                 (_mm_movehl_ps (a, a)), d2))) ;
+    a = _mm_sub_ps (a, _mm_and_ps (_mm_cmpge_ps (a, p2), p2)) ;
+    a = _mm_add_ps (a, _mm_and_ps (_mm_cmplt_ps (a, _mm_setzero_ps ()), p2)) ;
+
+    _mm_storeu_ps (g + 2 * x    , _mm_unpacklo_ps (m, a)) ;
+    _mm_storeu_ps (g + 2 * x + 4, _mm_unpackhi_ps (m, a)) ;
+  }
+  return x ;
+}
+
+/** @internal @brief Gradient of the middle of a row by groups of 8 with AVX2
+ ** @return first column left to compute.
+ **/
+VL_TARGET("avx2") static int
+_vl_sift_grad_avx2 (vl_sift_pix *g, vl_sift_pix const *r,
+                    vl_sift_pix const *ru, vl_sift_pix const *rd,
+                    float cy, int x, int end)
+{
+  __m256  const half  = _mm256_set1_ps (0.5F) ;
+  __m256  const vcy   = _mm256_set1_ps (cy) ;
+  __m256  const small = _mm256_set1_ps (_vl_sift_float_above (1e-8)) ;
+  __m256  const sign  = _mm256_set1_ps (-0.0F) ;
+  __m256  const eps   = _mm256_set1_ps (VL_EPSILON_F) ;
+  __m256  const c1    = _mm256_set1_ps (0.9675F) ;
+  __m256  const c3    = _mm256_set1_ps (0.1821F) ;
+  __m256  const q1    = _mm256_set1_ps ((float) (VL_PI / 4)) ;
+  __m256  const q3    = _mm256_set1_ps ((float) (3 * VL_PI / 4)) ;
+  __m256  const p2    = _mm256_set1_ps ((float) (2 * VL_PI)) ;
+  __m256  const zero  = _mm256_setzero_ps () ;
+  __m256d const d2    = _mm256_set1_pd (2 * VL_PI) ;
+  __m256i const magic = _mm256_set1_epi32 (0x5f3759df) ;
+
+  for ( ; x + 8 <= end ; x += 8) {
+    __m256 gx = _mm256_mul_ps (half, _mm256_sub_ps (_mm256_loadu_ps (r + x + 1),
+                                                    _mm256_loadu_ps (r + x - 1))) ;
+    __m256 gy = _mm256_mul_ps (vcy,  _mm256_sub_ps (_mm256_loadu_ps (rd + x),
+                                                    _mm256_loadu_ps (ru + x))) ;
+    __m256 m, a, t, u, pos, n, d, lo, hi ;
+
+    /* vl_fast_sqrt_f */
+    m = _mm256_add_ps (_mm256_mul_ps (gx, gx), _mm256_mul_ps (gy, gy)) ;
+    t = _mm256_mul_ps (half, m) ;
+    u = _mm256_castsi256_ps (_mm256_sub_epi32 (magic, _mm256_srai_epi32
+                                               (_mm256_castps_si256 (m), 1))) ;
+    u = _mm256_mul_ps (u, _mm256_sub_ps (_mm256_set1_ps (1.5F),
+                                         _mm256_mul_ps (_mm256_mul_ps (t, u), u))) ;
+    u = _mm256_mul_ps (u, _mm256_sub_ps (_mm256_set1_ps (1.5F),
+                                         _mm256_mul_ps (_mm256_mul_ps (t, u), u))) ;
+    m = _mm256_andnot_ps (_mm256_cmp_ps (m, small, _CMP_LT_OQ),
+                          _mm256_mul_ps (m, u)) ;
+
+    /* vl_fast_atan2_f */
+    t   = _mm256_add_ps (_mm256_andnot_ps (sign, gy), eps) ;
+    pos = _mm256_cmp_ps (gx, zero, _CMP_GE_OQ) ;
+    n   = _mm256_blendv_ps (_mm256_add_ps (gx, t), _mm256_sub_ps (gx, t), pos) ;
+    d   = _mm256_blendv_ps (_mm256_sub_ps (t, gx), _mm256_add_ps (gx, t), pos) ;
+    u   = _mm256_div_ps (n, d) ;
+    a   = _mm256_blendv_ps (q3, q1, pos) ;
+    a   = _mm256_add_ps (a, _mm256_mul_ps (_mm256_sub_ps (_mm256_mul_ps
+                                                          (_mm256_mul_ps (c3, u), u), c1), u)) ;
+    a   = _mm256_xor_ps (a, _mm256_and_ps (sign, _mm256_cmp_ps (gy, zero, _CMP_LT_OQ))) ;
+
+    /* vl_mod_2pi_f (a + 2 pi), the sum in double */
+    lo = _mm256_castps128_ps256
+      (_mm256_cvtpd_ps (_mm256_add_pd (_mm256_cvtps_pd
+                                       (_mm256_castps256_ps128 (a)), d2))) ;
+    a  = _mm256_insertf128_ps
+      (lo, _mm256_cvtpd_ps (_mm256_add_pd (_mm256_cvtps_pd
+                                           (_mm256_extractf128_ps (a, 1)), d2)), 1) ;
+    a  = _mm256_sub_ps (a, _mm256_and_ps (_mm256_cmp_ps (a, p2, _CMP_GE_OQ), p2)) ;
+    a  = _mm256_add_ps (a, _mm256_and_ps (_mm256_cmp_ps (a, zero, _CMP_LT_OQ), p2)) ;
+
+    /* interleave magnitudes and angles */
+    lo = _mm256_unpacklo_ps (m, a) ;
+    hi = _mm256_unpackhi_ps (m, a) ;
+    _mm256_storeu_ps (g + 2 * x    , _mm256_permute2f128_ps (lo, hi, 0x20)) ;
+    _mm256_storeu_ps (g + 2 * x + 8, _mm256_permute2f128_ps (lo, hi, 0x31)) ;
+  }
+  return x ;
+}
+
+#endif
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute a DoG row
+ **
+ ** @param dst DoG row (output).
+ ** @param a   row of the lower level.
+ ** @param b   row of the upper level.
+ ** @param w   row width.
+ **/
+
+static void
+diff_row (vl_sift_pix *dst, vl_sift_pix const *a, vl_sift_pix const *b, int w)
+{
+  int x = 0 ;
+
+#ifdef VL_SIFT_X86
+  if (vl_get_simd_enabled()) {
+    if (vl_cpu_has_avx2()) {
+      x = _vl_sift_diff_avx2 (dst, a, b, w, x) ;
+    }
+    if (vl_cpu_has_sse2()) {
+      x = _vl_sift_diff_sse2 (dst, a, b, w, x) ;
+    }
+  }
+#endif
+
+  for ( ; x < w ; ++x) dst [x] = b [x] - a [x] ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Find the extrema of a DoG row
+ **
+ ** @param pt  first pixel of the row.
+ ** @param off offsets of the 26 neighbours.
+ ** @param w   row width.
+ ** @param tf  smallest float not below 0.8 tp.
+ ** @param xs  columns of the extrema (output).
+ **
+ ** The first and last pixels are not tested.
+ **
+ ** @return number of extrema.
+ **/
+
+static int
+scan_row (vl_sift_pix const *pt, int const *off, int w, float tf, int *xs)
+{
+  int n = 0 ;
+  int x = 1 ;
+  int k ;
+
+#ifdef VL_SIFT_X86
+  if (vl_get_simd_enabled()) {
+    if (vl_cpu_has_avx2()) {
+      x = _vl_sift_scan_avx2 (pt, off, w - 1, tf, xs, &n, x) ;
+    }
+    if (vl_cpu_has_sse2()) {
+      x = _vl_sift_scan_sse2 (pt, off, w - 1, tf, xs, &n, x) ;
+    }
+  }
+#endif
+
+  for ( ; x < w - 1 ; ++x) {
+    vl_sift_pix v = pt [x] ;
+    if (v >= tf) {
+      for (k = 0 ; k < 26 && v > pt [x + off [k]] ; ++k) ;
+    } else if (v <= - tf) {
+      for (k = 0 ; k < 26 && v < pt [x + off [k]] ; ++k) ;
+    } else {
+      continue ;
+    }
+    if (k == 26) xs [n ++] = x ;
+  }
+  return n ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Detect keypoints
  **
@@ -1126,95 +1683,86 @@ vl_sift_detect (VlSiftFilt * f)
 
   double       xper  = pow (2.0, f->o_cur) ;
 
-  int x, y, s, i, ii, jj ;
-  vl_sift_pix *pt, v ;
+  int y, s, i, ii, jj ;
+  vl_sift_pix *pt ;
   VlSiftKeypoint *k ;
 
   /* clear current list */
   f-> nkeys = 0 ;
 
-  /* compute difference of gaussian (DoG) */
-  pt = f-> dog ;
-  for (s = s_min ; s <= s_max - 1 ; ++s) {
-    vl_sift_pix* src_a = vl_sift_get_octave (f, s    ) ;
-    vl_sift_pix* src_b = vl_sift_get_octave (f, s + 1) ;
-    vl_sift_pix* end_a = src_a + w * h ;
-    while (src_a != end_a) {
-      *pt++ = *src_b++ - *src_a++ ;
+  /* The DoG levels are computed a row at a time, and the rows of
+   * levels s_min+1 to s_max-2 scanned for extrema as soon as their
+   * neighbours are there, while they are still in the cache. The
+   * candidates are then put back in level order. */
+  {
+    int const  nd  = s_max - s_min ;
+    int       *xs  = f->cols ;
+    int        off [26] ;
+    float      tf  = (float) (0.8 * tp) ;
+    int        dx, dy, ds, n ;
+
+    /* v >= tf if and only if v >= 0.8 tp */
+    if (tf < 0.8 * tp) {
+      union { float f ; vl_uint32 i ; } u ;
+      u.f = tf ; u.i ++ ; tf = u.f ;
     }
-  }
 
-  /* -----------------------------------------------------------------
-   *                                          Find local maxima of DoG
-   * -------------------------------------------------------------- */
+    n = 0 ;
+    for (ds = -1 ; ds <= 1 ; ++ds)
+      for (dy = -1 ; dy <= 1 ; ++dy)
+        for (dx = -1 ; dx <= 1 ; ++dx)
+          if (dx || dy || ds) off [n ++] = dx * xo + dy * yo + ds * so ;
 
-  /* start from dog [1,1,s_min+1] */
-  pt  = dog + xo + yo + so ;
-
-  for(s = s_min + 1 ; s <= s_max - 2 ; ++s) {
-    for(y = 1 ; y < h - 1 ; ++y) {
-      for(x = 1 ; x < w - 1 ; ++x) {
-        v = *pt ;
-
-#define CHECK_NEIGHBORS(CMP,SGN)                    \
-        ( v CMP ## = SGN 0.8 * tp &&                \
-          v CMP *(pt + xo) &&                       \
-          v CMP *(pt - xo) &&                       \
-          v CMP *(pt + so) &&                       \
-          v CMP *(pt - so) &&                       \
-          v CMP *(pt + yo) &&                       \
-          v CMP *(pt - yo) &&                       \
-                                                    \
-          v CMP *(pt + yo + xo) &&                  \
-          v CMP *(pt + yo - xo) &&                  \
-          v CMP *(pt - yo + xo) &&                  \
-          v CMP *(pt - yo - xo) &&                  \
-                                                    \
-          v CMP *(pt + xo      + so) &&             \
-          v CMP *(pt - xo      + so) &&             \
-          v CMP *(pt + yo      + so) &&             \
-          v CMP *(pt - yo      + so) &&             \
-          v CMP *(pt + yo + xo + so) &&             \
-          v CMP *(pt + yo - xo + so) &&             \
-          v CMP *(pt - yo + xo + so) &&             \
-          v CMP *(pt - yo - xo + so) &&             \
-                                                    \
-          v CMP *(pt + xo      - so) &&             \
-          v CMP *(pt - xo      - so) &&             \
-          v CMP *(pt + yo      - so) &&             \
-          v CMP *(pt - yo      - so) &&             \
-          v CMP *(pt + yo + xo - so) &&             \
-          v CMP *(pt + yo - xo - so) &&             \
-          v CMP *(pt - yo + xo - so) &&             \
-          v CMP *(pt - yo - xo - so) )
-
-        if (CHECK_NEIGHBORS(>,+) ||
-            CHECK_NEIGHBORS(<,-) ) {
-
-          /* make room for more keypoints */
-          if (f->nkeys >= f->keys_res) {
-            f->keys_res += 500 ;
-            if (f->keys) {
-              f->keys = vl_realloc (f->keys,
-                                    f->keys_res *
-                                    sizeof(VlSiftKeypoint)) ;
-            } else {
-              f->keys = vl_malloc (f->keys_res *
-                                   sizeof(VlSiftKeypoint)) ;
-            }
+    for (y = 0 ; y < h ; ++y) {
+      for (s = 0 ; s < nd ; ++s) {
+        vl_sift_pix const *a = vl_sift_get_octave (f, s_min + s) + y * w ;
+        diff_row (dog + s * so + y * yo, a, a + w * h, w) ;
+      }
+      if (y < 2) continue ;
+
+      for (s = s_min + 1 ; s <= s_max - 2 ; ++s) {
+        pt = dog + (s - s_min) * so + (y - 1) * yo ;
+        n  = scan_row (pt, off, w, tf, xs) ;
+
+        /* make room for more keypoints */
+        if (f->nkeys + n > f->keys_res) {
+          f->keys_res = VL_MAX(f->keys_res + 500, f->nkeys + n) ;
+          if (f->keys) {
+            f->keys = vl_realloc (f->keys,
+                                  f->keys_res *
+                                  sizeof(VlSiftKeypoint)) ;
+          } else {
+            f->keys = vl_malloc (f->keys_res *
+                                 sizeof(VlSiftKeypoint)) ;
           }
+        }
 
+        for (i = 0 ; i < n ; ++i) {
           k = f->keys + (f->nkeys ++) ;
-
-          k-> ix = x ;
-          k-> iy = y ;
+          k-> ix = xs [i] ;
+          k-> iy = y - 1 ;
           k-> is = s ;
         }
-        pt += 1 ;
       }
-      pt += 2 ;
     }
-    pt += 2 * yo ;
+
+    /* stable partition by level */
+    if (f->nkeys > 0 && s_max - s_min > 3) {
+      VlSiftKeypoint *tmp ;
+      if (f->nkeys > f->keys_tmp_res) {
+        if (f->keys_tmp) vl_free (f->keys_tmp) ;
+        f->keys_tmp_res = f->keys_res ;
+        f->keys_tmp     = vl_malloc (sizeof(VlSiftKeypoint) * f->keys_res) ;
+      }
+      tmp = f->keys_tmp ;
+      memcpy (tmp, f->keys, sizeof(VlSiftKeypoint) * f->nkeys) ;
+      k = f->keys ;
+      for (s = s_min + 1 ; s <= s_max - 2 ; ++s) {
+        for (i = 0 ; i < f->nkeys ; ++i) {
+          if (tmp [i] .is == s) *k++ = tmp [i] ;
+        }
+      }
+    }
   }
 
   /* -----------------------------------------------------------------
@@ -1393,101 +1941,192 @@ vl_sift_detect (VlSiftFilt * f)
 
 /** ------------------------------------------------------------------
  ** @internal
- ** @brief Update gradients to current GSS octave
+ ** @brief Compute the gradient of a rectangle of a level
  **
- ** @param f SIFT filter.
- **
- ** The function makes sure that the gradient buffer is up-to-date
- ** with the current GSS data.
+ ** @param f  SIFT filter.
+ ** @param s  level.
+ ** @param x0 first column.
+ ** @param y0 first row.
+ ** @param x1 column past the last.
+ ** @param y1 row past the last.
  **
- ** @remark The minimum octave size is 2x2xS.
+ ** Derivatives are central differences, one-sided on the borders.
  **/
 
 static void
-update_gradient (VlSiftFilt *f)
+update_gradient_rect (VlSiftFilt *f, int s, int x0, int y0, int x1, int y1)
 {
-  int       s_min = f->s_min ;
-  int       s_max = f->s_max ;
-  int       w     = vl_sift_get_octave_width  (f) ;
-  int       h     = vl_sift_get_octave_height (f) ;
-  int const xo    = 1 ;
-  int const yo    = w ;
-  int const so    = h * w ;
-  int y, s ;
-
-  if (f->grad_o == f->o_cur) return ;
-
-  for (s  = s_min + 1 ;
-       s <= s_max - 2 ; ++ s) {
+  int w = f-> octave_width ;
+  int h = f-> octave_height ;
+  int x, y ;
 
-    vl_sift_pix *src, *end, *grad, gx, gy ;
+  vl_sift_pix const *src  = vl_sift_get_octave (f, s) ;
+  vl_sift_pix       *grad = f->grad + 2 * w * h * (s - f->s_min - 1) ;
+  vl_sift_pix        gx, gy ;
 
 #define SAVE_BACK                                                       \
-    *grad++ = vl_fast_sqrt_f (gx*gx + gy*gy) ;                          \
-    *grad++ = vl_mod_2pi_f   (vl_fast_atan2_f (gy, gx) + 2*VL_PI) ;     \
-    ++src ;                                                             \
-
-    src  = vl_sift_get_octave (f,s) ;
-    grad = f->grad + 2 * so * (s - s_min -1) ;
-
-    /* first pixel of the first row */
-    gx = src[+xo] - src[0] ;
-    gy = src[+yo] - src[0] ;
-    SAVE_BACK ;
-
-    /* middle pixels of the  first row */
-    end = (src - 1) + w - 1 ;
-    while (src < end) {
-      gx = 0.5 * (src[+xo] - src[-xo]) ;
-      gy =        src[+yo] - src[0] ;
+  g [2*x  ] = vl_fast_sqrt_f (gx*gx + gy*gy) ;                          \
+  g [2*x+1] = vl_mod_2pi_f   (vl_fast_atan2_f (gy, gx) + 2*VL_PI) ;
+
+  for (y = y0 ; y < y1 ; ++y) {
+    vl_sift_pix const *r  = src + y * w ;
+    vl_sift_pix const *ru = (y > 0    ) ? r - w : r ;
+    vl_sift_pix const *rd = (y < h - 1) ? r + w : r ;
+    double      const  cy = (y > 0 && y < h - 1) ? 0.5 : 1.0 ;
+    vl_sift_pix       *g  = grad + 2 * w * y ;
+
+    x = x0 ;
+    if (x == 0) {
+      gx = r [x+1] - r [x] ;
+      gy = cy * (rd [x] - ru [x]) ;
       SAVE_BACK ;
+      ++ x ;
     }
-
-    /* last pixel of the first row */
-    gx = src[0]   - src[-xo] ;
-    gy = src[+yo] - src[0] ;
-    SAVE_BACK ;
-
-    for (y = 1 ; y < h -1 ; ++y) {
-
-      /* first pixel of the middle rows */
-      gx =        src[+xo] - src[0] ;
-      gy = 0.5 * (src[+yo] - src[-yo]) ;
-      SAVE_BACK ;
-
-      /* middle pixels of the middle rows */
-      end = (src - 1) + w - 1 ;
-      while (src < end) {
-        gx = 0.5 * (src[+xo] - src[-xo]) ;
-        gy = 0.5 * (src[+yo] - src[-yo]) ;
-        SAVE_BACK ;
+#ifdef VL_SIFT_X86
+    if (vl_get_simd_enabled()) {
+      if (vl_cpu_has_avx2()) {
+        x = _vl_sift_grad_avx2 (g, r, ru, rd, (float) cy, x, VL_MIN(x1, w - 1)) ;
       }
-
-      /* last pixel of the middle row */
-      gx =        src[0]   - src[-xo] ;
-      gy = 0.5 * (src[+yo] - src[-yo]) ;
+      if (vl_cpu_has_sse2()) {
+        x = _vl_sift_grad_sse2 (g, r, ru, rd, (float) cy, x, VL_MIN(x1, w - 1)) ;
+      }
+    }
+#endif
+    for ( ; x < VL_MIN(x1, w - 1) ; ++x) {
+      gx = 0.5 * (r [x+1] - r [x-1]) ;
+      gy = cy  * (rd [x]  - ru [x] ) ;
+      SAVE_BACK ;
+    }
+    if (x < x1) {
+      gx = r [x] - r [x-1] ;
+      gy = cy * (rd [x] - ru [x]) ;
       SAVE_BACK ;
     }
+  }
+#undef SAVE_BACK
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute the missing gradient tiles over a rectangle
+ **
+ ** @param f  SIFT filter.
+ ** @param s  level.
+ ** @param x0 first column.
+ ** @param y0 first row.
+ ** @param x1 column past the last.
+ ** @param y1 row past the last.
+ **
+ ** The tiles of the current octave are forgotten when the octave
+ ** changes.
+ **/
 
-    /* first pixel of the last row */
-    gx = src[+xo] - src[0] ;
-    gy = src[  0] - src[-yo] ;
-    SAVE_BACK ;
+static void
+update_gradient_tiles (VlSiftFilt *f, int s, int x0, int y0, int x1, int y1)
+{
+  int w  = vl_sift_get_octave_width  (f) ;
+  int h  = vl_sift_get_octave_height (f) ;
+  int tw = GRAD_TILES(w) ;
+  int th = GRAD_TILES(h) ;
+  int tx, ty ;
+  vl_uint8 *done ;
+
+  if (f->grad_o != f->o_cur) {
+    if (! f->grad) {
+      int nel = VL_SHIFT_LEFT(f->width,  - f->o_min)
+              * VL_SHIFT_LEFT(f->height, - f->o_min) ;
+      f->grad = vl_malloc (sizeof(vl_sift_pix) * nel * 2
+                           * (f->s_max - f->s_min)) ;
+    }
+    memset (f->grad_done, 0, tw * th * (f->s_max - f->s_min)) ;
+    f->grad_o   = f->o_cur ;
+    f->grad_all = 0 ;
+  }
 
-    /* middle pixels of the last row */
-    end = (src - 1) + w - 1 ;
-    while (src < end) {
-      gx = 0.5 * (src[+xo] - src[-xo]) ;
-      gy =        src[0]   - src[-yo] ;
-      SAVE_BACK ;
+  x0 = VL_MAX(x0, 0) ; x1 = VL_MIN(x1, w) ;
+  y0 = VL_MAX(y0, 0) ; y1 = VL_MIN(y1, h) ;
+  if (x0 >= x1 || y0 >= y1) return ;
+
+  done = f->grad_done + tw * th * (s - f->s_min - 1) ;
+  for (ty = y0 / GRAD_TILE ; ty <= (y1 - 1) / GRAD_TILE ; ++ty) {
+    for (tx = x0 / GRAD_TILE ; tx <= (x1 - 1) / GRAD_TILE ; ++tx) {
+      if (done [ty * tw + tx]) continue ;
+      update_gradient_rect (f, s,
+                            tx * GRAD_TILE, ty * GRAD_TILE,
+                            VL_MIN((tx + 1) * GRAD_TILE, w),
+                            VL_MIN((ty + 1) * GRAD_TILE, h)) ;
+      done [ty * tw + tx] = 1 ;
     }
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Update gradients to current GSS octave
+ **
+ ** @param f SIFT filter.
+ **
+ ** The function makes sure that the gradient buffer is up-to-date
+ ** with the current GSS data. The orientation and descriptor
+ ** functions call it on demand; once it has been called for the
+ ** current octave they only read the filter, so that the keypoints
+ ** of the octave can be described by several threads at once.
+ **
+ ** @remark The minimum octave size is 2x2xS.
+ ** @sa ::vl_sift_update_keypoint_gradient.
+ **/
 
-    /* last pixel of the last row */
-    gx = src[0]   - src[-xo] ;
-    gy = src[0]   - src[-yo] ;
-    SAVE_BACK ;
+VL_EXPORT
+void
+vl_sift_update_gradient (VlSiftFilt *f)
+{
+  int w = vl_sift_get_octave_width  (f) ;
+  int h = vl_sift_get_octave_height (f) ;
+  int s ;
+
+  if (f->grad_o == f->o_cur && f->grad_all) return ;
+
+  for (s  = f->s_min + 1 ;
+       s <= f->s_max - 2 ; ++ s) {
+    update_gradient_tiles (f, s, 0, 0, w, h) ;
   }
-  f->grad_o = f->o_cur ;
+  f->grad_all = 1 ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Update gradients around a keypoint
+ **
+ ** @param f SIFT filter.
+ ** @param k keypoint.
+ **
+ ** The function is like ::vl_sift_update_gradient, for the pixels
+ ** the orientation and descriptor of the keypoint @a k read only.
+ ** The gradient is computed by tiles of 32x32 pixels, each one once
+ ** in an octave, so that sparse keypoints do not pay for the whole
+ ** octave. As with ::vl_sift_update_gradient, once it has been called
+ ** for the keypoints of the octave they can be described by several
+ ** threads at once.
+ **
+ ** @sa ::vl_sift_set_lazy_gradient.
+ **/
+
+VL_EXPORT
+void
+vl_sift_update_keypoint_gradient (VlSiftFilt *f, VlSiftKeypoint const *k)
+{
+  double xper  = pow (2.0, f->o_cur) ;
+  double sigma = k-> sigma / xper ;
+  int    xi    = (int) (k-> x / xper + 0.5) ;
+  int    yi    = (int) (k-> y / xper + 0.5) ;
+  int    si    = k-> is ;
+  /* radii of the orientation and descriptor windows */
+  int    Wo    = VL_MAX(floor (3.0 * 1.5 * sigma), 1) ;
+  int    Wd    = floor (sqrt(2.0) * f->magnif * sigma * (NBP + 1) / 2.0 + 0.5) ;
+  int    W     = VL_MAX(Wo, Wd) ;
+
+  if (k->o != f->o_cur || si < f->s_min + 1 || si > f->s_max - 2)
+    return ;
+
+  update_gradient_tiles (f, si, xi - W, yi - W, xi + W + 1, yi + W + 1) ;
 }
 
 /** ------------------------------------------------------------------
@@ -1562,7 +2201,11 @@ vl_sift_calc_keypoint_orientations (VlSiftFilt *f,
   }
 
   /* make gradient up to date */
-  update_gradient (f) ;
+  if (f->grad_lazy) {
+    vl_sift_update_keypoint_gradient (f, k) ;
+  } else {
+    vl_sift_update_gradient (f) ;
+  }
 
   /* clear histogram */
   memset (hist, 0, sizeof(double) * nbins) ;
@@ -1863,27 +2506,25 @@ vl_sift_calc_raw_descriptor (VlSiftFilt const *f,
 }
 
 /** ------------------------------------------------------------------
- ** @brief Compute the descriptor of a keypoint
+ ** @internal
+ ** @brief Compute the descriptor of a keypoint from the gradient
  **
  ** @param f        SIFT filter.
  ** @param descr    SIFT descriptor (output)
  ** @param k        keypoint.
  ** @param angle0   keypoint direction.
  **
- ** The function computes the SIFT descriptor of the keypoint @a k of
- ** orientation @a angle0. The function fills the buffer @a descr
- ** which must be large enough to hold the descriptor.
+ ** The gradient buffer must be up to date around the keypoint.
  **
- ** The function assumes that the keypoint is on the current octave.
- ** If not, it does not do anything.
+ ** @return false if the keypoint is not on the current octave, in
+ ** which case @a descr is not touched.
  **/
 
-VL_EXPORT
-void
-vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
-                                  vl_sift_pix *descr,
-                                  VlSiftKeypoint const* k,
-                                  double angle0)
+static vl_bool
+calc_descriptor (VlSiftFilt const *f,
+                 vl_sift_pix *descr,
+                 VlSiftKeypoint const* k,
+                 double angle0)
 {
   /*
      The SIFT descriptor is a three dimensional histogram of the
@@ -1940,10 +2581,7 @@ vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
      yi    >= h -    1        ||
      si    <  f->s_min + 1    ||
      si    >  f->s_max - 2     )
-    return ;
-
-  /* synchronize gradient buffer */
-  update_gradient (f) ;
+    return 0 ;
 
   /* VL_PRINTF("W = %d ; magnif = %g ; SBP = %g\n", W,magnif,SBP) ; */
 
@@ -2049,7 +2687,109 @@ vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
       normalize_histogram (descr, descr + NBO*NBP*NBP) ;
     }
   }
+  return 1 ;
+}
 
+/** ------------------------------------------------------------------
+ ** @brief Compute the descriptor of a keypoint
+ **
+ ** @param f        SIFT filter.
+ ** @param descr    SIFT descriptor (output)
+ ** @param k        keypoint.
+ ** @param angle0   keypoint direction.
+ **
+ ** The function computes the SIFT descriptor of the keypoint @a k of
+ ** orientation @a angle0. The function fills the buffer @a descr
+ ** which must be large enough to hold the descriptor.
+ **
+ ** The function assumes that the keypoint is on the current octave.
+ ** If not, it does not do anything.
+ **
+ ** @sa ::vl_sift_calc_keypoint_descriptors.
+ **/
+
+VL_EXPORT
+void
+vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
+                                  vl_sift_pix *descr,
+                                  VlSiftKeypoint const* k,
+                                  double angle0)
+{
+  if (k->o != f->o_cur)
+    return ;
+
+  /* synchronize gradient buffer */
+  if (f->grad_lazy) {
+    vl_sift_update_keypoint_gradient (f, k) ;
+  } else {
+    vl_sift_update_gradient (f) ;
+  }
+
+  calc_descriptor (f, descr, k, angle0) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Compute the 8-bit descriptors of several keypoints
+ **
+ ** @param f        SIFT filter.
+ ** @param descrs   SIFT descriptors (output).
+ ** @param stride   bytes from a descriptor to the next in @a descrs.
+ ** @param keys     keypoints.
+ ** @param angles   keypoint directions.
+ ** @param n        number of descriptors.
+ **
+ ** The function computes the descriptor of each keypoint @a keys[i]
+ ** of orientation @a angles[i], as ::vl_sift_calc_keypoint_descriptor,
+ ** and writes it quantized to 8 bits, each component @e d as
+ ** <code>min(512 d, 255)</code>, to the 128 bytes at
+ ** <code>descrs + i * stride</code>. The stride lets the descriptors
+ ** be written straight into the records of the caller.
+ **
+ ** The keypoints are described scale level by scale level, so that the
+ ** gradient of a level is read for all of its keypoints in turn. The
+ ** descriptor of a keypoint which is not on the current octave is set
+ ** to zero. As for ::vl_sift_calc_keypoint_descriptor, several
+ ** threads can describe keypoints of the octave at once, once the
+ ** gradient has been updated for them.
+ **/
+
+VL_EXPORT
+void
+vl_sift_calc_keypoint_descriptors (VlSiftFilt *f,
+                                   vl_uint8 *descrs,
+                                   int stride,
+                                   VlSiftKeypoint const *keys,
+                                   double const *angles,
+                                   int n)
+{
+  vl_sift_pix descr [NBO*NBP*NBP] ;
+  int i, s, bin ;
+
+  /* synchronize gradient buffer */
+  if (f->grad_lazy) {
+    for (i = 0 ; i < n ; ++ i) {
+      vl_sift_update_keypoint_gradient (f, keys + i) ;
+    }
+  } else {
+    vl_sift_update_gradient (f) ;
+  }
+
+  for (i = 0 ; i < n ; ++ i) {
+    memset (descrs + (size_t) i * stride, 0, NBO*NBP*NBP) ;
+  }
+
+  for (s  = f->s_min + 1 ;
+       s <= f->s_max - 2 ; ++ s) {
+    for (i = 0 ; i < n ; ++ i) {
+      vl_uint8 *dst = descrs + (size_t) i * stride ;
+      if (keys [i].is != s ||
+          ! calc_descriptor (f, descr, keys + i, angles [i]))
+        continue ;
+      for (bin = 0 ; bin < NBO*NBP*NBP ; ++ bin) {
+        dst [bin] = (vl_uint8) VL_MIN (512.0F * descr [bin], 255.0F) ;
+      }
+    }
+  }
 }
 
 /** ------------------------------------------------------------------
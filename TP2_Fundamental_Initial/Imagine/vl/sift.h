@@ -15,6 +15,7 @@ General Public License version 2.
 
 #include <stdio.h>
 #include "generic.h"
+#include "imop.h"
 
 /** @brief SIFT filter pixel type */
 typedef float vl_sift_pix ;
@@ -71,6 +72,9 @@ typedef struct _VlSiftFilt
   VlSiftKeypoint* keys ;/**< detected keypoints. */
   int nkeys ;           /**< number of detected keypoints. */
   int keys_res ;        /**< size of the keys buffer. */
+  VlSiftKeypoint* keys_tmp ;/**< keypoints being put in level order. */
+  int keys_tmp_res ;    /**< size of the keys_tmp buffer. */
+  int *cols ;           /**< columns of the extrema of a DoG row. */
 
   double peak_thresh ;  /**< peak threshold. */
   double edge_thresh ;  /**< edge threshold. */
@@ -80,6 +84,17 @@ typedef struct _VlSiftFilt
 
   vl_sift_pix *grad ;   /**< GSS gradient data. */
   int grad_o ;          /**< GSS gradient data octave. */
+  vl_uint8 *grad_done ; /**< GSS gradient tiles up to date. */
+  vl_bool grad_all ;    /**< GSS gradient all up to date. */
+  vl_bool grad_lazy ;   /**< compute gradients around keypoints only. */
+
+  vl_sift_pix *filt ;   /**< Gaussian kernels of the levels. */
+  int *filt_width ;     /**< half widths of the level kernels. */
+  int filt_stride ;     /**< distance between two level kernels. */
+  VlGaussianIir *iir ;  /**< recursive filters of the levels. */
+  double iir_sigma ;    /**< smoothing from which they are used. */
+  vl_sift_pix *scratch ;/**< scratch of the smoothing. */
+  int scratch_size ;    /**< size of the scratch, in pixels. */
 
 } VlSiftFilt ;
 
@@ -108,6 +123,13 @@ int   vl_sift_process_next_octave        (VlSiftFilt *f) ;
 VL_EXPORT
 void  vl_sift_detect                     (VlSiftFilt *f) ;
 
+VL_EXPORT
+void  vl_sift_update_gradient            (VlSiftFilt *f) ;
+
+VL_EXPORT
+void  vl_sift_update_keypoint_gradient   (VlSiftFilt *f,
+                                          VlSiftKeypoint const *k) ;
+
 VL_EXPORT
 int   vl_sift_calc_keypoint_orientations (VlSiftFilt *f, 
                                           double angles [4],
@@ -118,6 +140,14 @@ void  vl_sift_calc_keypoint_descriptor   (VlSiftFilt *f,
                                           VlSiftKeypoint const* k,
                                           double angle) ;
 
+VL_EXPORT
+void  vl_sift_calc_keypoint_descriptors  (VlSiftFilt *f,
+                                          vl_uint8 *descrs,
+                                          int stride,
+                                          VlSiftKeypoint const *keys,
+                                          double const *angles,
+                                          int n) ;
+
 VL_EXPORT
 void  vl_sift_calc_raw_descriptor        (VlSiftFilt const *f,
                                           vl_sift_pix const* image,
@@ -149,6 +179,8 @@ VL_INLINE double vl_sift_get_edge_thresh    (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_norm_thresh    (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_magnif         (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_window_size    (VlSiftFilt const *f) ;
+VL_INLINE double vl_sift_get_iir_sigma      (VlSiftFilt const *f) ;
+VL_INLINE vl_bool vl_sift_get_lazy_gradient (VlSiftFilt const *f) ;
 
 VL_INLINE vl_sift_pix *vl_sift_get_octave  (VlSiftFilt const *f, int s) ;
 VL_INLINE VlSiftKeypoint const *vl_sift_get_keypoints (VlSiftFilt const *f) ;
@@ -162,6 +194,8 @@ VL_INLINE void vl_sift_set_edge_thresh (VlSiftFilt *f, double t) ;
 VL_INLINE void vl_sift_set_norm_thresh (VlSiftFilt *f, double t) ;
 VL_INLINE void vl_sift_set_magnif      (VlSiftFilt *f, double m) ;
 VL_INLINE void vl_sift_set_window_size (VlSiftFilt *f, double m) ;
+VL_INLINE void vl_sift_set_iir_sigma   (VlSiftFilt *f, double s) ;
+VL_INLINE void vl_sift_set_lazy_gradient (VlSiftFilt *f, vl_bool x) ;
 /** @} */
 
 /* -------------------------------------------------------------------
@@ -344,6 +378,30 @@ vl_sift_get_window_size (VlSiftFilt const *f)
   return f -> windowSize ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Get the smoothing from which the recursive filter is used.
+ ** @param f SIFT filter.
+ ** @return smoothing (non positive if never used).
+ **/
+
+VL_INLINE double
+vl_sift_get_iir_sigma (VlSiftFilt const *f) 
+{
+  return f -> iir_sigma ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Are gradients computed around the keypoints only?
+ ** @param f SIFT filter.
+ ** @return true if gradients are computed around the keypoints only.
+ **/
+
+VL_INLINE vl_bool
+vl_sift_get_lazy_gradient (VlSiftFilt const *f) 
+{
+  return f -> grad_lazy ;
+}
+
 
 
 /** ------------------------------------------------------------------
@@ -409,5 +467,37 @@ vl_sift_set_window_size (VlSiftFilt *f, double x)
   f -> windowSize = x ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Set the smoothing from which the recursive filter is used
+ ** @param f SIFT filter.
+ ** @param s smoothing (non positive to never use it).
+ **
+ ** Smoothing steps of the scale space with a deviation of at least
+ ** @a s use ::vl_imsmooth_iir_f rather than ::vl_imsmooth_f. See
+ ** @ref sift-intro-smoothing.
+ **/
+
+VL_INLINE void
+vl_sift_set_iir_sigma (VlSiftFilt *f, double s) 
+{
+  f -> iir_sigma = s ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Compute gradients around the keypoints only
+ ** @param f SIFT filter.
+ ** @param x true to compute gradients around the keypoints only.
+ **
+ ** The orientation and descriptor functions then call
+ ** ::vl_sift_update_keypoint_gradient rather than
+ ** ::vl_sift_update_gradient.
+ **/
+
+VL_INLINE void
+vl_sift_set_lazy_gradient (VlSiftFilt *f, vl_bool x) 
+{
+  f -> grad_lazy = x ;
+}
+
 /* VL_SIFT_H */
 #endif